@@ -0,0 +1,396 @@
+#include "allocation_counter.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_network.hpp"
+#include "atmospherics_profile.hpp"
+#include "atmospherics_reactions.hpp"
+#include "executor.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace ZAtmos;
+using namespace ZAtmos::AtmosphericsDevices;
+
+// Headless benchmarks, one line of JSON (or CSV) per scenario and thread count.
+//   zatmos-bench [--scenario NAME]... [--size N] [--steps N] [--warmup N]
+//                [--threads 1,2,4] [--format json|csv] [--check-allocations] [--list]
+// ns_per_atmosphere_tick and ns_per_device_update time their own phases, so
+// network scenarios only report them when built with ZATMOS_PROFILE (see
+// atmospherics_profile.hpp), and null (empty in CSV) otherwise.
+// --check-allocations fails with exit status 1 as soon as a timed network step
+// allocates (see AtmosphericsNetwork::checkAllocations), it needs a build with
+// ZATMOS_COUNT_ALLOCATIONS. split-merge isn't checked, every split makes a new
+// Atmosphere.
+
+#define CELSIUS(x) (x + 273.15)
+
+struct BenchOptions {
+	std::vector<std::string> scenarios;
+	// atmospheres per scenario
+	std::size_t size = 10000;
+	std::size_t steps = 200;
+	// untimed steps first, so scratch buffers and sleep states settle
+	std::size_t warmup = 20;
+	std::vector<std::size_t> threads { 1 };
+	bool csv = false;
+	double dt = 0.05;
+	// throw std::logic_error from timed network steps that allocate
+	bool checkAllocations = false;
+};
+
+struct BenchResult {
+	std::size_t atmospheres = 0;
+	std::size_t devices = 0;
+	double nsPerStep = 0;
+	// negative if not measured
+	double nsPerAtmosphereTick = -1;
+	double nsPerDeviceUpdate = -1;
+	std::uint64_t allocations = 0;
+};
+
+// Everything a scenario set up, kept alive while it's timed.
+struct BenchWorld {
+	std::vector<std::unique_ptr<Atmosphere>> atmospheres;
+	std::vector<std::unique_ptr<GenericDevice>> devices;
+	AtmosphericsNetwork network;
+
+	Atmosphere &add_atmosphere(double volume)
+	{
+		atmospheres.push_back(std::make_unique<Atmosphere>(volume));
+		network.add_atmosphere(*atmospheres.back());
+		return *atmospheres.back();
+	}
+	template <typename T, typename... Args>
+	T &add_device(Args &&...args)
+	{
+		auto device = std::make_unique<T>(std::forward<Args>(args)...);
+		T &ref = *device;
+		devices.push_back(std::move(device));
+		network.add_device(ref);
+		ref.set(true);
+		return ref;
+	}
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Steps world.network and fills in the timings.
+static BenchResult time_network(BenchWorld &world, BenchOptions const &options, Executor &executor)
+{
+	world.network.set_executor(&executor);
+	world.network.parallelAtmospheres = true;
+	world.network.parallelDevices = true;
+	for (std::size_t i = 0; i < options.warmup; ++i)
+		world.network.step(options.dt);
+	world.network.reset_stats();
+	world.network.checkAllocations = options.checkAllocations;
+	std::uint64_t allocations = allocation_count();
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < options.steps; ++i)
+		world.network.step(options.dt);
+	double elapsed = seconds_since(start);
+	BenchResult result;
+	result.atmospheres = world.network.atmosphere_count();
+	result.devices = world.network.device_count();
+	result.nsPerStep = elapsed * 1e9 / options.steps;
+	result.allocations = allocation_count() - allocations;
+	if constexpr (profiling_enabled()) {
+		// reactions and volume updates per awake atmosphere, the device phase per device
+		NetworkStats const &stats = world.network.total_stats();
+		if (stats.activeAtmospheres > 0)
+			result.nsPerAtmosphereTick = static_cast<double>(stats.reactionNanoseconds + stats.elasticNanoseconds) / stats.activeAtmospheres;
+		if (result.devices > 0)
+			result.nsPerDeviceUpdate = static_cast<double>(stats.deviceNanoseconds) / (result.devices * options.steps);
+	}
+	world.network.set_executor(nullptr);
+	return result;
+}
+
+static AtmosphericsReaction hydrogen_combustion()
+{
+	AtmosphericsReaction reaction(CELSIUS(550), 241920);
+	reaction.add_reactant("hydrogen", 2);
+	reaction.add_reactant("oxygen", 1);
+	reaction.add_product("water", 2);
+	return reaction;
+}
+static void use_reactions(std::vector<AtmosphericsReaction> reactions)
+{
+	atmosphericsReactions = std::move(reactions);
+	atmosphericsReactionIndex.invalidate();
+}
+
+// N sealed tanks of burning hydrogen, nothing connecting them.
+static BenchResult isolated_reactions(BenchOptions const &options, Executor &executor)
+{
+	use_reactions({ hydrogen_combustion() });
+	BenchWorld world;
+	for (std::size_t i = 0; i < options.size; ++i) {
+		Atmosphere &tank = world.add_atmosphere(1000);
+		tank.add_moles_temp("hydrogen", 2000, CELSIUS(900));
+		tank.add_moles_temp("oxygen", 1000, CELSIUS(900));
+		tank.add_moles_temp("nitrogen", 500, CELSIUS(900));
+	}
+	return time_network(world, options, executor);
+}
+
+// One long line of valves with all the gas at one end.
+static BenchResult valve_chain(BenchOptions const &options, Executor &executor)
+{
+	use_reactions({});
+	BenchWorld world;
+	Atmosphere *previous = &world.add_atmosphere(2500);
+	previous->add_moles_temp("nitrogen", 100000, CELSIUS(20));
+	for (std::size_t i = 1; i < options.size; ++i) {
+		Atmosphere &next = world.add_atmosphere(2500);
+		world.add_device<Valve>(*previous, next);
+		previous = &next;
+	}
+	return time_network(world, options, executor);
+}
+
+// Every atmosphere has a few pumps and mixers to random others.
+static BenchResult pump_mixer(BenchOptions const &options, Executor &executor, bool flux)
+{
+	use_reactions({});
+	BenchWorld world;
+	world.network.fluxDevices = flux;
+	std::mt19937 random(1234);
+	for (std::size_t i = 0; i < options.size; ++i) {
+		Atmosphere &atmosphere = world.add_atmosphere(1000);
+		atmosphere.add_moles_temp(i % 2 ? "oxygen" : "nitrogen", 40 + i % 17, CELSIUS(i % 40));
+	}
+	std::uniform_int_distribution<std::size_t> pick(0, options.size - 1);
+	auto other = [&](std::size_t notA, std::size_t notB = SIZE_MAX) {
+		std::size_t index;
+		do
+			index = pick(random);
+		while (index == notA || index == notB);
+		return index;
+	};
+	std::vector<std::string> filter { "oxygen" };
+	for (std::size_t i = 0; i < options.size; ++i) {
+		Atmosphere &here = *world.atmospheres[i];
+		Atmosphere &a = *world.atmospheres[other(i)];
+		std::size_t bIndex = other(i);
+		Atmosphere &b = *world.atmospheres[bIndex];
+		Atmosphere &c = *world.atmospheres[other(i, bIndex)];
+		world.add_device<VolumePump>(here, a, 5);
+		world.add_device<MolarPump>(b, here, 0.5);
+		world.add_device<FilteredVolumePump>(here, c, filter, 3);
+		world.add_device<MolarMixer>(a, b, here, 0.3, 0.2);
+	}
+	return time_network(world, options, executor);
+}
+
+// Every element slot taken, every atmosphere holding all of them, and a
+// chain of reactions between neighbouring species.
+static BenchResult species_rich(BenchOptions const &options, Executor &executor)
+{
+	std::vector<AtmosphericsReaction> reactions;
+	for (std::size_t id = 0; id + 2 < atmosphericsElements.size(); id += 3) {
+		AtmosphericsReaction reaction(CELSIUS(100), 1000);
+		reaction.add_reactant(static_cast<ElementId>(id), 1);
+		reaction.add_reactant(static_cast<ElementId>(id + 1), 1);
+		reaction.add_product(static_cast<ElementId>(id + 2), 1);
+		reaction.reactionSpeed = 0.01;
+		reactions.push_back(reaction);
+	}
+	use_reactions(reactions);
+	BenchWorld world;
+	for (std::size_t i = 0; i < options.size; ++i) {
+		Atmosphere &atmosphere = world.add_atmosphere(1000);
+		for (std::size_t id = 0; id < atmosphericsElements.size(); ++id)
+			atmosphere.add_moles_temp(static_cast<ElementId>(id), 10 + (i + id) % 7, CELSIUS(300));
+	}
+	return time_network(world, options, executor);
+}
+
+// Atmosphere::split and merge back, once per atmosphere per step.
+static BenchResult split_merge(BenchOptions const &options, Executor &executor)
+{
+	(void) executor;
+	use_reactions({});
+	std::vector<std::unique_ptr<Atmosphere>> atmospheres;
+	for (std::size_t i = 0; i < options.size; ++i) {
+		atmospheres.push_back(std::make_unique<Atmosphere>(1000));
+		atmospheres.back()->add_moles_temp("nitrogen", 40, CELSIUS(20));
+		atmospheres.back()->add_moles_temp("oxygen", 10, CELSIUS(20));
+	}
+	auto churn = [&] {
+		for (auto &atmosphere : atmospheres) {
+			Atmosphere part = atmosphere->split(atmosphere->volume / 4);
+			atmosphere->merge(part);
+		}
+	};
+	for (std::size_t i = 0; i < options.warmup; ++i)
+		churn();
+	std::uint64_t allocations = allocation_count();
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < options.steps; ++i)
+		churn();
+	double elapsed = seconds_since(start);
+	BenchResult result;
+	result.atmospheres = atmospheres.size();
+	result.nsPerStep = elapsed * 1e9 / options.steps;
+	// the whole step is atmosphere work here
+	result.nsPerAtmosphereTick = result.nsPerStep / result.atmospheres;
+	result.allocations = allocation_count() - allocations;
+	return result;
+}
+
+struct Scenario {
+	char const *name;
+	char const *description;
+	BenchResult (*run)(BenchOptions const &options, Executor &executor);
+};
+static Scenario const scenarios[] = {
+	{ "isolated-reactions", "sealed tanks of burning hydrogen", isolated_reactions },
+	{ "valve-chain", "one long chain of open valves", valve_chain },
+	{ "pump-mixer", "pumps and mixers between random atmospheres, color batches", [](BenchOptions const &options, Executor &executor) { return pump_mixer(options, executor, false); } },
+	{ "pump-mixer-flux", "the same in two-phase flux mode", [](BenchOptions const &options, Executor &executor) { return pump_mixer(options, executor, true); } },
+	{ "species-rich", "every element in every atmosphere, chained reactions", species_rich },
+	{ "split-merge", "Atmosphere::split and merge churn, single threaded", split_merge },
+};
+
+// Fills the registry up to MAX_ATMOSPHERICS_ELEMENTS, once and before any
+// scenario, so every scenario runs with the same registry.
+static void register_bench_elements()
+{
+	register_atmospherics_builtins();
+	for (std::size_t i = atmosphericsElements.size(); i < MAX_ATMOSPHERICS_ELEMENTS; ++i) {
+		std::string id = "bench-gas-" + std::to_string(i);
+		atmosphericsElements.add(id, AtmosphericsElement(id, "B" + std::to_string(i), 1000 + 10 * i, (10 + i) / 1000.0, 0.02));
+	}
+}
+
+static std::vector<std::size_t> parse_list(char const *text)
+{
+	std::vector<std::size_t> values;
+	for (char const *at = text; *at;) {
+		char *end;
+		values.push_back(std::strtoull(at, &end, 10));
+		if (end == at)
+			throw std::invalid_argument(std::string("Not a list of numbers: ") + text);
+		at = *end == ',' ? end + 1 : end;
+	}
+	return values;
+}
+
+static BenchOptions parse_options(int argc, char **argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&]() -> char const * {
+			if (i + 1 >= argc)
+				throw std::invalid_argument(arg + " needs a value");
+			return argv[++i];
+		};
+		if (arg == "--scenario")
+			options.scenarios.push_back(value());
+		else if (arg == "--size")
+			options.size = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--steps")
+			options.steps = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--warmup")
+			options.warmup = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--threads")
+			options.threads = parse_list(value());
+		else if (arg == "--format")
+			options.csv = std::string(value()) == "csv";
+		else if (arg == "--check-allocations")
+			options.checkAllocations = true;
+		else if (arg == "--list") {
+			for (Scenario const &scenario : scenarios)
+				std::printf("%s\t%s\n", scenario.name, scenario.description);
+			std::exit(0);
+		} else
+			throw std::invalid_argument("Unknown argument " + arg);
+	}
+	for (std::string const &name : options.scenarios) {
+		bool known = false;
+		for (Scenario const &scenario : scenarios)
+			known = known || name == scenario.name;
+		if (!known)
+			throw std::invalid_argument("Unknown scenario " + name + ", see --list");
+	}
+	if (options.size < 4 || options.steps == 0)
+		throw std::invalid_argument("--size has to be at least 4 and --steps at least 1");
+	if (options.checkAllocations && !counting_allocations())
+		throw std::invalid_argument("--check-allocations needs a build with ZATMOS_COUNT_ALLOCATIONS");
+	return options;
+}
+
+// value with 3 decimals, or missing (null in JSON, empty in CSV) if negative
+static std::string format_measure(double value, bool csv)
+{
+	if (value < 0)
+		return csv ? "" : "null";
+	char text[64];
+	std::snprintf(text, sizeof(text), "%.3f", value);
+	return text;
+}
+
+static void print_result(BenchOptions const &options, Scenario const &scenario, std::size_t threads, BenchResult const &result)
+{
+	std::string perAtmosphere = format_measure(result.nsPerAtmosphereTick, options.csv);
+	std::string perDevice = format_measure(result.nsPerDeviceUpdate, options.csv);
+	double allocationsPerStep = static_cast<double>(result.allocations) / options.steps;
+	if (options.csv) {
+		std::printf("%s,%zu,%zu,%zu,%zu,%.1f,%s,%s,%.3f,%d\n", scenario.name, threads, result.atmospheres,
+		            result.devices, options.steps, result.nsPerStep, perAtmosphere.c_str(), perDevice.c_str(),
+		            allocationsPerStep, counting_allocations() ? 1 : 0);
+		return;
+	}
+	std::printf("{\"scenario\":\"%s\",\"threads\":%zu,\"atmospheres\":%zu,\"devices\":%zu,\"steps\":%zu,"
+	            "\"ns_per_step\":%.1f,\"ns_per_atmosphere_tick\":%s,\"ns_per_device_update\":%s,"
+	            "\"allocations_per_step\":%.3f,\"counting_allocations\":%s}\n",
+	            scenario.name, threads, result.atmospheres, result.devices, options.steps, result.nsPerStep,
+	            perAtmosphere.c_str(), perDevice.c_str(), allocationsPerStep, counting_allocations() ? "true" : "false");
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	try {
+		options = parse_options(argc, argv);
+	} catch (std::exception const &error) {
+		std::fprintf(stderr, "zatmos-bench: %s\n", error.what());
+		return 2;
+	}
+	register_bench_elements();
+	if (options.csv)
+		std::printf("scenario,threads,atmospheres,devices,steps,ns_per_step,ns_per_atmosphere_tick,ns_per_device_update,allocations_per_step,counting_allocations\n");
+	for (Scenario const &scenario : scenarios) {
+		if (!options.scenarios.empty()) {
+			bool wanted = false;
+			for (std::string const &name : options.scenarios)
+				wanted = wanted || name == scenario.name;
+			if (!wanted)
+				continue;
+		}
+		for (std::size_t threads : options.threads) {
+			WorkStealingExecutor executor(threads);
+			try {
+				print_result(options, scenario, executor.concurrency(), scenario.run(options, executor));
+			} catch (std::logic_error const &error) {
+				std::fprintf(stderr, "zatmos-bench: %s with %zu threads: %s\n", scenario.name, threads, error.what());
+				return 1;
+			}
+			std::fflush(stdout);
+		}
+	}
+}
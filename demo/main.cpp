@@ -8,6 +8,7 @@
 #include "atmospherics_reactions.hpp"
 #include "atmospherics_element.hpp"
 #include "atmospherics_device.hpp"
+#include "atmospherics_network.hpp"
 
 using namespace ZAtmos;
 
@@ -21,11 +22,11 @@ void draw_atmosphere(Atmosphere const &atmosphere, int x, int y)
 	DrawText(TextFormat("%lfkPa\n\n%lfK", pressure, temp), x + 4, y + 4, 12, BLACK);
 	int ty = y + 32 + 100;
 	for (auto const &entry : atmosphere.contents) {
-		if (!atmosphericsElements.has_key(entry.chemicalId))
-			throw std::invalid_argument("Unknown element " + entry.chemicalId);
-		auto element = atmosphericsElements[entry.chemicalId];
-		double chemPerc = atmosphere.get_percent_pressure(entry.chemicalId) * 100;
-		double moles = atmosphere.get_moles(entry.chemicalId);
+		if (!atmosphericsElements.has_id(entry.elementId))
+			throw std::invalid_argument("Unknown element " + std::to_string(entry.elementId));
+		auto element = atmosphericsElements[entry.elementId];
+		double chemPerc = atmosphere.get_percent_pressure(entry.elementId) * 100;
+		double moles = atmosphere.get_moles(entry.elementId);
 		DrawText(TextFormat("%s: %lf%%\n%lfmol", element->get_short_name().c_str(), chemPerc, moles), x, ty, 32, BLACK);
 		ty += 64;
 	}
@@ -70,6 +71,16 @@ int main()
 	ZAtmos::AtmosphericsDevices::TemperatureController heater(reactionChamber, 10000);
 	cooler.minTemperature = CELSIUS(20);
 
+	AtmosphericsNetwork network;
+	network.add_atmosphere(hydrogenTank);
+	network.add_atmosphere(oxygenTank);
+	network.add_atmosphere(reactionChamber);
+	network.add_atmosphere(waterTank);
+	network.add_device(mixer);
+	network.add_device(h2oFilter);
+	network.add_device(cooler);
+	network.add_device(heater);
+
 	while (!WindowShouldClose()) {
 		BeginDrawing();
 		ClearBackground(WHITE);
@@ -97,13 +108,6 @@ int main()
 			heater.toggle();
 
 		DrawFPS(0, 0);
-		hydrogenTank.tick(dt);
-		oxygenTank.tick(dt);
-		reactionChamber.tick(dt);
-		waterTank.tick(dt);
-		mixer.update(dt);
-		h2oFilter.update(dt);
-		cooler.update(dt);
-		heater.update(dt);
+		network.step(dt);
 	}
 }
@@ -0,0 +1,106 @@
+#include "allocation_counter.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_profile.hpp"
+#include "atmospherics_scenario.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+using namespace ZAtmos;
+
+// Runs a scenario file (see atmospherics_scenario.hpp) headless, then prints
+// throughput and a digest of every atmosphere's final state.
+//   zatmos-run SCENARIO [--steps N] [--dt S] [--threads N] [--check-allocations N] [--quiet]
+// --check-allocations N turns on AtmosphericsNetwork::checkAllocations after
+// the first N steps and exits with status 1 if a later step allocates. It
+// needs a build with ZATMOS_COUNT_ALLOCATIONS.
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: zatmos-run SCENARIO [--steps N] [--dt S] [--threads N] [--check-allocations N] [--quiet]\n");
+		return 2;
+	}
+	Scenario scenario;
+	bool quiet = false;
+	// steps before checkAllocations is turned on, SIZE_MAX for never
+	std::size_t checkAfter = SIZE_MAX;
+	try {
+		scenario.load_file(argv[1]);
+		for (int i = 2; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "--quiet") {
+				quiet = true;
+				continue;
+			}
+			if (i + 1 >= argc)
+				throw std::invalid_argument("Unknown argument " + arg);
+			char const *value = argv[++i];
+			if (arg == "--steps")
+				scenario.steps = std::strtoull(value, nullptr, 10);
+			else if (arg == "--dt")
+				scenario.dt = std::strtod(value, nullptr);
+			else if (arg == "--threads")
+				scenario.threads = std::strtoull(value, nullptr, 10);
+			else if (arg == "--check-allocations")
+				checkAfter = std::strtoull(value, nullptr, 10);
+			else
+				throw std::invalid_argument("Unknown argument " + arg);
+		}
+		if (checkAfter != SIZE_MAX && !counting_allocations())
+			throw std::invalid_argument("--check-allocations needs a build with ZATMOS_COUNT_ALLOCATIONS");
+	} catch (std::exception const &error) {
+		std::fprintf(stderr, "zatmos-run: %s\n", error.what());
+		return 2;
+	}
+
+	std::uint64_t allocations = allocation_count();
+	auto start = std::chrono::steady_clock::now();
+	try {
+		std::size_t warmup = std::min(checkAfter, scenario.steps);
+		scenario.run(warmup);
+		scenario.network.checkAllocations = checkAfter != SIZE_MAX;
+		scenario.run(scenario.steps - warmup);
+	} catch (std::logic_error const &error) {
+		std::fprintf(stderr, "zatmos-run: step %zu: %s\n", scenario.step(), error.what());
+		return 1;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	allocations = allocation_count() - allocations;
+
+	std::size_t atmospheres = scenario.network.atmosphere_count();
+	double steps = static_cast<double>(scenario.steps);
+	std::printf("steps %zu dt %g threads %zu atmospheres %zu devices %zu\n", scenario.steps, scenario.dt,
+	            scenario.threads, atmospheres, scenario.network.device_count());
+	std::printf("seconds %.6f ns_per_step %.1f steps_per_second %.1f atmosphere_ticks_per_second %.1f allocations_per_step %.3f\n",
+	            elapsed, steps > 0 ? elapsed * 1e9 / steps : 0.0, elapsed > 0 ? steps / elapsed : 0.0,
+	            elapsed > 0 ? steps * atmospheres / elapsed : 0.0, steps > 0 ? allocations / steps : 0.0);
+	if constexpr (profiling_enabled()) {
+		NetworkStats const &stats = scenario.network.total_stats();
+		double count = stats.steps > 0 ? static_cast<double>(stats.steps) : 1.0;
+		std::printf("profile ns_per_step %.1f reaction %.1f device %.1f mixing %.1f elastic %.1f\n",
+		            stats.stepNanoseconds / count, stats.reactionNanoseconds / count, stats.deviceNanoseconds / count,
+		            stats.mixingNanoseconds / count, stats.elasticNanoseconds / count);
+		std::printf("profile reactions_fired %" PRIu64 " moles_transferred %.6f devices_skipped %" PRIu64
+		            " active_atmospheres_per_step %.1f\n", stats.reactionsFired, stats.molesTransferred,
+		            stats.devicesSkipped, stats.activeAtmospheres / count);
+	}
+	// combined digest of every atmosphere, in declaration order
+	std::uint64_t world = 14695981039346656037ull;
+	for (std::string const &name : scenario.atmosphereNames) {
+		// merged-away atmospheres hold nothing, report the zone they're part of
+		Atmosphere &atmosphere = scenario.network.zone_of(*scenario.atmospheres[name]);
+		std::uint64_t digest = state_digest(atmosphere);
+		world = (world ^ digest) * 1099511628211ull;
+		if (!quiet)
+			std::printf("atmosphere %s %.6f kPa %.6f K %.6f mol %016" PRIx64 "\n", name.c_str(),
+			            atmosphere.get_pressure(), atmosphere.get_temperature(), atmosphere.get_moles(), digest);
+	}
+	std::printf("digest %016" PRIx64 "\n", world);
+}
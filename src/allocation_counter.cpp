@@ -0,0 +1,72 @@
+#include "allocation_counter.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ZATMOS_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+static std::atomic<std::uint64_t> allocations { 0 };
+
+static void *counted_allocate(std::size_t size, std::size_t alignment)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+	if (alignment <= alignof(std::max_align_t))
+		return std::malloc(size);
+	// aligned_alloc wants a multiple of the alignment
+	return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void *operator new(std::size_t size)
+{
+	if (void *pointer = counted_allocate(size, alignof(std::max_align_t)))
+		return pointer;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (void *pointer = counted_allocate(size, static_cast<std::size_t>(alignment)))
+		return pointer;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+	return counted_allocate(size, alignof(std::max_align_t));
+}
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+	return counted_allocate(size, alignof(std::max_align_t));
+}
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::nothrow_t const &) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::nothrow_t const &) noexcept { std::free(pointer); }
+#endif
+
+namespace ZAtmos {
+std::uint64_t allocation_count()
+{
+#ifdef ZATMOS_COUNT_ALLOCATIONS
+	return allocations.load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
+}
@@ -0,0 +1,23 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <cstdint>
+
+namespace ZAtmos {
+// Built with ZATMOS_COUNT_ALLOCATIONS, the library replaces the global
+// operator new to count every heap allocation made in the process, from any
+// thread. Meant for tests and benchmarks, not production builds.
+// Always 0 otherwise.
+std::uint64_t allocation_count();
+// True if allocation_count() actually counts.
+constexpr bool counting_allocations()
+{
+#ifdef ZATMOS_COUNT_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "atmospherics_element.hpp"
 #include "atmospherics_reactions.hpp"
 #include <algorithm>
+#include <bit>
 #include <cstdio>
 #include <cstdlib>
 #include <stdexcept>
@@ -15,102 +16,129 @@ Atmosphere::Atmosphere(double volume)
 	: volume(volume), tempKelvin(0), contents()
 {
 	id = Atmosphere::currentId++;
+	// room for every registered species, so gas showing up later doesn't allocate mid-step
+	contents.reserve(atmosphericsElements.size());
 	recalculate_dirty();
 }
-void Atmosphere::add_moles_temp(std::string const &chemicalId, double moles, double tempKelvin)
+static ElementId resolve_element(std::string const &chemicalId, char const *action, int atmosphereId)
+{
+	ElementId element;
+	if (!try_element_id(chemicalId, element))
+		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when " + action + " atmosphere " + std::to_string(atmosphereId));
+	return element;
+}
+void Atmosphere::add_moles_temp(ElementId element, double moles, double tempKelvin)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when adding to atmosphere " + std::to_string(id));
-	auto element = atmosphericsElements[chemicalId];
-	add_moles_heat(chemicalId, moles, tempKelvin * moles * element->get_heat_capacity_moles());
+	add_moles_heat(element, moles, tempKelvin * moles * atmosphericsElements[element]->get_heat_capacity_moles());
 }
 void Atmosphere::add_volume(double amount)
 {
+	sleeping = false;
 	volume += amount;
 	volume = std::max(0.0, volume);
-	if (volume <= 0)
+	if (volume <= 0) {
 		contents.clear();
+		recalculate_aggregates();
+	}
 	recalculate_dirty();
 }
-void Atmosphere::add_moles_heat(std::string const &chemicalId, double moles, double heatEnergy)
+void Atmosphere::add_moles_heat(ElementId element, double moles, double heatEnergy)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when adding to atmosphere " + std::to_string(id));
 	// mix gas in
-	for (auto &entry : contents) {
-		if (entry.chemicalId == chemicalId) {
-			entry.moles += moles;
-			goto no_add;
-		}
-	}
-	// couldn't find, add to list
-	contents.push_back(AtmosphericsQuantity(chemicalId, moles));
-no_add:;
+	change_moles(element, moles);
 	// mix temperatures
 	add_heat(heatEnergy);
 }
+void Atmosphere::add_mass_temp(ElementId element, double mass, double tempKelvin)
+{
+	add_mass_heat(element, mass, atmosphericsElements[element]->get_heat_capacity_mass() * mass * tempKelvin);
+}
+void Atmosphere::add_mass_heat(ElementId element, double mass, double heatEnergy)
+{
+	// a / (a/b) = a * b/a = b
+	double moles = mass / atmosphericsElements[element]->get_molar_mass();
+	add_moles_heat(element, moles, heatEnergy);
+}
+void Atmosphere::remove(ElementId element, double moles)
+{
+	if (!contents.has(element))
+		return;
+	double removed = -change_moles(element, -moles);
+	add_heat(-(removed * atmosphericsElements.heat_capacities_moles()[element] * get_temperature()));
+}
+void Atmosphere::remove_without_heat(ElementId element, double moles)
+{
+	change_moles(element, -moles);
+}
+void Atmosphere::remove_all(ElementId element)
+{
+	if (!contents.has(element))
+		return;
+	// mol * J/K·mol * K = J
+	double removed = -change_moles(element, -contents.get(element));
+	add_heat(-(removed * atmosphericsElements.heat_capacities_moles()[element] * get_temperature()));
+}
+void Atmosphere::add_moles_temp(std::string const &chemicalId, double moles, double tempKelvin)
+{
+	add_moles_temp(resolve_element(chemicalId, "adding to", id), moles, tempKelvin);
+}
 void Atmosphere::add_mass_temp(std::string const &chemicalId, double mass, double tempKelvin)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when adding to atmosphere " + std::to_string(id));
-	auto element = atmosphericsElements[chemicalId];
-	add_mass_heat(chemicalId, mass, element->get_heat_capacity_mass() * mass * tempKelvin);
+	add_mass_temp(resolve_element(chemicalId, "adding to", id), mass, tempKelvin);
+}
+void Atmosphere::add_moles_heat(std::string const &chemicalId, double moles, double heatEnergy)
+{
+	add_moles_heat(resolve_element(chemicalId, "adding to", id), moles, heatEnergy);
 }
 void Atmosphere::add_mass_heat(std::string const &chemicalId, double mass, double heatEnergy)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when adding to atmosphere " + std::to_string(id));
-	auto element = atmosphericsElements[chemicalId];
-	// a / (a/b) = a * b/a = b
-	double moles = mass / element->get_molar_mass();
-	add_moles_heat(chemicalId, moles, heatEnergy);
+	add_mass_heat(resolve_element(chemicalId, "adding to", id), mass, heatEnergy);
 }
 void Atmosphere::remove(std::string const &chemicalId, double moles)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when removing from atmosphere " + std::to_string(id));
-	auto element = atmosphericsElements[chemicalId];
-	for (auto v = contents.begin(); v < contents.end(); ++v) {
-		if (v->chemicalId == chemicalId) {
-			if (moles >= v->moles) {
-				contents.erase(v);
-				add_heat(-(v->moles * element->get_heat_capacity_moles() * get_temperature()));
-			} else {
-				v->moles -= moles;
-				add_heat(-(moles * element->get_heat_capacity_moles() * get_temperature()));
-			}
-			return;
-		}
-	}
+	remove(resolve_element(chemicalId, "removing from", id), moles);
 }
 void Atmosphere::remove_without_heat(std::string const &chemicalId, double moles)
 {
-	for (auto v = contents.begin(); v < contents.end(); ++v) {
-		if (v->chemicalId == chemicalId) {
-			if (moles >= v->moles) {
-				contents.erase(v);
-			} else {
-				v->moles -= moles;
-			}
-			return;
-		}
-	}
+	remove_without_heat(resolve_element(chemicalId, "removing from", id), moles);
 }
 void Atmosphere::remove_all(std::string const &chemicalId)
 {
-	if (!atmosphericsElements.has_key(chemicalId))
-		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when removing from atmosphere " + std::to_string(id));
-	auto element = atmosphericsElements[chemicalId];
-	for (auto v = contents.cbegin(); v < contents.cend(); ++v) {
-		if (v->chemicalId == chemicalId) {
-			// mol * J/K·mol * K = J
-			contents.erase(v);
-			add_heat(-(v->moles * element->get_heat_capacity_moles() * get_temperature()));
-			return;
-		}
-	}
+	remove_all(resolve_element(chemicalId, "removing from", id));
 }
 
+double Atmosphere::change_moles(ElementId element, double delta)
+{
+	sleeping = false;
+	double before = contents.get(element);
+	contents.add(element, delta);
+	double change = contents.get(element) - before;
+	if (contents.empty()) {
+		// snap back to exactly 0 so rounding can't accumulate across fills
+		totalMoles = 0;
+		totalMass = 0;
+		massHeatCapacityMoles = 0;
+		massHeatCapacityMass = 0;
+		massThermalConductivity = 0;
+		return change;
+	}
+	double mass = change * atmosphericsElements.molar_masses()[element];
+	totalMoles += change;
+	totalMass += mass;
+	massHeatCapacityMoles += mass * atmosphericsElements.heat_capacities_moles()[element];
+	massHeatCapacityMass += mass * atmosphericsElements.heat_capacities_mass()[element];
+	massThermalConductivity += mass * atmosphericsElements.thermal_conductivities()[element];
+	return change;
+}
+void Atmosphere::recalculate_aggregates()
+{
+	sleeping = false;
+	totalMoles = contents.total_moles();
+	totalMass = contents.total_mass();
+	massHeatCapacityMoles = contents.mass_weighted_sum(atmosphericsElements.heat_capacities_moles());
+	massHeatCapacityMass = contents.mass_weighted_sum(atmosphericsElements.heat_capacities_mass());
+	massThermalConductivity = contents.mass_weighted_sum(atmosphericsElements.thermal_conductivities());
+}
 void Atmosphere::recalculate_dirty()
 {
 	// J / (J / K) = J * K/J = K
@@ -128,6 +156,7 @@ double Atmosphere::get_temperature() const
 }
 void Atmosphere::add_heat(double heatEnergy)
 {
+	sleeping = false;
 	// you cannot go below 0.1 kelvin!
 	if (heatEnergy < 0) {
 		this->heatEnergy = std::max(get_heat_capacity() * minTemperature, this->heatEnergy + heatEnergy);
@@ -138,21 +167,20 @@ void Atmosphere::add_heat(double heatEnergy)
 }
 double Atmosphere::get_moles() const
 {
-	double sum = 0;
-	for (auto const &entry : contents) {
-		sum += entry.moles;
-	}
-	return sum;
+	return totalMoles;
+}
+double Atmosphere::get_moles(ElementId element) const
+{
+	return contents.get(element);
 }
 double Atmosphere::get_moles(std::string const &chemicalId) const
 {
-	for (auto const &entry : contents) {
-		if (entry.chemicalId == chemicalId)
-			return entry.moles;
-	}
-	return 0;
+	ElementId element;
+	if (!try_element_id(chemicalId, element))
+		return 0;
+	return get_moles(element);
 }
-double Atmosphere::get_percent_pressure(std::string const &chemicalId) const
+double Atmosphere::get_percent_pressure(ElementId element) const
 {
 	// PV = nRT
 	// V = nRT/T
@@ -162,26 +190,30 @@ double Atmosphere::get_percent_pressure(std::string const &chemicalId) const
 	// a / (a + b + c)
 	// molar percent is the same as pressure (volume) percent
 	double moles = get_moles();
-	return get_moles(chemicalId) / moles;
+	return get_moles(element) / moles;
+}
+double Atmosphere::get_percent_pressure(std::string const &chemicalId) const
+{
+	return get_moles(chemicalId) / get_moles();
 }
 double Atmosphere::get_mass() const
 {
-	double sum = 0;
-	for (auto const &entry : contents)
-		sum += get_mass(entry.chemicalId);
-	return sum;
+	return totalMass;
+}
+double Atmosphere::get_mass(ElementId element) const
+{
+	return atmosphericsElements.molar_masses()[element] * contents.get(element);
 }
 double Atmosphere::get_mass(std::string const &chemicalId) const
 {
-	for (auto const &entry : contents) {
-		if (entry.chemicalId == chemicalId) {
-			if (!atmosphericsElements.has_key(chemicalId))
-				throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found when calculating mass from atmosphere " + std::to_string(id));
-			auto element = atmosphericsElements[chemicalId];
-			return element->get_molar_mass() * entry.moles;
-		}
-	}
-	return 0;
+	ElementId element;
+	if (!try_element_id(chemicalId, element))
+		return 0;
+	return get_mass(element);
+}
+double Atmosphere::get_percent_mass(ElementId element) const
+{
+	return get_mass(element) / get_mass();
 }
 double Atmosphere::get_percent_mass(std::string const &chemicalId) const
 {
@@ -196,6 +228,11 @@ double Atmosphere::get_pressure() const
 	double energy = get_moles() * gasConstant * tempKelvin; // J
 	return energy / volume;
 }
+double Atmosphere::get_pressure(ElementId element) const
+{
+	double energy = get_moles(element) * gasConstant * tempKelvin;
+	return energy / volume;
+}
 double Atmosphere::get_pressure(std::string const &chemicalId) const
 {
 	double energy = get_moles(chemicalId) * gasConstant * tempKelvin;
@@ -204,46 +241,23 @@ double Atmosphere::get_pressure(std::string const &chemicalId) const
 // J / K·kg
 double Atmosphere::get_specific_heat_mass() const
 {
-	double sum = 0;
-	double totalMass = get_mass();
-	for (auto const &entry : contents) {
-		if (!atmosphericsElements.has_key(entry.chemicalId))
-			throw std::invalid_argument("Atmospherics Element '" + entry.chemicalId + "' not found when calculating heat capacity from atmosphere " + std::to_string(id));
-		auto element = atmosphericsElements[entry.chemicalId];
-		double mass = get_mass(entry.chemicalId);
-		double massRatio = mass / totalMass;
-		sum += massRatio * element->get_heat_capacity_mass();
-	}
-	return sum;
+	// mass-weighted average of each element's specific heat
+	if (totalMass <= 0)
+		return 0;
+	return massHeatCapacityMass / totalMass;
 }
 // J / K·mol
 double Atmosphere::get_specific_heat_moles() const
 {
-	double sum = 0;
-	double totalMass = get_mass();
-	for (auto const &entry : contents) {
-		if (!atmosphericsElements.has_key(entry.chemicalId))
-			throw std::invalid_argument("Atmospherics Element '" + entry.chemicalId + "' not found when calculating heat capacity from atmosphere " + std::to_string(id));
-		auto element = atmosphericsElements[entry.chemicalId];
-		double mass = get_mass(entry.chemicalId);
-		double massRatio = mass / totalMass;
-		sum += massRatio * element->get_heat_capacity_moles();
-	}
-	return sum;
+	if (totalMass <= 0)
+		return 0;
+	return massHeatCapacityMoles / totalMass;
 }
 double Atmosphere::get_thermal_conductivity() const
 {
-	double sum = 0;
-	double totalMass = get_mass();
-	for (auto const &entry : contents) {
-		if (!atmosphericsElements.has_key(entry.chemicalId))
-			throw std::invalid_argument("Atmospherics Element '" + entry.chemicalId + "' not found when calculating thermal conductivity from atmosphere " + std::to_string(id));
-		auto element = atmosphericsElements[entry.chemicalId];
-		double mass = get_mass(entry.chemicalId);
-		double massRatio = mass / totalMass;
-		sum += massRatio * element->get_thermal_conductivity();
-	}
-	return sum;
+	if (totalMass <= 0)
+		return 0;
+	return massThermalConductivity / totalMass;
 }
 // J/K
 double Atmosphere::get_heat_capacity() const
@@ -251,7 +265,7 @@ double Atmosphere::get_heat_capacity() const
 	return get_specific_heat_moles() * get_moles();
 }
 
-void Atmosphere::mix_with(Atmosphere &other, double dt, bool allowBackflow, bool temperatureMix)
+double Atmosphere::get_mix_flow(Atmosphere const &other, double dt) const
 {
 	// keep portion for self, so it doesn't "slosh" back and forth
 	double pressureGradient = 0.1 * (get_pressure() - other.get_pressure());
@@ -259,8 +273,29 @@ void Atmosphere::mix_with(Atmosphere &other, double dt, bool allowBackflow, bool
 	// L/kPa·s
 	double flowMult = maxPressure / (maxPressure + std::abs(pressureGradient));
 	flowMult *= flowMult;
-	double dN = mixRate * flowMult * pressureGradient * dt;
-	if (pressureGradient > 0) {
+	return mixRate * flowMult * pressureGradient * dt;
+}
+double Atmosphere::get_conducted_heat(Atmosphere const &other, double dt) const
+{
+	// keep half for self, so it doesn't "slosh" back and forth
+	// + means flow towards other, - means flow towards this
+	double temperatureGradient = (get_temperature() - other.get_temperature());
+	double distance = 0.01; // arbitrary 1cm distance to "conduct across"
+	double flow = get_thermal_conductivity() * temperatureGradient / distance;
+	double area = 1; // arbitrary 1m^2 conduction area
+	return flow * area * dt * tempMixRate;
+}
+// conductivity is in J/(s · K)
+double Atmosphere::get_conducted_heat_at(Atmosphere const &other, double conductivity, double dt) const
+{
+	// + means flow towards other, - means flow towards this
+	double temperatureGradient = (get_temperature() - other.get_temperature());
+	return conductivity * temperatureGradient * dt * tempMixRate;
+}
+void Atmosphere::mix_with(Atmosphere &other, double dt, bool allowBackflow, bool temperatureMix)
+{
+	double dN = get_mix_flow(other, dt);
+	if (dN > 0) {
 		move_gas_moles(other, dN);
 		if (temperatureMix)
 			mix_temperatures(other, dt);
@@ -272,105 +307,140 @@ void Atmosphere::mix_with(Atmosphere &other, double dt, bool allowBackflow, bool
 }
 void Atmosphere::mix_temperatures(Atmosphere &other, double dt)
 {
-	// keep half for self, so it doesn't "slosh" back and forth
-	// + means flow towards other, - means flow towards this
-	double temperatureGradient = (get_temperature() - other.get_temperature());
-	double distance = 0.01; // arbitrary 1cm distance to "conduct across"
-	double flow = get_thermal_conductivity() * temperatureGradient / distance;
-	double area = 1; // arbitrary 1m^2 conduction area
-	double dT = flow * area * dt * tempMixRate;
+	double dT = get_conducted_heat(other, dt);
 	add_heat(-dT);
 	other.add_heat(dT);
 }
 // conductivity is in J/(s · K)
 void Atmosphere::mix_temperatures_at(Atmosphere &other, double conductivity, double dt)
 {
-	// keep half for self, so it doesn't "slosh" back and forth
-	// + means flow towards other, - means flow towards this
-	double temperatureGradient = (get_temperature() - other.get_temperature());
-	double dT = conductivity * temperatureGradient * dt * tempMixRate;
+	double dT = get_conducted_heat_at(other, conductivity, dt);
 	add_heat(-dT);
 	other.add_heat(dT);
 }
-void Atmosphere::move_gas_moles(Atmosphere &other, double moles)
+void Atmosphere::apply_flux(AtmosphericsFlux const &flux)
 {
-	// PV = nRT
-	// V = nRT/P
-	// V/n = RT/P
-	// n/V = P/RT
-	AtmosphericsMixture moved;
-	for (auto &entry : contents) {
-		double molarPercent = get_percent_pressure(entry.chemicalId);
-		double entryPortion = molarPercent * moles;
-		moved.push_back(AtmosphericsQuantity(entry.chemicalId, entryPortion));
-	}
-
-	double temp = get_temperature();
-
-	for (auto &entry : moved) {
-		other.add_moles_temp(entry.chemicalId, entry.moles, temp);
-		remove(entry.chemicalId, entry.moles);
+	apply_changes(flux.touched, flux.moles.data(), flux.heat);
+}
+void Atmosphere::apply_changes(ElementMask touched, double const *changes, double heat)
+{
+	while (touched != 0) {
+		ElementId element = static_cast<ElementId>(std::countr_zero(touched));
+		touched &= touched - 1;
+		change_moles(element, changes[element]);
 	}
+	add_heat(heat);
+}
+void Atmosphere::move_gas_moles(Atmosphere &other, double moles)
+{
+	if (totalMoles <= 0)
+		return;
+	transfer(other, moles / totalMoles);
 }
 void Atmosphere::move_gas_volume(Atmosphere &other, double volume)
 {
 	// PV = nRT
-	// V = nRT/P
-	// V/n = RT/P
-	// n/V = P/RT
-	AtmosphericsMixture moved;
-	for (auto &entry : contents) {
-		double molesPerVolume = entry.moles / this->volume;
-		double moles = molesPerVolume * volume;
-		moved.push_back(AtmosphericsQuantity(entry.chemicalId, moles));
+	// n/V = P/RT, the same for every element, so moving a volume moves the same
+	// share of each of them
+	if (this->volume <= 0)
+		return;
+	transfer(other, volume / this->volume);
+}
+double Atmosphere::transfer(Atmosphere &other, double fraction)
+{
+	fraction = std::clamp(fraction, 0.0, 1.0);
+	if (fraction <= 0 || totalMoles <= 0 || &other == this)
+		return 0;
+	sleeping = false;
+	other.sleeping = false;
+	double const *moles = contents.data();
+	ElementMask remaining = contents.mask();
+	while (remaining != 0) {
+		ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+		remaining &= remaining - 1;
+		other.contents.add(element, moles[element] * fraction);
 	}
-
+	// every aggregate is a sum over moles, so they scale along with them
+	double moved = totalMoles * fraction;
+	other.totalMoles += moved;
+	other.totalMass += totalMass * fraction;
+	other.massHeatCapacityMoles += massHeatCapacityMoles * fraction;
+	other.massHeatCapacityMass += massHeatCapacityMass * fraction;
+	other.massThermalConductivity += massThermalConductivity * fraction;
+	double heat = heatEnergy * fraction;
+	if (fraction >= 1) {
+		contents.clear();
+		recalculate_aggregates();
+	} else {
+		double kept = 1.0 - fraction;
+		contents.scale(kept);
+		totalMoles *= kept;
+		totalMass *= kept;
+		massHeatCapacityMoles *= kept;
+		massHeatCapacityMass *= kept;
+		massThermalConductivity *= kept;
+	}
+	heatEnergy -= heat;
+	recalculate_dirty();
+	other.add_heat(heat);
+	count_moved(moved);
+	return moved;
+}
+double Atmosphere::transfer(Atmosphere &other, double fraction, ElementMask filter)
+{
+	fraction = std::clamp(fraction, 0.0, 1.0);
+	if (fraction <= 0 || &other == this)
+		return 0;
 	double temp = get_temperature();
-
-	for (auto &entry : moved) {
-		other.add_moles_temp(entry.chemicalId, entry.moles, temp);
-		remove(entry.chemicalId, entry.moles);
+	double heat = 0;
+	double moved = 0;
+	ElementMask remaining = contents.mask() & filter;
+	while (remaining != 0) {
+		ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+		remaining &= remaining - 1;
+		double amount = -change_moles(element, -contents.get(element) * fraction);
+		other.change_moles(element, amount);
+		heat += amount * atmosphericsElements.heat_capacities_moles()[element] * temp;
+		moved += amount;
 	}
+	if (moved <= 0)
+		return 0;
+	add_heat(-heat);
+	other.add_heat(heat);
+	count_moved(moved);
+	return moved;
+}
+bool Atmosphere::has(ElementId element, double atLeastMoles) const
+{
+	return contents.has(element) && contents.get(element) > atLeastMoles;
 }
 bool Atmosphere::has(std::string const &chemicalId, double atLeastMoles) const
 {
-	for (auto const &entry : contents)
-		if (entry.chemicalId == chemicalId)
-			return entry.moles > atLeastMoles;
-	return false;
+	ElementId element;
+	if (!try_element_id(chemicalId, element))
+		return false;
+	return has(element, atLeastMoles);
 }
 
 // used for in-atmosphere reactions, like autoignition and such
 void Atmosphere::tick(double dt)
 {
-	double temp = get_temperature();
-	for (auto reaction : atmosphericsReactions) {
-		for (auto const &reactant : reaction.reactants) {
-			if (!has(reactant.chemicalId))
-				goto next;
-		}
-		if (temp < reaction.autoignitionPoint)
-next:			continue;
-		reaction.do_once(*this, dt);
-	}
+	react(dt);
+	update_volume(dt);
+}
+std::size_t Atmosphere::react(double dt)
+{
+	return atmosphericsReactionIndex.react(*this, dt);
 }
 // forcefully burn the atmosphere if possible
 void Atmosphere::ignite(double dt)
 {
-	for (auto reaction : atmosphericsReactions) {
-		if (!reaction.ignitable) continue;
-		for (auto const &reactant : reaction.reactants) {
-			if (!has(reactant.chemicalId))
-				goto next;
-		}
-		reaction.do_once(*this, dt);
-next:		continue;
-	}
+	atmosphericsReactionIndex.ignite(*this, dt);
 }
 void Atmosphere::empty()
 {
-	while (contents.size() > 0)
-		contents.pop_back();
+	contents.clear();
+	recalculate_aggregates();
 	add_heat(-heatEnergy);
 }
 Atmosphere Atmosphere::split(double splitVolume)
@@ -382,8 +452,7 @@ Atmosphere Atmosphere::split(double splitVolume)
 }
 void Atmosphere::merge(Atmosphere &other)
 {
-	for (auto &entry : other.contents)
-		add_moles_temp(entry.chemicalId, entry.moles, other.tempKelvin);
+	other.transfer(*this, 1);
 	add_volume(other.volume);
 	other.empty();
 	other.volume = 0;
@@ -2,12 +2,31 @@
 #define ATMOSPHERE_HPP
 
 #include <string>
+#include "atmospherics_compiled_reactions.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_flux.hpp"
 #include "atmospherics_mixture.hpp"
 
 namespace ZAtmos {
+// Pressure, temperature and total moles of an atmosphere at one moment.
+struct AtmosphereState {
+	double pressure; // kPa
+	double temperature; // K
+	double moles; // mol
+};
+
 struct Atmosphere {
 private:
 	static int currentId;
+	// Cached aggregates of contents, updated by delta on every add/remove so
+	// totals, heat capacity and pressure are O(1) reads.
+	double totalMoles = 0; // mol
+	double totalMass = 0; // kg
+	double massHeatCapacityMoles = 0; // Σ kg · J / K·mol
+	double massHeatCapacityMass = 0; // Σ kg · J / K·kg
+	double massThermalConductivity = 0; // Σ kg · W / m·K
+	// adds delta moles of element (clamped at 0), returns the actual change
+	double change_moles(ElementId element, double delta);
 public:
 	int id;
 	// J / K·mol
@@ -22,22 +41,50 @@ public:
 	double tempKelvin = 0;
 	double heatEnergy = 0;
 	// K
+	// Only modify through the add/remove methods, or call recalculate_aggregates() after.
 	AtmosphericsMixture contents;
+	// how react() integrates reactions
+	ReactionIntegration reactionIntegration;
+	// Set by AtmosphericsNetwork once this atmosphere reaches equilibrium, so
+	// it can be skipped. Every write through the methods below clears it.
+	bool sleeping = false;
+	// Set by AtmosphericsNetwork for the length of a step in ZATMOS_PROFILE
+	// builds, count_moved() adds up there.
+	double *movedMoles = nullptr;
 
 	Atmosphere(double volume);
+	bool has(ElementId element, double atLeastMoles=0) const;
 	bool has(std::string const &chemicalId, double atLeastMoles=0) const;
 	// used for in-atmosphere reactions, like autoignition and such
+	// also runs update_volume() afterwards
 	virtual void tick(double dt);
+	// only the reaction part of tick(), returns the number of reactions that ran
+	std::size_t react(double dt);
+	// relaxes volume towards its target, no-op for rigid atmospheres
+	inline virtual void update_volume(double dt) { (void) dt; }
+	// true if update_volume() does anything
+	inline virtual bool is_elastic() const { return false; }
+	inline virtual ~Atmosphere() {}
 	// attempt to burn the atmosphere
 	void ignite(double dt=1);
 	void add_volume(double amount);
+	void add_moles_temp(ElementId element, double moles, double tempKelvin);
+	void add_mass_temp(ElementId element, double mass, double tempKelvin);
+	virtual void add_moles_heat(ElementId element, double moles, double heatEnergy);
+	void add_mass_heat(ElementId element, double mass, double heatEnergy);
+	virtual void remove(ElementId element, double moles);
+	virtual void remove_without_heat(ElementId element, double moles);
+	virtual void remove_all(ElementId element);
+
+	// Convenience overloads, these resolve chemicalId through atmosphericsElements
+	// and throw if it isn't registered.
 	void add_moles_temp(std::string const &chemicalId, double moles, double tempKelvin);
 	void add_mass_temp(std::string const &chemicalId, double mass, double tempKelvin);
-	virtual void add_moles_heat(std::string const &chemicalId, double moles, double heatEnergy);
+	void add_moles_heat(std::string const &chemicalId, double moles, double heatEnergy);
 	void add_mass_heat(std::string const &chemicalId, double mass, double heatEnergy);
-	virtual void remove(std::string const &chemicalId, double moles);
-	virtual void remove_without_heat(std::string const &chemicalId, double moles);
-	virtual void remove_all(std::string const &chemicalId);
+	void remove(std::string const &chemicalId, double moles);
+	void remove_without_heat(std::string const &chemicalId, double moles);
+	void remove_all(std::string const &chemicalId);
 
 	// remove all gas from this atmosphere
 	void empty();
@@ -52,8 +99,37 @@ public:
 	void mix_temperatures_at(Atmosphere &other, double conductivity, double dt);
 	void move_gas_volume(Atmosphere &other, double volume);
 	void move_gas_moles(Atmosphere &other, double moles);
+	// Moves fraction (clamped to 0..1) of every element and of heatEnergy to
+	// other in one pass, so this atmosphere keeps its temperature. Returns mol moved.
+	double transfer(Atmosphere &other, double fraction);
+	// Like transfer(), but only for the elements in filter, each taking its
+	// own moles · heat capacity · temperature worth of heat along.
+	double transfer(Atmosphere &other, double fraction, ElementMask filter);
+	// mol that mix_with would move towards other, negative is towards this
+	double get_mix_flow(Atmosphere const &other, double dt) const;
+	// J that mix_temperatures would conduct towards other
+	double get_conducted_heat(Atmosphere const &other, double dt) const;
+	// J that mix_temperatures_at would conduct towards other
+	double get_conducted_heat_at(Atmosphere const &other, double conductivity, double dt) const;
+	// applies the moles (with no heat of their own) and then the heat of flux
+	void apply_flux(AtmosphericsFlux const &flux);
+	// apply_flux() from plain arrays: changes[element] mol for every element in
+	// touched, then heat J
+	void apply_changes(ElementMask touched, double const *changes, double heat);
 
+	inline void wake() { sleeping = false; }
+	// Notes moles moved out of this atmosphere into another, for
+	// NetworkStats::molesTransferred. transfer() calls it, anything moving
+	// gas between atmospheres some other way should too. Does nothing unless
+	// a network is counting, see movedMoles.
+	inline void count_moved(double moles)
+	{
+		if (movedMoles)
+			*movedMoles += moles;
+	}
 	void recalculate_dirty();
+	// Recomputes the cached totals from contents.
+	void recalculate_aggregates();
 	// K
 	double get_temperature() const;
 	// J
@@ -61,18 +137,23 @@ public:
 	// mol
 	double get_moles() const;
 	// mol
+	double get_moles(ElementId element) const;
 	double get_moles(std::string const &chemicalId) const;
 	// kg
 	double get_mass() const;
 	// kg
+	double get_mass(ElementId element) const;
 	double get_mass(std::string const &chemicalId) const;
 	// %
+	double get_percent_pressure(ElementId element) const;
 	double get_percent_pressure(std::string const &chemicalId) const;
 	// %
+	double get_percent_mass(ElementId element) const;
 	double get_percent_mass(std::string const &chemicalId) const;
 	// kPa
 	double get_pressure() const;
 	// kPa
+	double get_pressure(ElementId element) const;
 	double get_pressure(std::string const &chemicalId) const;
 	// J / K·kg
 	double get_specific_heat_mass() const;
@@ -82,6 +163,7 @@ public:
 	double get_heat_capacity() const;
 	// W/K·m
 	double get_thermal_conductivity() const;
+	inline AtmosphereState state() const { return AtmosphereState { get_pressure(), get_temperature(), get_moles() }; }
 };
 }
 
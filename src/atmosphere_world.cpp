@@ -0,0 +1,300 @@
+#include "atmosphere_world.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_reactions.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ZAtmos {
+AtmosphereWorld::AtmosphereWorld()
+{}
+
+void AtmosphereWorld::reserve(std::size_t rows, std::size_t elements)
+{
+	elements = std::max(elements, species);
+	if (rows <= capacity && elements <= species)
+		return;
+	std::size_t newCapacity = std::max(rows, capacity);
+	if (newCapacity > capacity)
+		newCapacity = std::max(newCapacity, capacity * 2);
+	// re-stride the species-major matrix
+	std::vector<double> newMoles(newCapacity * elements, 0.0);
+	for (std::size_t element = 0; element < species; ++element)
+		std::copy(moles.begin() + element * capacity,
+			moles.begin() + element * capacity + size(),
+			newMoles.begin() + element * newCapacity);
+	moles.swap(newMoles);
+	capacity = newCapacity;
+	species = elements;
+}
+
+AtmosphereHandle AtmosphereWorld::add(double volume)
+{
+	std::size_t row = size();
+	reserve(row + 1, atmosphericsElements.size());
+	std::uint32_t slot;
+	if (freeSlots.empty()) {
+		slot = static_cast<std::uint32_t>(slotRows.size());
+		slotRows.push_back(0);
+		slotGenerations.push_back(0);
+	} else {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	slotRows[slot] = static_cast<std::uint32_t>(row);
+	rowSlots.push_back(slot);
+	this->volume.push_back(volume);
+	heatEnergy.push_back(0);
+	tempKelvin.push_back(minTemperature);
+	totalMoles.push_back(0);
+	totalMass.push_back(0);
+	massHeatCapacity.push_back(0);
+	return AtmosphereHandle { slot, slotGenerations[slot] };
+}
+AtmosphereHandle AtmosphereWorld::add(Atmosphere const &atmosphere)
+{
+	AtmosphereHandle handle = add(atmosphere.volume);
+	std::size_t row = this->row(handle);
+	for (auto const &entry : atmosphere.contents)
+		change_moles(row, entry.elementId, entry.moles);
+	heatEnergy[row] = atmosphere.heatEnergy;
+	recalculate_dirty(row);
+	return handle;
+}
+std::size_t AtmosphereWorld::append(std::size_t count, double const *volume, double const *heatEnergy,
+                                    double const *moles, std::size_t stride, std::size_t elements)
+{
+	std::size_t first = size();
+	reserve(first + count, std::max(elements, atmosphericsElements.size()));
+	rowSlots.reserve(first + count);
+	for (std::size_t i = 0; i < count; ++i) {
+		std::uint32_t slot;
+		if (freeSlots.empty()) {
+			slot = static_cast<std::uint32_t>(slotRows.size());
+			slotRows.push_back(0);
+			slotGenerations.push_back(0);
+		} else {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		slotRows[slot] = static_cast<std::uint32_t>(first + i);
+		rowSlots.push_back(slot);
+	}
+	this->volume.insert(this->volume.end(), volume, volume + count);
+	this->heatEnergy.insert(this->heatEnergy.end(), heatEnergy, heatEnergy + count);
+	tempKelvin.resize(first + count, minTemperature);
+	totalMoles.resize(first + count, 0);
+	totalMass.resize(first + count, 0);
+	massHeatCapacity.resize(first + count, 0);
+	// one column at a time, the same sums change_moles() keeps
+	for (std::size_t element = 0; element < elements; ++element) {
+		double const *from = moles + element * stride;
+		double *to = species_moles(static_cast<ElementId>(element)) + first;
+		double molarMass = atmosphericsElements.molar_masses()[element];
+		double heatCapacity = atmosphericsElements.heat_capacities_moles()[element];
+		for (std::size_t i = 0; i < count; ++i) {
+			double amount = std::max(0.0, from[i]);
+			double mass = amount * molarMass;
+			to[i] = amount;
+			totalMoles[first + i] += amount;
+			totalMass[first + i] += mass;
+			massHeatCapacity[first + i] += mass * heatCapacity;
+		}
+	}
+	for (std::size_t i = 0; i < count; ++i)
+		recalculate_dirty(first + i);
+	return first;
+}
+void AtmosphereWorld::remove(AtmosphereHandle handle)
+{
+	std::size_t row = this->row(handle);
+	std::size_t last = size() - 1;
+	if (row != last) {
+		// move the last row into the hole to keep rows dense
+		volume[row] = volume[last];
+		heatEnergy[row] = heatEnergy[last];
+		tempKelvin[row] = tempKelvin[last];
+		totalMoles[row] = totalMoles[last];
+		totalMass[row] = totalMass[last];
+		massHeatCapacity[row] = massHeatCapacity[last];
+		for (std::size_t element = 0; element < species; ++element)
+			moles[element * capacity + row] = moles[element * capacity + last];
+		rowSlots[row] = rowSlots[last];
+		slotRows[rowSlots[row]] = static_cast<std::uint32_t>(row);
+	}
+	for (std::size_t element = 0; element < species; ++element)
+		moles[element * capacity + last] = 0;
+	volume.pop_back();
+	heatEnergy.pop_back();
+	tempKelvin.pop_back();
+	totalMoles.pop_back();
+	totalMass.pop_back();
+	massHeatCapacity.pop_back();
+	rowSlots.pop_back();
+	++slotGenerations[handle.slot];
+	freeSlots.push_back(handle.slot);
+}
+bool AtmosphereWorld::valid(AtmosphereHandle handle) const
+{
+	return handle.slot < slotRows.size() && slotGenerations[handle.slot] == handle.generation;
+}
+std::size_t AtmosphereWorld::row(AtmosphereHandle handle) const
+{
+	if (!valid(handle))
+		throw std::invalid_argument("Atmosphere handle " + std::to_string(handle.slot) + " is not valid in this world");
+	return slotRows[handle.slot];
+}
+AtmosphereHandle AtmosphereWorld::handle(std::size_t row) const
+{
+	std::uint32_t slot = rowSlots[row];
+	return AtmosphereHandle { slot, slotGenerations[slot] };
+}
+
+double AtmosphereWorld::change_moles(std::size_t row, ElementId element, double delta)
+{
+	reserve(size(), static_cast<std::size_t>(element) + 1);
+	double &amount = moles[element * capacity + row];
+	double before = amount;
+	amount = std::max(0.0, amount + delta);
+	double change = amount - before;
+	double mass = change * atmosphericsElements.molar_masses()[element];
+	totalMoles[row] += change;
+	totalMass[row] += mass;
+	massHeatCapacity[row] += mass * atmosphericsElements.heat_capacities_moles()[element];
+	if (totalMoles[row] <= 0) {
+		totalMoles[row] = 0;
+		totalMass[row] = 0;
+		massHeatCapacity[row] = 0;
+	}
+	return change;
+}
+void AtmosphereWorld::recalculate_dirty(std::size_t row)
+{
+	double heatCapacity = totalMass[row] > 0 ? totalMoles[row] * massHeatCapacity[row] / totalMass[row] : 0;
+	if (heatEnergy[row] <= 0 || heatCapacity <= 0) {
+		tempKelvin[row] = minTemperature;
+		heatEnergy[row] = 0;
+	} else {
+		tempKelvin[row] = heatEnergy[row] / heatCapacity;
+	}
+}
+
+void AtmosphereWorld::add_moles_temp(AtmosphereHandle handle, ElementId element, double moles, double tempKelvin)
+{
+	add_moles_heat(handle, element, moles, tempKelvin * moles * atmosphericsElements.heat_capacities_moles()[element]);
+}
+void AtmosphereWorld::add_moles_heat(AtmosphereHandle handle, ElementId element, double moles, double heatEnergy)
+{
+	std::size_t row = this->row(handle);
+	change_moles(row, element, moles);
+	add_heat(handle, heatEnergy);
+}
+void AtmosphereWorld::remove(AtmosphereHandle handle, ElementId element, double moles)
+{
+	std::size_t row = this->row(handle);
+	double removed = -change_moles(row, element, -moles);
+	add_heat(handle, -(removed * atmosphericsElements.heat_capacities_moles()[element] * tempKelvin[row]));
+}
+void AtmosphereWorld::add_heat(AtmosphereHandle handle, double heatEnergy)
+{
+	std::size_t row = this->row(handle);
+	// same floor as Atmosphere::add_heat
+	if (heatEnergy < 0)
+		this->heatEnergy[row] = std::max(get_heat_capacity(handle) * minTemperature, this->heatEnergy[row] + heatEnergy);
+	else
+		this->heatEnergy[row] += heatEnergy;
+	recalculate_dirty(row);
+}
+void AtmosphereWorld::copy_to(AtmosphereHandle handle, Atmosphere &atmosphere) const
+{
+	std::size_t row = this->row(handle);
+	atmosphere.empty();
+	atmosphere.volume = volume[row];
+	for (std::size_t element = 0; element < species; ++element) {
+		double amount = moles[element * capacity + row];
+		if (amount > 0)
+			atmosphere.add_moles_heat(static_cast<ElementId>(element), amount, 0);
+	}
+	atmosphere.add_heat(heatEnergy[row]);
+}
+
+double AtmosphereWorld::get_moles(AtmosphereHandle handle) const
+{
+	return totalMoles[row(handle)];
+}
+double AtmosphereWorld::get_moles(AtmosphereHandle handle, ElementId element) const
+{
+	if (element >= species)
+		return 0;
+	return moles[element * capacity + row(handle)];
+}
+double AtmosphereWorld::get_temperature(AtmosphereHandle handle) const
+{
+	return tempKelvin[row(handle)];
+}
+double AtmosphereWorld::get_pressure(AtmosphereHandle handle) const
+{
+	std::size_t row = this->row(handle);
+	if (volume[row] == 0)
+		return 0;
+	return totalMoles[row] * gasConstant * tempKelvin[row] / volume[row];
+}
+double AtmosphereWorld::get_heat_capacity(AtmosphereHandle handle) const
+{
+	std::size_t row = this->row(handle);
+	if (totalMass[row] <= 0)
+		return 0;
+	return totalMoles[row] * massHeatCapacity[row] / totalMass[row];
+}
+
+void AtmosphereWorld::tick(double dt)
+{
+	atmosphericsReactionIndex.update();
+	CompiledReactionSet const &reactions = atmosphericsReactionIndex.compiled();
+	// make sure every species a reaction can produce has a row in moles
+	reserve(size(), atmosphericsElements.size());
+	std::vector<ElementId> const &columns = reactions.species();
+	std::size_t width = reactions.column_count();
+	std::size_t block = std::max<std::size_t>(1, reactionBlock);
+	double const *columnMoles[MAX_ATMOSPHERICS_ELEMENTS];
+	for (std::size_t start = 0; start < size(); start += block) {
+		std::size_t count = std::min(block, size() - start);
+		double const *temperatures = tempKelvin.data() + start;
+		std::size_t active = reactions.active_count(*std::max_element(temperatures, temperatures + count));
+		if (active == 0)
+			continue;
+		for (std::size_t column = 0; column < width; ++column)
+			columnMoles[column] = species_moles(columns[column]) + start;
+		reactionRates.resize(active * count);
+		reactionDeltas.resize(width * count);
+		reactionHeat.resize(count);
+		reactions.evaluate(active, count, temperatures, columnMoles, dt, reactionRates.data());
+		reactions.apply_rates(active, count, reactionRates.data(), dt, reactionDeltas.data(), reactionHeat.data());
+		for (std::size_t i = 0; i < count; ++i) {
+			std::size_t row = start + i;
+			bool changed = reactionHeat[i] != 0;
+			for (std::size_t column = 0; column < width; ++column) {
+				double delta = reactionDeltas[column * count + i];
+				if (delta != 0) {
+					change_moles(row, columns[column], delta);
+					changed = true;
+				}
+			}
+			if (!changed)
+				continue;
+			// same floor as Atmosphere::add_heat
+			double released = reactionHeat[i];
+			double heatCapacity = totalMass[row] > 0 ? totalMoles[row] * massHeatCapacity[row] / totalMass[row] : 0;
+			if (released < 0)
+				heatEnergy[row] = std::max(heatCapacity * minTemperature, heatEnergy[row] + released);
+			else
+				heatEnergy[row] += released;
+			recalculate_dirty(row);
+		}
+	}
+}
+}
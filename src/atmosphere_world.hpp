@@ -0,0 +1,122 @@
+#ifndef ATMOSPHERE_WORLD_HPP
+#define ATMOSPHERE_WORLD_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ZAtmos {
+// Stable reference to an atmosphere stored in an AtmosphereWorld. Stays valid
+// until that atmosphere is removed, even though its storage row may move.
+struct AtmosphereHandle {
+	std::uint32_t slot = UINT32_MAX;
+	std::uint32_t generation = 0;
+	inline bool operator==(AtmosphereHandle const &other) const
+	{
+		return slot == other.slot && generation == other.generation;
+	}
+	inline bool operator!=(AtmosphereHandle const &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Stores many atmospheres as structure-of-arrays: one contiguous array per
+// field indexed by row, and a species-by-atmosphere moles matrix, so a whole
+// world can be ticked with linear sweeps instead of per-object calls.
+// Rows are kept dense (removal swaps the last row in), so use handles to
+// refer to atmospheres across additions and removals.
+struct AtmosphereWorld {
+private:
+	// slot -> row, plus generation to detect stale handles
+	std::vector<std::uint32_t> slotRows;
+	std::vector<std::uint32_t> slotGenerations;
+	std::vector<std::uint32_t> freeSlots;
+	// row -> slot
+	std::vector<std::uint32_t> rowSlots;
+	// rows allocated per species in moles
+	std::size_t capacity = 0;
+	// species allocated in moles
+	std::size_t species = 0;
+	// scratch for tick(), one block of rows at a time
+	std::vector<double> reactionRates;
+	std::vector<double> reactionDeltas;
+	std::vector<double> reactionHeat;
+
+	void reserve(std::size_t rows, std::size_t elements);
+	// adds delta moles of element to row (clamped at 0), returns the actual change
+	double change_moles(std::size_t row, ElementId element, double delta);
+	void recalculate_dirty(std::size_t row);
+public:
+	// J / K·mol
+	double gasConstant = 8.31446261815324;
+	double minTemperature = 0.001; // K
+
+	// L
+	std::vector<double> volume;
+	// J
+	std::vector<double> heatEnergy;
+	// K
+	std::vector<double> tempKelvin;
+	// mol
+	std::vector<double> totalMoles;
+	// kg
+	std::vector<double> totalMass;
+	// Σ kg · J / K·mol, heat capacity is totalMoles · massHeatCapacity / totalMass
+	std::vector<double> massHeatCapacity;
+	// mol, moles[element * stride() + row]
+	std::vector<double> moles;
+
+	AtmosphereWorld();
+
+	// Number of atmospheres, rows are [0, size())
+	inline std::size_t size() const { return rowSlots.size(); }
+	// Distance between species in moles
+	inline std::size_t stride() const { return capacity; }
+	inline double *species_moles(ElementId element) { return moles.data() + element * capacity; }
+	inline double const *species_moles(ElementId element) const { return moles.data() + element * capacity; }
+
+	AtmosphereHandle add(double volume);
+	// copies volume, heat and contents of atmosphere into a new row
+	AtmosphereHandle add(Atmosphere const &atmosphere);
+	// Adds count atmospheres at once, atmosphere i with volume[i] L,
+	// heatEnergy[i] J and moles[element * stride + i] mol of each of the
+	// first elements elements. Returns the row of the first one.
+	std::size_t append(std::size_t count, double const *volume, double const *heatEnergy,
+	                   double const *moles, std::size_t stride, std::size_t elements);
+	// Throws if handle is stale.
+	void remove(AtmosphereHandle handle);
+	bool valid(AtmosphereHandle handle) const;
+	// Throws if handle is stale.
+	std::size_t row(AtmosphereHandle handle) const;
+	AtmosphereHandle handle(std::size_t row) const;
+
+	void add_moles_temp(AtmosphereHandle handle, ElementId element, double moles, double tempKelvin);
+	void add_moles_heat(AtmosphereHandle handle, ElementId element, double moles, double heatEnergy);
+	void remove(AtmosphereHandle handle, ElementId element, double moles);
+	// J
+	void add_heat(AtmosphereHandle handle, double heatEnergy);
+	// copies the stored state into atmosphere, replacing its contents
+	void copy_to(AtmosphereHandle handle, Atmosphere &atmosphere) const;
+
+	// mol
+	double get_moles(AtmosphereHandle handle) const;
+	// mol
+	double get_moles(AtmosphereHandle handle, ElementId element) const;
+	// K
+	double get_temperature(AtmosphereHandle handle) const;
+	// kPa
+	double get_pressure(AtmosphereHandle handle) const;
+	// J / K
+	double get_heat_capacity(AtmosphereHandle handle) const;
+
+	// runs atmosphericsReactions over every atmosphere, the same as Atmosphere::tick
+	void tick(double dt);
+	// rows per batch handed to CompiledReactionSet in tick()
+	std::size_t reactionBlock = 256;
+};
+}
+
+#endif
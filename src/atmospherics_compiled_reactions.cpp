@@ -0,0 +1,463 @@
+#include "atmospherics_compiled_reactions.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_flux.hpp"
+#include "atmospherics_reactions.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+namespace ZAtmos {
+// Scratch for up to this many reactions at once lives on the stack, bigger
+// batches fall back to per-thread buffers that only grow.
+static constexpr std::size_t STACK_RATES = 64;
+
+CompiledReactionSet::CompiledReactionSet()
+{}
+CompiledReactionSet::CompiledReactionSet(std::vector<AtmosphericsReaction> const &reactions)
+{
+	compile(reactions);
+}
+void CompiledReactionSet::compile(std::vector<AtmosphericsReaction> const &reactions)
+{
+	std::vector<std::size_t> order(reactions.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+		return reactions[a].autoignitionPoint < reactions[b].autoignitionPoint;
+	});
+	// every species any reaction touches gets a column
+	ElementMask used = 0;
+	for (auto const &reaction : reactions) {
+		for (auto const &reactant : reaction.reactants)
+			used |= element_bit(reactant.elementId);
+		for (auto const &product : reaction.products)
+			used |= element_bit(product.elementId);
+	}
+	std::size_t columnOf[MAX_ATMOSPHERICS_ELEMENTS];
+	columns.clear();
+	for (ElementId element = 0; element < MAX_ATMOSPHERICS_ELEMENTS; ++element) {
+		if (used & element_bit(element)) {
+			columnOf[element] = columns.size();
+			columns.push_back(element);
+		}
+	}
+
+	std::size_t width = columns.size();
+	autoignitionPoints.clear();
+	reactionSpeeds.clear();
+	energiesReleased.clear();
+	reactantMasks.clear();
+	reactants.assign(reactions.size() * width, 0.0);
+	stoichiometry.assign(reactions.size() * width, 0.0);
+	for (std::size_t row = 0; row < order.size(); ++row) {
+		AtmosphericsReaction const &reaction = reactions[order[row]];
+		autoignitionPoints.push_back(reaction.autoignitionPoint);
+		reactionSpeeds.push_back(reaction.reactionSpeed);
+		energiesReleased.push_back(reaction.energyReleased);
+		ElementMask mask = 0;
+		for (auto const &reactant : reaction.reactants) {
+			reactants[row * width + columnOf[reactant.elementId]] += reactant.moles;
+			stoichiometry[row * width + columnOf[reactant.elementId]] -= reactant.moles;
+			mask |= element_bit(reactant.elementId);
+		}
+		reactantMasks.push_back(mask);
+		for (auto const &product : reaction.products)
+			stoichiometry[row * width + columnOf[product.elementId]] += product.moles;
+	}
+}
+std::size_t CompiledReactionSet::active_count(double temperature) const
+{
+	return std::upper_bound(autoignitionPoints.begin(), autoignitionPoints.end(), temperature) - autoignitionPoints.begin();
+}
+std::size_t CompiledReactionSet::present_rows(std::size_t active, ElementMask present, std::size_t *rows) const
+{
+	std::size_t count = 0;
+	for (std::size_t row = 0; row < active; ++row) {
+		if ((reactantMasks[row] & ~present) == 0)
+			rows[count++] = row;
+	}
+	return count;
+}
+
+void CompiledReactionSet::evaluate(std::size_t reactionCount, std::size_t count, double const *temperatures,
+	double const *const *moles, double dt, double *rates, std::size_t const *rows) const
+{
+	std::size_t width = columns.size();
+	for (std::size_t reaction = 0; reaction < reactionCount; ++reaction) {
+		std::size_t row = rows ? rows[reaction] : reaction;
+		double *rate = rates + reaction * count;
+		double autoignitionPoint = autoignitionPoints[row];
+		// faster the hotter the reaction is, same as AtmosphericsReaction::do_once
+		double speedPerKelvin = reactionSpeeds[row] / autoignitionPoint;
+		for (std::size_t i = 0; i < count; ++i)
+			rate[i] = temperatures[i] >= autoignitionPoint ? 1.0 : 0.0;
+		// limiting reactant, as a fraction of the full speed
+		double const *used = reactants.data() + row * width;
+		for (std::size_t column = 0; column < width; ++column) {
+			if (used[column] <= 0)
+				continue;
+			double const *available = moles[column];
+			for (std::size_t i = 0; i < count; ++i) {
+				double wanted = used[column] * speedPerKelvin * temperatures[i];
+				double possible = available[i] > 0 ? available[i] / wanted : 0.0;
+				rate[i] = std::min(rate[i], possible);
+			}
+		}
+		for (std::size_t i = 0; i < count; ++i)
+			rate[i] *= speedPerKelvin * temperatures[i];
+	}
+
+	// reactions sharing a reactant can still use up more than there is
+	// between them, so scale down every reaction using an overdrawn species
+	double stackConsumed[MAX_ATMOSPHERICS_ELEMENTS];
+	thread_local std::vector<double> heapConsumed;
+	double *consumed = stackConsumed;
+	if (width * count > MAX_ATMOSPHERICS_ELEMENTS) {
+		heapConsumed.resize(width * count);
+		consumed = heapConsumed.data();
+	}
+	std::fill(consumed, consumed + width * count, 0.0);
+	for (std::size_t reaction = 0; reaction < reactionCount; ++reaction) {
+		double const *rate = rates + reaction * count;
+		double const *used = reactants.data() + (rows ? rows[reaction] : reaction) * width;
+		for (std::size_t column = 0; column < width; ++column) {
+			if (used[column] <= 0)
+				continue;
+			double *total = consumed + column * count;
+			for (std::size_t i = 0; i < count; ++i)
+				total[i] += used[column] * rate[i] * dt;
+		}
+	}
+	for (std::size_t column = 0; column < width; ++column) {
+		double *total = consumed + column * count;
+		double const *available = moles[column];
+		// reuse consumed as the scale for this species
+		for (std::size_t i = 0; i < count; ++i)
+			total[i] = total[i] > available[i] ? available[i] / total[i] : 1.0;
+	}
+	for (std::size_t reaction = 0; reaction < reactionCount; ++reaction) {
+		double *rate = rates + reaction * count;
+		double const *used = reactants.data() + (rows ? rows[reaction] : reaction) * width;
+		for (std::size_t column = 0; column < width; ++column) {
+			if (used[column] <= 0)
+				continue;
+			double const *scale = consumed + column * count;
+			for (std::size_t i = 0; i < count; ++i)
+				rate[i] *= scale[i];
+		}
+	}
+}
+void CompiledReactionSet::apply_rates(std::size_t reactionCount, std::size_t count, double const *rates, double dt,
+	double *deltas, double *heat, std::size_t const *rows) const
+{
+	std::size_t width = columns.size();
+	std::fill(deltas, deltas + width * count, 0.0);
+	std::fill(heat, heat + count, 0.0);
+	for (std::size_t reaction = 0; reaction < reactionCount; ++reaction) {
+		std::size_t row = rows ? rows[reaction] : reaction;
+		double const *rate = rates + reaction * count;
+		double const *change = stoichiometry.data() + row * width;
+		for (std::size_t column = 0; column < width; ++column) {
+			if (change[column] == 0)
+				continue;
+			double *delta = deltas + column * count;
+			for (std::size_t i = 0; i < count; ++i)
+				delta[i] += change[column] * rate[i] * dt;
+		}
+		double energy = energiesReleased[row];
+		for (std::size_t i = 0; i < count; ++i)
+			heat[i] += energy * rate[i] * dt;
+	}
+}
+
+std::size_t CompiledReactionSet::react(Atmosphere &atmosphere, double dt) const
+{
+	double temperature = atmosphere.get_temperature();
+	std::size_t active = active_count(temperature);
+	if (active == 0)
+		return 0;
+	std::size_t stackRows[STACK_RATES];
+	double stackRates[STACK_RATES];
+	thread_local std::vector<std::size_t> heapRows;
+	thread_local std::vector<double> heapRates;
+	std::size_t *rows = stackRows;
+	double *rates = stackRates;
+	if (active > STACK_RATES) {
+		heapRows.resize(active);
+		heapRates.resize(active);
+		rows = heapRows.data();
+		rates = heapRates.data();
+	}
+	// only the reactions with every reactant present, one AND each
+	active = present_rows(active, atmosphere.contents.mask(), rows);
+	if (active == 0)
+		return 0;
+	std::size_t width = columns.size();
+	double moles[MAX_ATMOSPHERICS_ELEMENTS];
+	double const *columnMoles[MAX_ATMOSPHERICS_ELEMENTS];
+	for (std::size_t column = 0; column < width; ++column) {
+		moles[column] = atmosphere.contents.get(columns[column]);
+		columnMoles[column] = &moles[column];
+	}
+	evaluate(active, 1, &temperature, columnMoles, dt, rates, rows);
+	std::size_t running = std::count_if(rates, rates + active, [](double rate) { return rate > 0; });
+	if (running == 0)
+		return 0;
+	double deltas[MAX_ATMOSPHERICS_ELEMENTS];
+	double heat;
+	apply_rates(active, 1, rates, dt, deltas, &heat, rows);
+	// by ElementId, like AtmosphericsFlux::moles
+	double changes[MAX_ATMOSPHERICS_ELEMENTS];
+	ElementMask touched = 0;
+	for (std::size_t column = 0; column < width; ++column) {
+		if (deltas[column] != 0) {
+			changes[columns[column]] = deltas[column];
+			touched |= element_bit(columns[column]);
+		}
+	}
+	atmosphere.apply_changes(touched, changes, heat);
+	return running;
+}
+
+// What the heat capacity of an atmosphere depends on during implicit
+// integration: its aggregates at the start plus the change in each column.
+struct CompiledReactionSet::IntegrationState {
+	std::size_t width;
+	double startMoles[MAX_ATMOSPHERICS_ELEMENTS];
+	double molarMasses[MAX_ATMOSPHERICS_ELEMENTS]; // kg/mol
+	double heatCapacities[MAX_ATMOSPHERICS_ELEMENTS]; // J/K·mol
+	double totalMoles; // mol
+	double totalMass; // kg
+	double massHeatCapacity; // Σ kg · J/K·mol
+	double minTemperature; // K
+
+	// J/K at y, and optionally its derivative by each column's moles
+	inline double heat_capacity(double const *y, double *derivative = nullptr) const
+	{
+		double moles = totalMoles, mass = totalMass, weighted = massHeatCapacity;
+		for (std::size_t column = 0; column < width; ++column) {
+			double change = y[column] - startMoles[column];
+			moles += change;
+			mass += change * molarMasses[column];
+			weighted += change * molarMasses[column] * heatCapacities[column];
+		}
+		if (mass <= 0 || moles <= 0) {
+			if (derivative)
+				std::fill(derivative, derivative + width, 0.0);
+			return 0;
+		}
+		// same mass-weighted formula as Atmosphere::get_heat_capacity
+		if (derivative) {
+			for (std::size_t column = 0; column < width; ++column) {
+				double massChange = molarMasses[column];
+				derivative[column] = weighted / mass
+					+ moles * massChange * heatCapacities[column] / mass
+					- moles * weighted * massChange / (mass * mass);
+			}
+		}
+		return moles * weighted / mass;
+	}
+};
+
+void CompiledReactionSet::derivatives(IntegrationState const &state, double const *y, double *f, double *jacobian,
+	std::size_t *running) const
+{
+	std::size_t width = state.width;
+	std::size_t size = width + 1;
+	double capacityChange[MAX_ATMOSPHERICS_ELEMENTS];
+	double capacity = state.heat_capacity(y, capacityChange);
+	double temperature = capacity > 0 ? std::max(state.minTemperature, y[width] / capacity) : state.minTemperature;
+	std::size_t active = active_count(temperature);
+	double const *columnMoles[MAX_ATMOSPHERICS_ELEMENTS];
+	ElementMask present = 0;
+	for (std::size_t column = 0; column < width; ++column) {
+		columnMoles[column] = &y[column];
+		if (y[column] > 0)
+			present |= element_bit(columns[column]);
+	}
+	std::size_t stackRows[STACK_RATES];
+	double stackRates[STACK_RATES];
+	thread_local std::vector<std::size_t> heapRows;
+	thread_local std::vector<double> heapRates;
+	std::size_t *rows = stackRows;
+	double *rates = stackRates;
+	if (active > STACK_RATES) {
+		heapRows.resize(active);
+		heapRates.resize(active);
+		rows = heapRows.data();
+		rates = heapRates.data();
+	}
+	active = present_rows(active, present, rows);
+	if (jacobian)
+		std::fill(jacobian, jacobian + size * size, 0.0);
+	if (active == 0) {
+		std::fill(f, f + size, 0.0);
+		if (running)
+			*running = 0;
+		return;
+	}
+	// dt = 0 leaves out the overdraw scaling, the implicit step takes care of that
+	evaluate(active, 1, &temperature, columnMoles, 0, rates, rows);
+	apply_rates(active, 1, rates, 1, f, f + width, rows);
+	if (running)
+		*running = std::count_if(rates, rates + active, [](double rate) { return rate > 0; });
+	if (!jacobian)
+		return;
+
+	// each rate is min(speed · T / autoignition, moles / used) over its
+	// reactants, so it only depends on whichever of those is smaller
+	double rateChange[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	for (std::size_t reaction = 0; reaction < active; ++reaction) {
+		if (rates[reaction] <= 0)
+			continue;
+		std::size_t index = rows[reaction];
+		double const *used = reactants.data() + index * width;
+		double speedPerKelvin = reactionSpeeds[index] / autoignitionPoints[index];
+		std::fill(rateChange, rateChange + size, 0.0);
+		std::size_t limiting = width;
+		double limit = speedPerKelvin * temperature;
+		for (std::size_t column = 0; column < width; ++column) {
+			if (used[column] > 0 && y[column] / used[column] < limit) {
+				limit = y[column] / used[column];
+				limiting = column;
+			}
+		}
+		if (limiting < width) {
+			rateChange[limiting] = 1 / used[limiting];
+		} else if (capacity > 0) {
+			// T = heat / capacity
+			rateChange[width] = speedPerKelvin / capacity;
+			for (std::size_t column = 0; column < width; ++column)
+				rateChange[column] = -speedPerKelvin * temperature / capacity * capacityChange[column];
+		}
+		double const *change = stoichiometry.data() + index * width;
+		for (std::size_t row = 0; row < size; ++row) {
+			double weight = row < width ? change[row] : energiesReleased[index];
+			if (weight == 0)
+				continue;
+			for (std::size_t column = 0; column < size; ++column)
+				jacobian[row * size + column] += weight * rateChange[column];
+		}
+	}
+}
+// solves a · x = b in place (b becomes x) by Gaussian elimination with partial pivoting
+static void solve_dense(double *a, double *b, std::size_t size)
+{
+	for (std::size_t pivot = 0; pivot < size; ++pivot) {
+		std::size_t best = pivot;
+		for (std::size_t row = pivot + 1; row < size; ++row)
+			if (std::abs(a[row * size + pivot]) > std::abs(a[best * size + pivot]))
+				best = row;
+		if (a[best * size + pivot] == 0)
+			continue;
+		if (best != pivot) {
+			std::swap_ranges(a + best * size, a + best * size + size, a + pivot * size);
+			std::swap(b[best], b[pivot]);
+		}
+		for (std::size_t row = pivot + 1; row < size; ++row) {
+			double factor = a[row * size + pivot] / a[pivot * size + pivot];
+			if (factor == 0)
+				continue;
+			for (std::size_t column = pivot; column < size; ++column)
+				a[row * size + column] -= factor * a[pivot * size + column];
+			b[row] -= factor * b[pivot];
+		}
+	}
+	for (std::size_t pivot = size; pivot-- > 0;) {
+		double sum = b[pivot];
+		for (std::size_t column = pivot + 1; column < size; ++column)
+			sum -= a[pivot * size + column] * b[column];
+		b[pivot] = a[pivot * size + pivot] != 0 ? sum / a[pivot * size + pivot] : 0;
+	}
+}
+void CompiledReactionSet::implicit_step(IntegrationState const &state, double const *y, double h, double *out) const
+{
+	std::size_t width = state.width;
+	std::size_t size = width + 1;
+	// at most 65² doubles, fine on the stack and no allocation per substep
+	double jacobian[(MAX_ATMOSPHERICS_ELEMENTS + 1) * (MAX_ATMOSPHERICS_ELEMENTS + 1)];
+	double f[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	derivatives(state, y, f, jacobian);
+	// (I - h·J) · Δ = h · f(y)
+	for (std::size_t i = 0; i < size * size; ++i)
+		jacobian[i] *= -h;
+	for (std::size_t i = 0; i < size; ++i) {
+		jacobian[i * size + i] += 1;
+		f[i] *= h;
+	}
+	solve_dense(jacobian, f, size);
+	for (std::size_t i = 0; i < width; ++i)
+		out[i] = std::max(0.0, y[i] + f[i]);
+	out[width] = std::max(state.heat_capacity(out) * state.minTemperature, y[width] + f[width]);
+}
+std::size_t CompiledReactionSet::react_implicit(Atmosphere &atmosphere, double dt, ReactionIntegration &settings) const
+{
+	if (dt <= 0 || active_count(atmosphere.get_temperature()) == 0)
+		return 0;
+	IntegrationState state;
+	std::size_t width = state.width = columns.size();
+	std::size_t size = width + 1;
+	double y[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	for (std::size_t column = 0; column < width; ++column) {
+		ElementId element = columns[column];
+		y[column] = state.startMoles[column] = atmosphere.contents.get(element);
+		state.molarMasses[column] = atmosphericsElements.molar_masses()[element];
+		state.heatCapacities[column] = atmosphericsElements.heat_capacities_moles()[element];
+	}
+	y[width] = atmosphere.heatEnergy;
+	state.totalMoles = atmosphere.get_moles();
+	state.totalMass = atmosphere.get_mass();
+	state.massHeatCapacity = atmosphere.get_specific_heat_moles() * atmosphere.get_mass();
+	state.minTemperature = atmosphere.minTemperature;
+
+	// nothing reacting, e.g. hot but without the reactants
+	double f[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	std::size_t running;
+	derivatives(state, y, f, nullptr, &running);
+	if (std::all_of(f, f + size, [](double value) { return value == 0; }))
+		return 0;
+
+	double full[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	double half[MAX_ATMOSPHERICS_ELEMENTS + 1];
+	double step = settings.substep > 0 ? std::min(settings.substep, dt) : dt;
+	double time = 0;
+	unsigned attempts = 0;
+	while (time < dt) {
+		bool last = ++attempts >= settings.maxSubsteps;
+		if (last || time + step > dt)
+			step = dt - time;
+		// step doubling: the difference between one step and two half steps
+		// estimates the error of the half steps
+		implicit_step(state, y, step, full);
+		implicit_step(state, y, step / 2, half);
+		implicit_step(state, half, step / 2, half);
+		double error = 0;
+		for (std::size_t i = 0; i < size; ++i) {
+			double scale = settings.absoluteTolerance + settings.tolerance * std::max(std::abs(y[i]), std::abs(half[i]));
+			error = std::max(error, std::abs(full[i] - half[i]) / scale);
+		}
+		if (error <= 1 || last) {
+			std::copy(half, half + size, y);
+			time += step;
+		}
+		// error goes with step², so this aims for 0.8 of the tolerance next time
+		double growth = 0.9 / std::sqrt(std::max(error, 1e-10));
+		step *= std::clamp(growth, 0.2, 4.0);
+		if (last)
+			break;
+	}
+	settings.substep = step;
+
+	double changes[MAX_ATMOSPHERICS_ELEMENTS];
+	ElementMask touched = 0;
+	for (std::size_t column = 0; column < width; ++column) {
+		if (y[column] != state.startMoles[column]) {
+			changes[columns[column]] = y[column] - state.startMoles[column];
+			touched |= element_bit(columns[column]);
+		}
+	}
+	atmosphere.apply_changes(touched, changes, y[width] - atmosphere.heatEnergy);
+	return running;
+}
+}
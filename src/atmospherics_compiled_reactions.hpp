@@ -0,0 +1,93 @@
+#ifndef ATMOSPHERICS_COMPILED_REACTIONS_HPP
+#define ATMOSPHERICS_COMPILED_REACTIONS_HPP
+
+#include "atmospherics_element.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace ZAtmos {
+struct Atmosphere;
+struct AtmosphericsReaction;
+
+// Per-atmosphere choice of how reactions are integrated over a tick.
+struct ReactionIntegration {
+	// false takes one explicit Euler step per tick. true uses linearly implicit
+	// Euler steps, halving and growing the substep to keep the error estimate
+	// (one full step against two half steps) under tolerance.
+	bool implicit = false;
+	// relative error allowed per substep
+	double tolerance = 1e-3;
+	// mol (J for heat), errors below this don't count
+	double absoluteTolerance = 1e-6;
+	// attempts per tick, the rest of the tick is taken as one step after that
+	unsigned maxSubsteps = 32;
+	// s, substep the last tick ended on and the next one starts from, 0 tries the whole tick
+	double substep = 0;
+};
+
+// A set of reactions flattened into dense per-reaction arrays and a
+// stoichiometry matrix over the species they use (the columns). Every
+// reaction's rate is worked out from the same starting state, then all of
+// them are applied at once as one matrix-vector product, so an atmosphere
+// only has its moles and heat touched once per tick.
+//
+// Reactions are sorted by autoignition point (ties keep registration order),
+// so the ones hot enough to run are always a prefix.
+struct CompiledReactionSet {
+private:
+	// ElementId of each column
+	std::vector<ElementId> columns;
+	// per reaction
+	std::vector<double> autoignitionPoints; // K
+	std::vector<double> reactionSpeeds; // mol/s
+	std::vector<double> energiesReleased; // J/mol
+	std::vector<ElementMask> reactantMasks;
+	// reactions × columns, mol used up per mol of reaction
+	std::vector<double> reactants;
+	// reactions × columns, products - reactants
+	std::vector<double> stoichiometry;
+
+	struct IntegrationState;
+	// Writes the first active reactions whose reactants are all in present
+	// into rows, returns how many there are.
+	std::size_t present_rows(std::size_t active, ElementMask present, std::size_t *rows) const;
+	// mol/s and J/s at state y (column moles then heat), plus the Jacobian and
+	// the number of reactions with a positive rate if asked for
+	void derivatives(IntegrationState const &state, double const *y, double *f, double *jacobian,
+		std::size_t *running = nullptr) const;
+	// one linearly implicit Euler step of h from y into out
+	void implicit_step(IntegrationState const &state, double const *y, double h, double *out) const;
+public:
+	CompiledReactionSet();
+	CompiledReactionSet(std::vector<AtmosphericsReaction> const &reactions);
+	void compile(std::vector<AtmosphericsReaction> const &reactions);
+
+	inline std::size_t reaction_count() const { return autoignitionPoints.size(); }
+	inline std::size_t column_count() const { return columns.size(); }
+	inline std::vector<ElementId> const &species() const { return columns; }
+	// Number of reactions that autoignite at temperature, they're always the first ones.
+	std::size_t active_count(double temperature) const;
+
+	// Rate pass over count atmospheres for the first reactionCount reactions,
+	// or for the reactionCount reactions listed in rows if given.
+	// moles[column][i] is that column's species in atmosphere i. Writes
+	// rates[reaction * count + i] in mol/s, already scaled down so no species
+	// is used up past 0 within dt.
+	void evaluate(std::size_t reactionCount, std::size_t count, double const *temperatures,
+		double const *const *moles, double dt, double *rates, std::size_t const *rows = nullptr) const;
+	// Update pass: deltas[column * count + i] in mol and heat[i] in J
+	// released over dt by rates from evaluate(), with the same rows.
+	void apply_rates(std::size_t reactionCount, std::size_t count, double const *rates, double dt,
+		double *deltas, double *heat, std::size_t const *rows = nullptr) const;
+
+	// evaluate() and apply_rates() for a single atmosphere, over only the
+	// reactions it has every reactant of, then applies the result. Returns the
+	// number of reactions that ran.
+	std::size_t react(Atmosphere &atmosphere, double dt) const;
+	// Integrates atmosphere over dt with adaptive implicit substeps, see
+	// ReactionIntegration. Returns the number of reactions running at the start.
+	std::size_t react_implicit(Atmosphere &atmosphere, double dt, ReactionIntegration &settings) const;
+};
+}
+
+#endif
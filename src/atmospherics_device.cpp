@@ -3,21 +3,33 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 namespace ZAtmos {
+void GenericDevice::wake_atmospheres() const
+{
+	thread_local std::vector<Atmosphere *> atmospheres;
+	atmospheres.clear();
+	collect_atmospheres(atmospheres);
+	for (Atmosphere *atmosphere : atmospheres)
+		atmosphere->wake();
+}
+
 namespace AtmosphericsDevices {
 bool Sink::is_running()
 {
-	double temperature = source.get_temperature();
-	double pressure = source.get_pressure();
+	AtmosphereState state = state_of(0, source);
+	double temperature = state.temperature;
+	double pressure = state.pressure;
 	return active
 	    && (temperature >= minTemperature && temperature <= maxTemperature)
 	    && (pressure >= minPressure && pressure <= maxPressure);
 }
 
 bool Source::is_running() {
-	double temperature = destination.get_temperature();
-	double pressure = destination.get_pressure();
+	AtmosphereState state = state_of(0, destination);
+	double temperature = state.temperature;
+	double pressure = state.pressure;
 	return active
 	    && (temperature >= minTemperature && temperature <= maxTemperature)
 	    && (pressure >= minPressure && pressure <= maxPressure);
@@ -25,10 +37,12 @@ bool Source::is_running() {
 
 bool BinaryDevice::is_running()
 {
-	double temperatureDest = destination.get_temperature();
-	double pressureDest = destination.get_pressure();
-	double temperatureDiff = source.get_temperature() - temperatureDest;
-	double pressureDiff = source.get_pressure() - pressureDest;
+	AtmosphereState sourceState = state_of(0, source);
+	AtmosphereState destinationState = state_of(1, destination);
+	double temperatureDest = destinationState.temperature;
+	double pressureDest = destinationState.pressure;
+	double temperatureDiff = sourceState.temperature - temperatureDest;
+	double pressureDiff = sourceState.pressure - pressureDest;
 	return active
 	    && (temperatureDest >= minTemperature && temperatureDest <= maxTemperature)
 	    && (pressureDest >= minPressure && pressureDest <= maxPressure)
@@ -38,132 +52,259 @@ bool BinaryDevice::is_running()
 
 void Valve::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	source.mix_with(destination, dt, true);
 }
+bool Valve::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.mix(source, destination, dt, true);
+	return true;
+}
+bool Valve::get_conductance(double &gasConductance, double &heatConductance)
+{
+	gasConductance = 0;
+	heatConductance = 0;
+	if (!should_run())
+		return true;
+	// the linear part of Atmosphere::get_mix_flow, without the maxPressure throttle
+	gasConductance = 0.1 * source.mixRate;
+	// mix_with conducts with whichever side the gas flows out of
+	bool forward = state_of(0, source).pressure > state_of(1, destination).pressure;
+	Atmosphere const &upstream = forward ? source : destination;
+	// 1m^2 across 1cm, like Atmosphere::get_conducted_heat
+	heatConductance = upstream.get_thermal_conductivity() / 0.01 * upstream.tempMixRate;
+	return true;
+}
 
 void OneWayValve::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	source.mix_with(destination, dt, false);
 }
+bool OneWayValve::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.mix(source, destination, dt, false);
+	return true;
+}
 
 void Spawner::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
-	for (auto &element : mixture)
-		destination.add_moles_temp(element.chemicalId, element.moles * dt, temperature);
+	for (auto const &element : mixture)
+		destination.add_moles_temp(element.elementId, element.moles * dt, temperature);
+}
+bool Spawner::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	for (auto const &element : mixture)
+		flux.add_moles_temp(destination, element.elementId, element.moles * dt, temperature);
+	return true;
 }
 
 void Void::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
-	for (auto &element : source.contents)
-		source.remove(element.chemicalId, removalRate * source.get_percent_pressure(element.chemicalId) * dt);
+	for (auto const &element : source.contents)
+		source.remove(element.elementId, removalRate * source.get_percent_pressure(element.elementId) * dt);
+}
+bool Void::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	for (auto const &element : source.contents)
+		flux.remove(source, element.elementId, removalRate * source.get_percent_pressure(element.elementId) * dt);
+	return true;
 }
 
 void FilteredVoid::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	for (auto &element : filter)
 		source.remove(element, removalRate * source.get_percent_pressure(element) * dt);
 }
+bool FilteredVoid::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	for (auto &element : filter)
+		flux.remove(source, element, removalRate * source.get_percent_pressure(element) * dt);
+	return true;
+}
 
 void TemperatureController::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	destination.add_heat(energyRate * dt);
 }
+bool TemperatureController::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.add_heat(destination, energyRate * dt);
+	return true;
+}
 
 void TemperatureConductor::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	destination.mix_temperatures_at(source, conductivity, dt);
 }
+bool TemperatureConductor::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.move_heat(destination, source, destination.get_conducted_heat_at(source, conductivity, dt));
+	return true;
+}
+bool TemperatureConductor::get_conductance(double &gasConductance, double &heatConductance)
+{
+	gasConductance = 0;
+	heatConductance = should_run() ? conductivity * destination.tempMixRate : 0;
+	return true;
+}
 
 void FilteredVolumePump::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
-	for (auto &element : filter) {
-		double amountPerVolume = source.get_moles(element) / source.volume;
-		double amount = amountPerVolume * pumpRate * dt;
-		source.remove(element, amount);
-		destination.add_moles_temp(element, amount, source.get_temperature());
-	}
+	if (source.volume <= 0)
+		return;
+	source.transfer(destination, pumpRate * dt / source.volume, element_mask(filter));
+}
+bool FilteredVolumePump::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	if (source.volume > 0)
+		flux.transfer(source, destination, pumpRate * dt / source.volume, element_mask(filter));
+	return true;
 }
 
 void VolumePump::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	source.move_gas_volume(destination, pumpRate * dt);
 }
+bool VolumePump::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.move_gas_volume(source, destination, pumpRate * dt);
+	return true;
+}
 
 void FilteredMolarPump::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	for (auto &element : filter) {
 		double amount = std::min(source.get_moles(element), pumpRate * dt);
 		source.remove(element, amount);
 		destination.add_moles_temp(element, amount, source.get_temperature());
+		source.count_moved(amount);
 	}
 }
+bool FilteredMolarPump::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	for (auto &element : filter)
+		flux.move_element(source, destination, element, pumpRate * dt);
+	return true;
+}
 
 void MolarPump::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	source.move_gas_moles(destination, pumpRate * dt);
 }
+bool MolarPump::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (should_run())
+		flux.move_gas_moles(source, destination, pumpRate * dt);
+	return true;
+}
 
 void VolumeMixer::update(double dt)
 {
-	if (!is_running())
+	if (!should_run())
 		return;
 	double amountA = pumpRate * dt * (1.0 - ratio);
 	double amountB = pumpRate * dt * ratio;
 	sourceA.move_gas_volume(destination, amountA);
 	sourceB.move_gas_volume(destination, amountB);
 }
+bool VolumeMixer::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	flux.move_gas_volume(sourceA, destination, pumpRate * dt * (1.0 - ratio));
+	flux.move_gas_volume(sourceB, destination, pumpRate * dt * ratio);
+	return true;
+}
 
-void MolarMixer::update(double dt)
+// returns false if either source is empty
+static bool molar_mixer_amounts(MolarMixer const &mixer, double dt, double &amountA, double &amountB)
 {
-	if (!is_running())
-		return;
-	double amountA = pumpRate * dt * (1.0 - ratio);
-	double amountB = pumpRate * dt * ratio;
-	double cap = std::min(sourceA.get_moles(), sourceB.get_moles());
+	amountA = mixer.pumpRate * dt * (1.0 - mixer.ratio);
+	amountB = mixer.pumpRate * dt * mixer.ratio;
+	double cap = std::min(mixer.state_of(0, mixer.sourceA).moles, mixer.state_of(1, mixer.sourceB).moles);
 	if (cap == 0)
-		return;
+		return false;
 	if (amountA > cap) {
 		amountA = cap;
-		amountB = amountA / (1.0 - ratio) * ratio;
+		amountB = amountA / (1.0 - mixer.ratio) * mixer.ratio;
 	}
 	if (amountB > cap) {
 		amountB = cap;
-		amountA = amountB / ratio * (1.0 - ratio);
+		amountA = amountB / mixer.ratio * (1.0 - mixer.ratio);
 	}
+	return true;
+}
+
+void MolarMixer::update(double dt)
+{
+	if (!should_run())
+		return;
+	double amountA, amountB;
+	if (!molar_mixer_amounts(*this, dt, amountA, amountB))
+		return;
 	sourceA.move_gas_moles(destination, amountA);
 	sourceB.move_gas_moles(destination, amountB);
 }
 
+bool MolarMixer::emit_flux(double dt, DeviceFlux &flux)
+{
+	if (!should_run())
+		return true;
+	double amountA, amountB;
+	if (!molar_mixer_amounts(*this, dt, amountA, amountB))
+		return true;
+	flux.move_gas_moles(sourceA, destination, amountA);
+	flux.move_gas_moles(sourceB, destination, amountB);
+	return true;
+}
+
 bool MolarMixer::is_running()
 {
-	double temperatureDest = destination.get_temperature();
-	double pressureDest = destination.get_pressure();
-	double temperatureDiffA = sourceA.get_temperature() - temperatureDest;
-	double pressureDiffA = sourceA.get_pressure() - pressureDest;
-	double temperatureDiffB = sourceB.get_temperature() - temperatureDest;
-	double pressureDiffB = sourceB.get_pressure() - pressureDest;
+	AtmosphereState stateA = state_of(0, sourceA);
+	AtmosphereState stateB = state_of(1, sourceB);
+	AtmosphereState destinationState = state_of(2, destination);
+	double temperatureDest = destinationState.temperature;
+	double pressureDest = destinationState.pressure;
+	double temperatureDiffA = stateA.temperature - temperatureDest;
+	double pressureDiffA = stateA.pressure - pressureDest;
+	double temperatureDiffB = stateB.temperature - temperatureDest;
+	double pressureDiffB = stateB.pressure - pressureDest;
 	return active
 	    && (temperatureDest >= minTemperature && temperatureDest <= maxTemperature)
 	    && (pressureDest >= minPressure && pressureDest <= maxPressure)
@@ -177,12 +318,15 @@ bool MolarMixer::is_running()
 
 bool VolumeMixer::is_running()
 {
-	double temperatureDest = destination.get_temperature();
-	double pressureDest = destination.get_pressure();
-	double temperatureDiffA = sourceA.get_temperature() - temperatureDest;
-	double pressureDiffA = sourceA.get_pressure() - pressureDest;
-	double temperatureDiffB = sourceB.get_temperature() - temperatureDest;
-	double pressureDiffB = sourceB.get_pressure() - pressureDest;
+	AtmosphereState stateA = state_of(0, sourceA);
+	AtmosphereState stateB = state_of(1, sourceB);
+	AtmosphereState destinationState = state_of(2, destination);
+	double temperatureDest = destinationState.temperature;
+	double pressureDest = destinationState.pressure;
+	double temperatureDiffA = stateA.temperature - temperatureDest;
+	double pressureDiffA = stateA.pressure - pressureDest;
+	double temperatureDiffB = stateB.temperature - temperatureDest;
+	double pressureDiffB = stateB.pressure - pressureDest;
 	return active
 	    && (temperatureDest >= minTemperature && temperatureDest <= maxTemperature)
 	    && (pressureDest >= minPressure && pressureDest <= maxPressure)
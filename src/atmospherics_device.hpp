@@ -2,27 +2,116 @@
 #define DEVICE_HPP
 
 #include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_flux.hpp"
 #include "atmospherics_mixture.hpp"
 
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
 #include <vector>
 
 namespace ZAtmos {
+// States of a set of atmospheres taken at one point of a step, so everything
+// reading them during that step sees the same thing.
+struct AtmosphereSnapshot {
+	std::vector<AtmosphereState> states;
+	// only read while set
+	bool valid = false;
+};
+
 struct GenericDevice {
 	bool active = false;
+	// Set by AtmosphericsNetwork from add_device() until remove_device() or the
+	// network's destruction: while snapshot is valid, is_running() and
+	// friends read atmosphere i of collect_atmospheres() as
+	// snapshot->states[snapshotIndices[i]] instead of the live atmosphere.
+	AtmosphereSnapshot const *snapshot = nullptr;
+	std::size_t const *snapshotIndices = nullptr;
+	// Set by AtmosphericsNetwork for the length of a step in ZATMOS_PROFILE
+	// builds, should_run() notes there whether it held the device back.
+	char *heldBack = nullptr;
 	inline GenericDevice() {};
+	// A copy isn't registered with the network of the original.
+	inline GenericDevice(GenericDevice const &other) : active(other.active) {}
+	inline GenericDevice &operator=(GenericDevice const &other)
+	{
+		active = other.active;
+		return *this;
+	}
 	inline virtual void update(double dt)
 	{
 		(void) dt;
 		fprintf(stderr, "Called update on abstract device!");
 		exit(1);
 	}
-	inline virtual void toggle() { active = !active; }
-	inline virtual void set(bool active) { this->active = active; }
+	inline virtual void toggle()
+	{
+		active = !active;
+		wake_atmospheres();
+	}
+	inline virtual void set(bool active)
+	{
+		if (this->active != active)
+			wake_atmospheres();
+		this->active = active;
+	}
 	inline virtual bool is_on() { return active; };
 	inline virtual bool is_running() { return active; };
+	// is_running(), for update(), emit_flux() and get_conductance() to check.
+	// Also notes in heldBack, if set, when it holds back a device that's on,
+	// for NetworkStats::devicesSkipped.
+	inline bool should_run()
+	{
+		bool running = is_running();
+		if (heldBack)
+			*heldBack = active && !running;
+		return running;
+	}
+	// Flux mode: records what update() would do into flux, reading the
+	// atmospheres but not modifying them. Returns false if the device only
+	// supports update().
+	inline virtual bool emit_flux(double dt, DeviceFlux &flux) { (void) dt; (void) flux; return false; }
+	// Appends every atmosphere this device reads or writes to out.
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const { (void) out; }
+	// Wakes every atmosphere from collect_atmospheres(). Call it after changing
+	// settings of a passive device, so its atmospheres notice.
+	void wake_atmospheres() const;
+	// State of atmosphere, which is entry slot of collect_atmospheres(), from
+	// the snapshot if there is a valid one.
+	inline AtmosphereState state_of(std::size_t slot, Atmosphere const &atmosphere) const
+	{
+		if (snapshot && snapshot->valid)
+			return snapshot->states[snapshotIndices[slot]];
+		return atmosphere.state();
+	}
+	// True for devices that only even out differences between their
+	// atmospheres, so there's nothing for them to do once those are asleep.
+	inline virtual bool is_passive() const { return false; }
+	// True if, while on, gas flows freely both ways between this device's
+	// atmospheres, so AtmosphericsNetwork may merge them into one zone.
+	inline virtual bool is_open_link() const { return false; }
+	// Implicit transport: true if this device is a symmetric link between the
+	// first two atmospheres from collect_atmospheres() that moves gas at
+	// gasConductance (mol/kPa·s) of pressure difference and heat at
+	// heatConductance (J/K·s) of temperature difference, so the network can
+	// solve it together with the others instead of calling update().
+	// Both are 0 while the device isn't running.
+	inline virtual bool get_conductance(double &gasConductance, double &heatConductance)
+	{
+		(void) gasConductance;
+		(void) heatConductance;
+		return false;
+	}
+	inline virtual ~GenericDevice()
+	{
+		// the network would go on using it, remove it from the network first
+		if (snapshot) {
+			fprintf(stderr, "Destroyed a device still registered with an AtmosphericsNetwork!\n");
+			abort();
+		}
+	}
 };
 
 namespace AtmosphericsDevices {
@@ -42,12 +131,14 @@ struct Sink : public Device {
 	Atmosphere &source;
 	inline Sink(Atmosphere &source) : source(source) {}
 	virtual bool is_running() override;
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const override { out.push_back(&source); }
 };
 
 struct Source : public Device {
 	Atmosphere &destination;
 	inline Source(Atmosphere &destination) : destination(destination) {}
 	virtual bool is_running() override;
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const override { out.push_back(&destination); }
 };
 
 struct BinaryDevice : public Device {
@@ -64,6 +155,11 @@ struct BinaryDevice : public Device {
 	// Maximum temperature differential required for device to run.
 	double maxTemperatureDifferential = 1000000.00;
 	virtual bool is_running() override;
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const override
+	{
+		out.push_back(&source);
+		out.push_back(&destination);
+	}
 };
 
 struct OneWayValve : public BinaryDevice {
@@ -71,6 +167,8 @@ struct OneWayValve : public BinaryDevice {
 		: BinaryDevice(source, destination)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
+	inline virtual bool is_passive() const override { return true; }
 };
 
 struct Valve : public BinaryDevice {
@@ -78,6 +176,10 @@ struct Valve : public BinaryDevice {
 		: BinaryDevice(source, destination)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
+	inline virtual bool is_passive() const override { return true; }
+	inline virtual bool is_open_link() const override { return true; }
+	virtual bool get_conductance(double &gasConductance, double &heatConductance) override;
 };
 
 struct Spawner : public Source {
@@ -87,6 +189,7 @@ struct Spawner : public Source {
 		: Source(destination), mixture(mixture), temperature(temperature)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct Void : public Sink {
@@ -97,17 +200,23 @@ struct Void : public Sink {
 		: Sink(source), removalRate(removalRate)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct FilteredVoid : public Sink {
-	std::vector<std::string> filter;
+	std::vector<ElementId> filter;
 	// moles / second
 	double removalRate;
 	// removalRate is in moles/second
-	inline FilteredVoid(Atmosphere &source, std::vector<std::string> filter, double removalRate)
+	inline FilteredVoid(Atmosphere &source, std::vector<ElementId> filter, double removalRate)
 		: Sink(source), filter(filter), removalRate(removalRate)
 	{}
+	// Throws if any of filter is not registered.
+	inline FilteredVoid(Atmosphere &source, std::vector<std::string> const &filter, double removalRate)
+		: Sink(source), filter(element_ids(filter)), removalRate(removalRate)
+	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct TemperatureController : public Source {
@@ -117,6 +226,7 @@ struct TemperatureController : public Source {
 		: Source(destination), energyRate(energyRate)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct TemperatureConductor : public BinaryDevice {
@@ -127,17 +237,25 @@ struct TemperatureConductor : public BinaryDevice {
 		: BinaryDevice(source, destination), conductivity(conductivity)
 	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
+	inline virtual bool is_passive() const override { return true; }
+	virtual bool get_conductance(double &gasConductance, double &heatConductance) override;
 };
 
 struct FilteredVolumePump : public BinaryDevice {
-	std::vector<std::string> filter;
+	std::vector<ElementId> filter;
 	// liters / second
 	double pumpRate;
 	// pumpRate is in liters / second
-	inline FilteredVolumePump(Atmosphere &source, Atmosphere &destination, std::vector<std::string> filter, double pumpRate)
+	inline FilteredVolumePump(Atmosphere &source, Atmosphere &destination, std::vector<ElementId> filter, double pumpRate)
 		: BinaryDevice(source, destination), filter(filter), pumpRate(pumpRate)
 	{}
+	// Throws if any of filter is not registered.
+	inline FilteredVolumePump(Atmosphere &source, Atmosphere &destination, std::vector<std::string> const &filter, double pumpRate)
+		: BinaryDevice(source, destination), filter(element_ids(filter)), pumpRate(pumpRate)
+	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct VolumePump : public BinaryDevice {
@@ -149,17 +267,23 @@ struct VolumePump : public BinaryDevice {
 	{}
 
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct FilteredMolarPump : public BinaryDevice {
-	std::vector<std::string> filter;
+	std::vector<ElementId> filter;
 	// moles / second
 	double pumpRate;
 	// pumpRate is in moles / second
-	inline FilteredMolarPump(Atmosphere &source, Atmosphere &destination, std::vector<std::string> filter, double pumpRate)
+	inline FilteredMolarPump(Atmosphere &source, Atmosphere &destination, std::vector<ElementId> filter, double pumpRate)
 		: BinaryDevice(source, destination), filter(filter), pumpRate(pumpRate)
 	{}
+	// Throws if any of filter is not registered.
+	inline FilteredMolarPump(Atmosphere &source, Atmosphere &destination, std::vector<std::string> const &filter, double pumpRate)
+		: BinaryDevice(source, destination), filter(element_ids(filter)), pumpRate(pumpRate)
+	{}
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 struct MolarPump : public BinaryDevice {
@@ -171,6 +295,7 @@ struct MolarPump : public BinaryDevice {
 	{}
 
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 };
 
 
@@ -208,7 +333,14 @@ struct VolumeMixer : Device {
 	{}
 
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 	virtual bool is_running() override;
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const override
+	{
+		out.push_back(&sourceA);
+		out.push_back(&sourceB);
+		out.push_back(&destination);
+	}
 };
 
 struct MolarMixer : Device {
@@ -245,7 +377,14 @@ struct MolarMixer : Device {
 	{}
 
 	virtual void update(double dt) override;
+	virtual bool emit_flux(double dt, DeviceFlux &flux) override;
 	virtual bool is_running() override;
+	inline virtual void collect_atmospheres(std::vector<Atmosphere *> &out) const override
+	{
+		out.push_back(&sourceA);
+		out.push_back(&sourceB);
+		out.push_back(&destination);
+	}
 };
 }
 }
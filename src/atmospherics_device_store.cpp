@@ -0,0 +1,509 @@
+#include "atmospherics_device_store.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace ZAtmos {
+using namespace AtmosphericsDevices;
+
+DeviceStore::DeviceStore()
+{
+	thresholds.push_back(DeviceThresholds());
+}
+
+std::uint32_t DeviceStore::add_atmosphere(Atmosphere &atmosphere)
+{
+	auto found = atmosphereIndices.find(&atmosphere);
+	if (found != atmosphereIndices.end())
+		return found->second;
+	std::uint32_t index = static_cast<std::uint32_t>(atmospheres.size());
+	atmospheres.push_back(&atmosphere);
+	atmosphereIndices.emplace(&atmosphere, index);
+	return index;
+}
+
+std::uint32_t DeviceStore::add_thresholds(DeviceThresholds const &limits)
+{
+	thresholds.push_back(limits);
+	return static_cast<std::uint32_t>(thresholds.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_valve(Atmosphere &source, Atmosphere &destination)
+{
+	valves.push_back(LinkRecord { add_atmosphere(source), add_atmosphere(destination) });
+	return static_cast<std::uint32_t>(valves.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_one_way_valve(Atmosphere &source, Atmosphere &destination)
+{
+	oneWayValves.push_back(LinkRecord { add_atmosphere(source), add_atmosphere(destination) });
+	return static_cast<std::uint32_t>(oneWayValves.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_spawner(Atmosphere &destination, AtmosphericsMixture const &mixture, double temperature)
+{
+	mixtures.push_back(mixture);
+	SpawnerRecord record { add_atmosphere(destination) };
+	record.mixture = static_cast<std::uint32_t>(mixtures.size() - 1);
+	record.temperature = temperature;
+	spawners.push_back(record);
+	return static_cast<std::uint32_t>(spawners.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_void(Atmosphere &source, double removalRate)
+{
+	std::uint32_t index = add_atmosphere(source);
+	RateRecord record { index, index };
+	record.rate = removalRate;
+	voids.push_back(record);
+	return static_cast<std::uint32_t>(voids.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_filtered_void(Atmosphere &source, ElementMask filter, double removalRate)
+{
+	std::uint32_t index = add_atmosphere(source);
+	FilteredRecord record { index, index };
+	record.rate = removalRate;
+	record.filter = filter;
+	filteredVoids.push_back(record);
+	return static_cast<std::uint32_t>(filteredVoids.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_temperature_controller(Atmosphere &destination, double energyRate)
+{
+	std::uint32_t index = add_atmosphere(destination);
+	RateRecord record { index, index };
+	record.rate = energyRate;
+	temperatureControllers.push_back(record);
+	return static_cast<std::uint32_t>(temperatureControllers.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_temperature_conductor(Atmosphere &source, Atmosphere &destination, double conductivity)
+{
+	RateRecord record { add_atmosphere(source), add_atmosphere(destination) };
+	record.rate = conductivity;
+	temperatureConductors.push_back(record);
+	return static_cast<std::uint32_t>(temperatureConductors.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_filtered_volume_pump(Atmosphere &source, Atmosphere &destination, ElementMask filter, double pumpRate)
+{
+	FilteredRecord record { add_atmosphere(source), add_atmosphere(destination) };
+	record.rate = pumpRate;
+	record.filter = filter;
+	filteredVolumePumps.push_back(record);
+	return static_cast<std::uint32_t>(filteredVolumePumps.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_volume_pump(Atmosphere &source, Atmosphere &destination, double pumpRate)
+{
+	RateRecord record { add_atmosphere(source), add_atmosphere(destination) };
+	record.rate = pumpRate;
+	volumePumps.push_back(record);
+	return static_cast<std::uint32_t>(volumePumps.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_filtered_molar_pump(Atmosphere &source, Atmosphere &destination, ElementMask filter, double pumpRate)
+{
+	FilteredRecord record { add_atmosphere(source), add_atmosphere(destination) };
+	record.rate = pumpRate;
+	record.filter = filter;
+	filteredMolarPumps.push_back(record);
+	return static_cast<std::uint32_t>(filteredMolarPumps.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_molar_pump(Atmosphere &source, Atmosphere &destination, double pumpRate)
+{
+	RateRecord record { add_atmosphere(source), add_atmosphere(destination) };
+	record.rate = pumpRate;
+	molarPumps.push_back(record);
+	return static_cast<std::uint32_t>(molarPumps.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_volume_mixer(Atmosphere &sourceA, Atmosphere &sourceB, Atmosphere &destination, double ratio, double pumpRate)
+{
+	MixerRecord record { add_atmosphere(sourceA), add_atmosphere(sourceB), add_atmosphere(destination) };
+	record.ratio = ratio;
+	record.rate = pumpRate;
+	volumeMixers.push_back(record);
+	return static_cast<std::uint32_t>(volumeMixers.size() - 1);
+}
+
+std::uint32_t DeviceStore::add_molar_mixer(Atmosphere &sourceA, Atmosphere &sourceB, Atmosphere &destination, double ratio, double pumpRate)
+{
+	MixerRecord record { add_atmosphere(sourceA), add_atmosphere(sourceB), add_atmosphere(destination) };
+	record.ratio = ratio;
+	record.rate = pumpRate;
+	molarMixers.push_back(record);
+	return static_cast<std::uint32_t>(molarMixers.size() - 1);
+}
+
+// the shared entry when limits are the defaults, else a new one
+static std::uint32_t pack_thresholds(DeviceStore &store, DeviceThresholds const &limits)
+{
+	if (limits == store.thresholds[DeviceStore::DEFAULT_THRESHOLDS])
+		return DeviceStore::DEFAULT_THRESHOLDS;
+	return store.add_thresholds(limits);
+}
+
+static DeviceThresholds device_thresholds(Device const &device)
+{
+	DeviceThresholds limits;
+	limits.minPressure = device.minPressure;
+	limits.maxPressure = device.maxPressure;
+	limits.minTemperature = device.minTemperature;
+	limits.maxTemperature = device.maxTemperature;
+	return limits;
+}
+
+static DeviceThresholds device_thresholds(BinaryDevice const &device)
+{
+	DeviceThresholds limits = device_thresholds(static_cast<Device const &>(device));
+	limits.minPressureDifferentialA = device.minPressureDifferential;
+	limits.maxPressureDifferentialA = device.maxPressureDifferential;
+	limits.minTemperatureDifferentialA = device.minTemperatureDifferential;
+	limits.maxTemperatureDifferentialA = device.maxTemperatureDifferential;
+	return limits;
+}
+
+template <typename Mixer>
+static DeviceThresholds mixer_thresholds(Mixer const &mixer)
+{
+	DeviceThresholds limits = device_thresholds(static_cast<Device const &>(mixer));
+	limits.minPressureDifferentialA = mixer.minPressureDifferentialA;
+	limits.maxPressureDifferentialA = mixer.maxPressureDifferentialA;
+	limits.minTemperatureDifferentialA = mixer.minTemperatureDifferentialA;
+	limits.maxTemperatureDifferentialA = mixer.maxTemperatureDifferentialA;
+	limits.minPressureDifferentialB = mixer.minPressureDifferentialB;
+	limits.maxPressureDifferentialB = mixer.maxPressureDifferentialB;
+	limits.minTemperatureDifferentialB = mixer.minTemperatureDifferentialB;
+	limits.maxTemperatureDifferentialB = mixer.maxTemperatureDifferentialB;
+	return limits;
+}
+
+template <typename Record>
+static std::uint32_t pack(std::vector<Record> &records, std::uint32_t index, std::uint32_t limits, bool active)
+{
+	records[index].thresholds = limits;
+	records[index].active = active;
+	return index;
+}
+
+std::uint32_t DeviceStore::add(GenericDevice const &device, DeviceKind &kind)
+{
+	// most derived kinds first, several share a base
+	if (auto valve = dynamic_cast<Valve const *>(&device)) {
+		kind = DeviceKind::Valve;
+		return pack(valves, add_valve(valve->source, valve->destination),
+		            pack_thresholds(*this, device_thresholds(*valve)), valve->active);
+	}
+	if (auto valve = dynamic_cast<OneWayValve const *>(&device)) {
+		kind = DeviceKind::OneWayValve;
+		return pack(oneWayValves, add_one_way_valve(valve->source, valve->destination),
+		            pack_thresholds(*this, device_thresholds(*valve)), valve->active);
+	}
+	if (auto spawner = dynamic_cast<Spawner const *>(&device)) {
+		kind = DeviceKind::Spawner;
+		return pack(spawners, add_spawner(spawner->destination, spawner->mixture, spawner->temperature),
+		            pack_thresholds(*this, device_thresholds(*spawner)), spawner->active);
+	}
+	if (auto sink = dynamic_cast<Void const *>(&device)) {
+		kind = DeviceKind::Void;
+		return pack(voids, add_void(sink->source, sink->removalRate),
+		            pack_thresholds(*this, device_thresholds(*sink)), sink->active);
+	}
+	if (auto sink = dynamic_cast<FilteredVoid const *>(&device)) {
+		kind = DeviceKind::FilteredVoid;
+		return pack(filteredVoids, add_filtered_void(sink->source, element_mask(sink->filter), sink->removalRate),
+		            pack_thresholds(*this, device_thresholds(*sink)), sink->active);
+	}
+	if (auto controller = dynamic_cast<TemperatureController const *>(&device)) {
+		kind = DeviceKind::TemperatureController;
+		return pack(temperatureControllers, add_temperature_controller(controller->destination, controller->energyRate),
+		            pack_thresholds(*this, device_thresholds(*controller)), controller->active);
+	}
+	if (auto conductor = dynamic_cast<TemperatureConductor const *>(&device)) {
+		kind = DeviceKind::TemperatureConductor;
+		return pack(temperatureConductors,
+		            add_temperature_conductor(conductor->source, conductor->destination, conductor->conductivity),
+		            pack_thresholds(*this, device_thresholds(*conductor)), conductor->active);
+	}
+	if (auto pump = dynamic_cast<FilteredVolumePump const *>(&device)) {
+		kind = DeviceKind::FilteredVolumePump;
+		return pack(filteredVolumePumps,
+		            add_filtered_volume_pump(pump->source, pump->destination, element_mask(pump->filter), pump->pumpRate),
+		            pack_thresholds(*this, device_thresholds(*pump)), pump->active);
+	}
+	if (auto pump = dynamic_cast<VolumePump const *>(&device)) {
+		kind = DeviceKind::VolumePump;
+		return pack(volumePumps, add_volume_pump(pump->source, pump->destination, pump->pumpRate),
+		            pack_thresholds(*this, device_thresholds(*pump)), pump->active);
+	}
+	if (auto pump = dynamic_cast<FilteredMolarPump const *>(&device)) {
+		kind = DeviceKind::FilteredMolarPump;
+		return pack(filteredMolarPumps,
+		            add_filtered_molar_pump(pump->source, pump->destination, element_mask(pump->filter), pump->pumpRate),
+		            pack_thresholds(*this, device_thresholds(*pump)), pump->active);
+	}
+	if (auto pump = dynamic_cast<MolarPump const *>(&device)) {
+		kind = DeviceKind::MolarPump;
+		return pack(molarPumps, add_molar_pump(pump->source, pump->destination, pump->pumpRate),
+		            pack_thresholds(*this, device_thresholds(*pump)), pump->active);
+	}
+	if (auto mixer = dynamic_cast<VolumeMixer const *>(&device)) {
+		kind = DeviceKind::VolumeMixer;
+		return pack(volumeMixers,
+		            add_volume_mixer(mixer->sourceA, mixer->sourceB, mixer->destination, mixer->ratio, mixer->pumpRate),
+		            pack_thresholds(*this, mixer_thresholds(*mixer)), mixer->active);
+	}
+	if (auto mixer = dynamic_cast<MolarMixer const *>(&device)) {
+		kind = DeviceKind::MolarMixer;
+		return pack(molarMixers,
+		            add_molar_mixer(mixer->sourceA, mixer->sourceB, mixer->destination, mixer->ratio, mixer->pumpRate),
+		            pack_thresholds(*this, mixer_thresholds(*mixer)), mixer->active);
+	}
+	throw std::invalid_argument("DeviceStore can't hold this kind of device");
+}
+
+// Calls f with the record of kind at index and the atmospheres it touches.
+template <typename F>
+static void with_record(DeviceStore &store, DeviceKind kind, std::uint32_t index, F f)
+{
+	auto two = [&](auto &records) {
+		auto &record = records.at(index);
+		f(record.active, { record.source, record.destination });
+	};
+	auto mixer = [&](std::vector<DeviceStore::MixerRecord> &records) {
+		auto &record = records.at(index);
+		f(record.active, { record.sourceA, record.sourceB, record.destination });
+	};
+	switch (kind) {
+	case DeviceKind::Valve: two(store.valves); return;
+	case DeviceKind::OneWayValve: two(store.oneWayValves); return;
+	case DeviceKind::Spawner: {
+		auto &record = store.spawners.at(index);
+		f(record.active, { record.destination });
+		return;
+	}
+	case DeviceKind::Void: two(store.voids); return;
+	case DeviceKind::FilteredVoid: two(store.filteredVoids); return;
+	case DeviceKind::TemperatureController: two(store.temperatureControllers); return;
+	case DeviceKind::TemperatureConductor: two(store.temperatureConductors); return;
+	case DeviceKind::FilteredVolumePump: two(store.filteredVolumePumps); return;
+	case DeviceKind::VolumePump: two(store.volumePumps); return;
+	case DeviceKind::FilteredMolarPump: two(store.filteredMolarPumps); return;
+	case DeviceKind::MolarPump: two(store.molarPumps); return;
+	case DeviceKind::VolumeMixer: mixer(store.volumeMixers); return;
+	case DeviceKind::MolarMixer: mixer(store.molarMixers); return;
+	}
+	throw std::invalid_argument("Unknown device kind");
+}
+
+void DeviceStore::set_active(DeviceKind kind, std::uint32_t index, bool active)
+{
+	with_record(*this, kind, index, [&](bool &current, std::initializer_list<std::uint32_t> touched) {
+		if (current != active)
+			for (std::uint32_t atmosphere : touched)
+				atmospheres[atmosphere]->wake();
+		current = active;
+	});
+}
+
+bool DeviceStore::is_active(DeviceKind kind, std::uint32_t index) const
+{
+	bool result = false;
+	with_record(const_cast<DeviceStore &>(*this), kind, index,
+	            [&](bool &current, std::initializer_list<std::uint32_t>) { result = current; });
+	return result;
+}
+
+std::size_t DeviceStore::size() const
+{
+	return valves.size() + oneWayValves.size() + spawners.size() + voids.size() + filteredVoids.size()
+	     + temperatureControllers.size() + temperatureConductors.size() + filteredVolumePumps.size()
+	     + volumePumps.size() + filteredMolarPumps.size() + molarPumps.size() + volumeMixers.size()
+	     + molarMixers.size();
+}
+
+// Sink::is_running and Source::is_running
+static inline bool single_running(DeviceThresholds const *limits, AtmosphereState const &atmosphere)
+{
+	if (limits == nullptr)
+		return true;
+	return (atmosphere.temperature >= limits->minTemperature && atmosphere.temperature <= limits->maxTemperature)
+	    && (atmosphere.pressure >= limits->minPressure && atmosphere.pressure <= limits->maxPressure);
+}
+
+// BinaryDevice::is_running
+static inline bool binary_running(DeviceThresholds const *limits, AtmosphereState const &source, AtmosphereState const &destination)
+{
+	if (limits == nullptr)
+		return true;
+	double temperatureDiff = source.temperature - destination.temperature;
+	double pressureDiff = source.pressure - destination.pressure;
+	return (destination.temperature >= limits->minTemperature && destination.temperature <= limits->maxTemperature)
+	    && (destination.pressure >= limits->minPressure && destination.pressure <= limits->maxPressure)
+	    && (temperatureDiff >= limits->minTemperatureDifferentialA && temperatureDiff <= limits->maxTemperatureDifferentialA)
+	    && (pressureDiff >= limits->minPressureDifferentialA && pressureDiff <= limits->maxPressureDifferentialA);
+}
+
+// VolumeMixer::is_running and MolarMixer::is_running
+static inline bool mixer_running(DeviceThresholds const *limits, AtmosphereState const &sourceA, AtmosphereState const &sourceB,
+                                 AtmosphereState const &destination)
+{
+	if (limits == nullptr)
+		return true;
+	double temperatureDiffA = sourceA.temperature - destination.temperature;
+	double pressureDiffA = sourceA.pressure - destination.pressure;
+	double temperatureDiffB = sourceB.temperature - destination.temperature;
+	double pressureDiffB = sourceB.pressure - destination.pressure;
+	return (destination.temperature >= limits->minTemperature && destination.temperature <= limits->maxTemperature)
+	    && (destination.pressure >= limits->minPressure && destination.pressure <= limits->maxPressure)
+	    && (temperatureDiffA >= limits->minTemperatureDifferentialA && temperatureDiffA <= limits->maxTemperatureDifferentialA)
+	    && (pressureDiffA >= limits->minPressureDifferentialA && pressureDiffA <= limits->maxPressureDifferentialA)
+	    && (temperatureDiffB >= limits->minTemperatureDifferentialB && temperatureDiffB <= limits->maxTemperatureDifferentialB)
+	    && (pressureDiffB >= limits->minPressureDifferentialB && pressureDiffB <= limits->maxPressureDifferentialB);
+}
+
+void DeviceStore::update(double dt)
+{
+	Atmosphere *const *table = atmospheres.data();
+	DeviceThresholds const *limits = thresholds.data();
+	auto limits_of = [limits](std::uint32_t index) -> DeviceThresholds const * {
+		return index == NO_THRESHOLDS ? nullptr : limits + index;
+	};
+
+	for (LinkRecord const &record : valves) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			source.mix_with(destination, dt, true);
+	}
+	for (LinkRecord const &record : oneWayValves) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			source.mix_with(destination, dt, false);
+	}
+	for (SpawnerRecord const &record : spawners) {
+		if (!record.active)
+			continue;
+		Atmosphere &destination = *table[record.destination];
+		if (!single_running(limits_of(record.thresholds), state_of(record.destination)))
+			continue;
+		for (auto const &element : mixtures[record.mixture])
+			destination.add_moles_temp(element.elementId, element.moles * dt, record.temperature);
+	}
+	for (RateRecord const &record : voids) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source];
+		if (!single_running(limits_of(record.thresholds), state_of(record.source)))
+			continue;
+		for (auto const &element : source.contents)
+			source.remove(element.elementId, record.rate * source.get_percent_pressure(element.elementId) * dt);
+	}
+	for (FilteredRecord const &record : filteredVoids) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source];
+		if (!single_running(limits_of(record.thresholds), state_of(record.source)))
+			continue;
+		for (ElementMask remaining = record.filter; remaining != 0; remaining &= remaining - 1) {
+			ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+			source.remove(element, record.rate * source.get_percent_pressure(element) * dt);
+		}
+	}
+	for (RateRecord const &record : temperatureControllers) {
+		if (!record.active)
+			continue;
+		Atmosphere &destination = *table[record.destination];
+		if (single_running(limits_of(record.thresholds), state_of(record.destination)))
+			destination.add_heat(record.rate * dt);
+	}
+	for (RateRecord const &record : temperatureConductors) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			destination.mix_temperatures_at(source, record.rate, dt);
+	}
+	for (FilteredRecord const &record : filteredVolumePumps) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (source.volume > 0 && binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			source.transfer(destination, record.rate * dt / source.volume, record.filter);
+	}
+	for (RateRecord const &record : volumePumps) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			source.move_gas_volume(destination, record.rate * dt);
+	}
+	for (FilteredRecord const &record : filteredMolarPumps) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (!binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			continue;
+		for (ElementMask remaining = record.filter; remaining != 0; remaining &= remaining - 1) {
+			ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+			double amount = std::min(source.get_moles(element), record.rate * dt);
+			source.remove(element, amount);
+			destination.add_moles_temp(element, amount, source.get_temperature());
+			source.count_moved(amount);
+		}
+	}
+	for (RateRecord const &record : molarPumps) {
+		if (!record.active)
+			continue;
+		Atmosphere &source = *table[record.source], &destination = *table[record.destination];
+		if (binary_running(limits_of(record.thresholds), state_of(record.source), state_of(record.destination)))
+			source.move_gas_moles(destination, record.rate * dt);
+	}
+	for (MixerRecord const &record : volumeMixers) {
+		if (!record.active)
+			continue;
+		Atmosphere &sourceA = *table[record.sourceA], &sourceB = *table[record.sourceB];
+		Atmosphere &destination = *table[record.destination];
+		if (!mixer_running(limits_of(record.thresholds), state_of(record.sourceA), state_of(record.sourceB),
+		                   state_of(record.destination)))
+			continue;
+		sourceA.move_gas_volume(destination, record.rate * dt * (1.0 - record.ratio));
+		sourceB.move_gas_volume(destination, record.rate * dt * record.ratio);
+	}
+	for (MixerRecord const &record : molarMixers) {
+		if (!record.active)
+			continue;
+		Atmosphere &sourceA = *table[record.sourceA], &sourceB = *table[record.sourceB];
+		Atmosphere &destination = *table[record.destination];
+		if (!mixer_running(limits_of(record.thresholds), state_of(record.sourceA), state_of(record.sourceB),
+		                   state_of(record.destination)))
+			continue;
+		// same as molar_mixer_amounts
+		double amountA = record.rate * dt * (1.0 - record.ratio);
+		double amountB = record.rate * dt * record.ratio;
+		double cap = std::min(state_of(record.sourceA).moles, state_of(record.sourceB).moles);
+		if (cap == 0)
+			continue;
+		if (amountA > cap) {
+			amountA = cap;
+			amountB = amountA / (1.0 - record.ratio) * record.ratio;
+		}
+		if (amountB > cap) {
+			amountB = cap;
+			amountA = amountB / record.ratio * (1.0 - record.ratio);
+		}
+		sourceA.move_gas_moles(destination, amountA);
+		sourceB.move_gas_moles(destination, amountB);
+	}
+}
+}
@@ -0,0 +1,201 @@
+#ifndef ATMOSPHERICS_DEVICE_STORE_HPP
+#define ATMOSPHERICS_DEVICE_STORE_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_mixture.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ZAtmos {
+// Running limits of a packed device, same meaning and defaults as the fields
+// on AtmosphericsDevices::Device, BinaryDevice and the mixers. Binary devices
+// use the A differentials.
+struct DeviceThresholds {
+	// destination side (source side for sinks)
+	double minPressure = 0.0;
+	double maxPressure = 10132.50;
+	double minTemperature = 0.0;
+	double maxTemperature = 1000000.00;
+	// source (A) - destination
+	double minPressureDifferentialA = -10132.50;
+	double maxPressureDifferentialA = 10132.50;
+	double minTemperatureDifferentialA = -1000000.0;
+	double maxTemperatureDifferentialA = 1000000.00;
+	// source B - destination, mixers only
+	double minPressureDifferentialB = -10132.50;
+	double maxPressureDifferentialB = 10132.50;
+	double minTemperatureDifferentialB = -1000000.0;
+	double maxTemperatureDifferentialB = 1000000.00;
+
+	bool operator==(DeviceThresholds const &other) const = default;
+};
+
+enum class DeviceKind : std::uint8_t {
+	Valve,
+	OneWayValve,
+	Spawner,
+	Void,
+	FilteredVoid,
+	TemperatureController,
+	TemperatureConductor,
+	FilteredVolumePump,
+	VolumePump,
+	FilteredMolarPump,
+	MolarPump,
+	VolumeMixer,
+	MolarMixer,
+};
+
+// Data-oriented home for large numbers of devices. Each kind lives in its own
+// packed array of small records that refer to atmospheres by 32-bit index
+// into the store's atmosphere table, and update() runs one plain loop per
+// kind, doing exactly what that kind's update() does, without virtual calls.
+// Filters are element masks instead of vectors, and limits live in a side
+// table: every device starts out on the shared defaults (DEFAULT_THRESHOLDS),
+// NO_THRESHOLDS skips the check altogether, anything else is an index from
+// add_thresholds().
+//
+// The device classes stay as they are for everything else; add() packs a
+// copy of one. Records can be edited in place, use set_active() to switch one
+// so its atmospheres wake up like with GenericDevice::set. Kinds are updated
+// in DeviceKind order, each in the order devices were added.
+struct DeviceStore {
+	static constexpr std::uint32_t DEFAULT_THRESHOLDS = 0;
+	static constexpr std::uint32_t NO_THRESHOLDS = UINT32_MAX;
+
+	// Valve, OneWayValve
+	struct LinkRecord {
+		std::uint32_t source, destination;
+		std::uint32_t thresholds = DEFAULT_THRESHOLDS;
+		bool active = false;
+	};
+	// Void (destination unused), TemperatureController (source unused),
+	// TemperatureConductor, VolumePump, MolarPump
+	struct RateRecord {
+		std::uint32_t source, destination;
+		std::uint32_t thresholds = DEFAULT_THRESHOLDS;
+		bool active = false;
+		// removal/pump rate, energyRate or conductivity, same units as the class
+		double rate = 0;
+	};
+	// FilteredVoid (destination unused), FilteredVolumePump, FilteredMolarPump
+	struct FilteredRecord {
+		std::uint32_t source, destination;
+		std::uint32_t thresholds = DEFAULT_THRESHOLDS;
+		bool active = false;
+		double rate = 0;
+		ElementMask filter = 0;
+	};
+	// VolumeMixer, MolarMixer
+	struct MixerRecord {
+		std::uint32_t sourceA, sourceB, destination;
+		std::uint32_t thresholds = DEFAULT_THRESHOLDS;
+		bool active = false;
+		double ratio = 0;
+		double rate = 0;
+	};
+	struct SpawnerRecord {
+		std::uint32_t destination;
+		std::uint32_t thresholds = DEFAULT_THRESHOLDS;
+		// index into mixtures
+		std::uint32_t mixture = 0;
+		bool active = false;
+		// K
+		double temperature = 0;
+	};
+private:
+	std::vector<Atmosphere *> atmospheres;
+	std::unordered_map<Atmosphere const *, std::uint32_t> atmosphereIndices;
+public:
+	// Set by AtmosphericsNetwork, like GenericDevice::snapshot: while valid,
+	// limits are checked against snapshot->states[snapshotIndices[atmosphere]].
+	// Cleared when the store is replaced or the network destroyed.
+	AtmosphereSnapshot const *snapshot = nullptr;
+	std::vector<std::size_t> snapshotIndices;
+	// side tables
+	std::vector<DeviceThresholds> thresholds;
+	std::vector<AtmosphericsMixture> mixtures;
+
+	std::vector<LinkRecord> valves;
+	std::vector<LinkRecord> oneWayValves;
+	std::vector<SpawnerRecord> spawners;
+	std::vector<RateRecord> voids;
+	std::vector<FilteredRecord> filteredVoids;
+	std::vector<RateRecord> temperatureControllers;
+	std::vector<RateRecord> temperatureConductors;
+	std::vector<FilteredRecord> filteredVolumePumps;
+	std::vector<RateRecord> volumePumps;
+	std::vector<FilteredRecord> filteredMolarPumps;
+	std::vector<RateRecord> molarPumps;
+	std::vector<MixerRecord> volumeMixers;
+	std::vector<MixerRecord> molarMixers;
+
+	DeviceStore();
+
+	// Index of atmosphere in the atmosphere table, adding it if needed. The
+	// atmosphere must outlive the store.
+	std::uint32_t add_atmosphere(Atmosphere &atmosphere);
+	inline Atmosphere &atmosphere(std::uint32_t index) const { return *atmospheres[index]; }
+	inline std::vector<Atmosphere *> const &atmosphere_table() const { return atmospheres; }
+	inline bool has_atmosphere(Atmosphere const &atmosphere) const { return atmosphereIndices.count(&atmosphere) > 0; }
+	inline AtmosphereState state_of(std::uint32_t index) const
+	{
+		if (snapshot && snapshot->valid)
+			return snapshot->states[snapshotIndices[index]];
+		return atmospheres[index]->state();
+	}
+	std::uint32_t add_thresholds(DeviceThresholds const &limits);
+
+	// Each returns the device's index in its kind's array, devices start off inactive.
+	std::uint32_t add_valve(Atmosphere &source, Atmosphere &destination);
+	std::uint32_t add_one_way_valve(Atmosphere &source, Atmosphere &destination);
+	std::uint32_t add_spawner(Atmosphere &destination, AtmosphericsMixture const &mixture, double temperature);
+	std::uint32_t add_void(Atmosphere &source, double removalRate);
+	std::uint32_t add_filtered_void(Atmosphere &source, ElementMask filter, double removalRate);
+	std::uint32_t add_temperature_controller(Atmosphere &destination, double energyRate);
+	std::uint32_t add_temperature_conductor(Atmosphere &source, Atmosphere &destination, double conductivity);
+	std::uint32_t add_filtered_volume_pump(Atmosphere &source, Atmosphere &destination, ElementMask filter, double pumpRate);
+	std::uint32_t add_volume_pump(Atmosphere &source, Atmosphere &destination, double pumpRate);
+	std::uint32_t add_filtered_molar_pump(Atmosphere &source, Atmosphere &destination, ElementMask filter, double pumpRate);
+	std::uint32_t add_molar_pump(Atmosphere &source, Atmosphere &destination, double pumpRate);
+	std::uint32_t add_volume_mixer(Atmosphere &sourceA, Atmosphere &sourceB, Atmosphere &destination, double ratio, double pumpRate);
+	std::uint32_t add_molar_mixer(Atmosphere &sourceA, Atmosphere &sourceB, Atmosphere &destination, double ratio, double pumpRate);
+	// Packs a copy of device, including whether it's on and its limits.
+	// Throws if it isn't one of the kinds above.
+	std::uint32_t add(GenericDevice const &device, DeviceKind &kind);
+
+	// Switches a device on or off, waking its atmospheres if that changes anything.
+	void set_active(DeviceKind kind, std::uint32_t index, bool active);
+	bool is_active(DeviceKind kind, std::uint32_t index) const;
+	// Number of devices of every kind together.
+	std::size_t size() const;
+
+	void update(double dt);
+};
+
+// Calls f(kind, records) with the record array of every kind of store, in
+// DeviceKind order. Works on const and non-const stores alike.
+template <typename Store, typename F>
+inline void for_each_record_array(Store &store, F f)
+{
+	f(DeviceKind::Valve, store.valves);
+	f(DeviceKind::OneWayValve, store.oneWayValves);
+	f(DeviceKind::Spawner, store.spawners);
+	f(DeviceKind::Void, store.voids);
+	f(DeviceKind::FilteredVoid, store.filteredVoids);
+	f(DeviceKind::TemperatureController, store.temperatureControllers);
+	f(DeviceKind::TemperatureConductor, store.temperatureConductors);
+	f(DeviceKind::FilteredVolumePump, store.filteredVolumePumps);
+	f(DeviceKind::VolumePump, store.volumePumps);
+	f(DeviceKind::FilteredMolarPump, store.filteredMolarPumps);
+	f(DeviceKind::MolarPump, store.molarPumps);
+	f(DeviceKind::VolumeMixer, store.volumeMixers);
+	f(DeviceKind::MolarMixer, store.molarMixers);
+}
+}
+
+#endif
@@ -1,8 +1,23 @@
 #include "atmospherics_element.hpp"
 #include "registry.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace ZAtmos {
-ImmutableRegistry<AtmosphericsElement> atmosphericsElements;
+ElementRegistry atmosphericsElements;
+
+ElementId ElementRegistry::add(std::string const &key, AtmosphericsElement const &value)
+{
+	if (size() >= MAX_ATMOSPHERICS_ELEMENTS && !has_key(key))
+		throw std::invalid_argument("Cannot register '" + key + "', at most " + std::to_string(MAX_ATMOSPHERICS_ELEMENTS) + " atmospherics elements are supported");
+	ElementId id = static_cast<ElementId>(ImmutableRegistry<AtmosphericsElement>::add(key, value));
+	molarMasses[id] = value.get_molar_mass();
+	heatCapacitiesMoles[id] = value.get_heat_capacity_moles();
+	heatCapacitiesMass[id] = value.get_heat_capacity_mass();
+	thermalConductivities[id] = value.get_thermal_conductivity();
+	return id;
+}
 
 void register_atmospherics_builtins()
 {
@@ -32,6 +47,36 @@ void register_atmospherics_builtins()
 			18.0152833 / 1000.0,
 			0.68));
 }
+ElementId element_id(std::string const &chemicalId)
+{
+	ElementId id;
+	if (!try_element_id(chemicalId, id))
+		throw std::invalid_argument("Atmospherics Element '" + chemicalId + "' not found");
+	return id;
+}
+bool try_element_id(std::string const &chemicalId, ElementId &out)
+{
+	std::size_t id;
+	if (!atmosphericsElements.try_get_id(chemicalId, id))
+		return false;
+	out = static_cast<ElementId>(id);
+	return true;
+}
+std::vector<ElementId> element_ids(std::vector<std::string> const &chemicalIds)
+{
+	std::vector<ElementId> ids;
+	ids.reserve(chemicalIds.size());
+	for (auto const &chemicalId : chemicalIds)
+		ids.push_back(element_id(chemicalId));
+	return ids;
+}
+ElementMask element_mask(std::vector<ElementId> const &elements)
+{
+	ElementMask mask = 0;
+	for (ElementId element : elements)
+		mask |= element_bit(element);
+	return mask;
+}
 AtmosphericsElement::AtmosphericsElement(std::string name, std::string shortName, double heatCapacity, double molarMass, double thermalConductivity)
 	: name(name), shortName(shortName),
 	  heatCapacity(heatCapacity), molarMass(molarMass), thermalConductivity(thermalConductivity)
@@ -2,9 +2,24 @@
 #define CHEMICAL_TYPES_HPP
 
 #include "registry.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace ZAtmos {
+// Dense handle handed out by atmosphericsElements at registration time.
+typedef std::uint16_t ElementId;
+// One bit per ElementId, used for presence checks.
+typedef std::uint64_t ElementMask;
+constexpr std::size_t MAX_ATMOSPHERICS_ELEMENTS = 64;
+
+inline constexpr ElementMask element_bit(ElementId element)
+{
+	return ElementMask(1) << element;
+}
+
 struct AtmosphericsElement {
 private:
 	std::string name;
@@ -30,8 +45,37 @@ public:
 	inline double get_thermal_conductivity() const { return thermalConductivity; }
 };
 
-extern ImmutableRegistry<AtmosphericsElement> atmosphericsElements;
+// Element registry which also keeps each property in its own contiguous array
+// indexed by ElementId, so whole-mixture reductions can be plain loops.
+struct ElementRegistry : public ImmutableRegistry<AtmosphericsElement> {
+private:
+	// kg / mol
+	std::array<double, MAX_ATMOSPHERICS_ELEMENTS> molarMasses {};
+	// J / (K · mol)
+	std::array<double, MAX_ATMOSPHERICS_ELEMENTS> heatCapacitiesMoles {};
+	// J / (K · kg)
+	std::array<double, MAX_ATMOSPHERICS_ELEMENTS> heatCapacitiesMass {};
+	// W / (m · K)
+	std::array<double, MAX_ATMOSPHERICS_ELEMENTS> thermalConductivities {};
+public:
+	// Throws if key is already registered or MAX_ATMOSPHERICS_ELEMENTS is reached.
+	ElementId add(std::string const &key, AtmosphericsElement const &value);
+	inline double const *molar_masses() const { return molarMasses.data(); }
+	inline double const *heat_capacities_moles() const { return heatCapacitiesMoles.data(); }
+	inline double const *heat_capacities_mass() const { return heatCapacitiesMass.data(); }
+	inline double const *thermal_conductivities() const { return thermalConductivities.data(); }
+};
+
+extern ElementRegistry atmosphericsElements;
 void register_atmospherics_builtins();
+// Throws if chemicalId is not registered.
+ElementId element_id(std::string const &chemicalId);
+// Returns true if chemicalId is registered.
+bool try_element_id(std::string const &chemicalId, ElementId &out);
+// Throws if any of chemicalIds is not registered.
+std::vector<ElementId> element_ids(std::vector<std::string> const &chemicalIds);
+// One bit set for each of elements
+ElementMask element_mask(std::vector<ElementId> const &elements);
 
 }
 
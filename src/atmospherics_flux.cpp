@@ -0,0 +1,109 @@
+#include "atmospherics_flux.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace ZAtmos {
+void AtmosphericsFlux::accumulate(AtmosphericsFlux const &other, double scale)
+{
+	ElementMask remaining = other.touched;
+	while (remaining != 0) {
+		ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+		remaining &= remaining - 1;
+		add_moles(element, other.moles[element] * scale);
+	}
+	heat += other.heat * scale;
+}
+
+AtmosphericsFlux &DeviceFlux::operator[](Atmosphere const &atmosphere)
+{
+	for (std::size_t i = 0; i < count; ++i)
+		if (atmospheres[i] == &atmosphere)
+			return slots[i];
+	throw std::invalid_argument("Atmosphere " + std::to_string(atmosphere.id) + " is not connected to this device");
+}
+void DeviceFlux::add_heat(Atmosphere const &atmosphere, double heatEnergy)
+{
+	(*this)[atmosphere].heat += heatEnergy;
+}
+void DeviceFlux::add_moles_temp(Atmosphere const &atmosphere, ElementId element, double moles, double tempKelvin)
+{
+	AtmosphericsFlux &flux = (*this)[atmosphere];
+	flux.add_moles(element, moles);
+	flux.heat += tempKelvin * moles * atmosphericsElements.heat_capacities_moles()[element];
+}
+void DeviceFlux::remove(Atmosphere const &atmosphere, ElementId element, double moles)
+{
+	moles = std::min(moles, atmosphere.get_moles(element));
+	if (moles <= 0)
+		return;
+	add_moles_temp(atmosphere, element, -moles, atmosphere.get_temperature());
+}
+void DeviceFlux::move_element(Atmosphere const &source, Atmosphere const &destination, ElementId element, double moles)
+{
+	moles = std::min(moles, source.get_moles(element));
+	if (moles <= 0)
+		return;
+	double temperature = source.get_temperature();
+	add_moles_temp(source, element, -moles, temperature);
+	add_moles_temp(destination, element, moles, temperature);
+}
+void DeviceFlux::transfer(Atmosphere const &source, Atmosphere const &destination, double fraction)
+{
+	fraction = std::clamp(fraction, 0.0, 1.0);
+	if (fraction <= 0 || source.get_moles() <= 0)
+		return;
+	AtmosphericsFlux &from = (*this)[source];
+	AtmosphericsFlux &to = (*this)[destination];
+	for (auto const &entry : source.contents) {
+		double amount = entry.moles * fraction;
+		from.add_moles(entry.elementId, -amount);
+		to.add_moles(entry.elementId, amount);
+	}
+	double heat = source.heatEnergy * fraction;
+	from.heat -= heat;
+	to.heat += heat;
+}
+void DeviceFlux::transfer(Atmosphere const &source, Atmosphere const &destination, double fraction, ElementMask filter)
+{
+	fraction = std::clamp(fraction, 0.0, 1.0);
+	if (fraction <= 0)
+		return;
+	for (auto const &entry : source.contents)
+		if (filter & element_bit(entry.elementId))
+			move_element(source, destination, entry.elementId, entry.moles * fraction);
+}
+void DeviceFlux::move_gas_moles(Atmosphere const &source, Atmosphere const &destination, double moles)
+{
+	double total = source.get_moles();
+	if (total > 0)
+		transfer(source, destination, moles / total);
+}
+void DeviceFlux::move_gas_volume(Atmosphere const &source, Atmosphere const &destination, double volume)
+{
+	if (source.volume > 0)
+		transfer(source, destination, volume / source.volume);
+}
+void DeviceFlux::move_heat(Atmosphere const &source, Atmosphere const &destination, double heatEnergy)
+{
+	add_heat(source, -heatEnergy);
+	add_heat(destination, heatEnergy);
+}
+void DeviceFlux::mix(Atmosphere const &source, Atmosphere const &destination, double dt, bool allowBackflow, bool temperatureMix)
+{
+	double dN = source.get_mix_flow(destination, dt);
+	if (dN > 0) {
+		move_gas_moles(source, destination, dN);
+		if (temperatureMix)
+			move_heat(source, destination, source.get_conducted_heat(destination, dt));
+	} else if (allowBackflow) {
+		move_gas_moles(destination, source, -dN);
+		if (temperatureMix)
+			move_heat(destination, source, destination.get_conducted_heat(source, dt));
+	}
+}
+}
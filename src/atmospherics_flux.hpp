@@ -0,0 +1,80 @@
+#ifndef ATMOSPHERICS_FLUX_HPP
+#define ATMOSPHERICS_FLUX_HPP
+
+#include "atmospherics_element.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace ZAtmos {
+struct Atmosphere;
+
+// Pending change to one atmosphere: signed moles per element plus heat,
+// accumulated during the first phase of a flux step and applied in the second.
+struct AtmosphericsFlux {
+	// mol, indexed by ElementId, only elements in touched are meaningful
+	std::vector<double> moles;
+	ElementMask touched = 0;
+	// J
+	double heat = 0;
+
+	inline void clear()
+	{
+		for (std::size_t i = 0; i < moles.size(); ++i)
+			moles[i] = 0;
+		touched = 0;
+		heat = 0;
+	}
+	inline void add_moles(ElementId element, double amount)
+	{
+		if (element >= moles.size())
+			moles.resize(element + 1, 0.0);
+		moles[element] += amount;
+		touched |= element_bit(element);
+	}
+	// Grows moles to at least span up front, so add_moles() below it never allocates.
+	inline void reserve(std::size_t span)
+	{
+		if (span > moles.size())
+			moles.resize(span, 0.0);
+	}
+	// adds every entry of other, times scale, onto this
+	void accumulate(AtmosphericsFlux const &other, double scale = 1);
+};
+
+// What a device sees while emitting flux: one AtmosphericsFlux per atmosphere
+// the device touches. Helpers mirror the immediate-mode Atmosphere methods,
+// but only read the atmospheres and record the changes.
+struct DeviceFlux {
+private:
+	Atmosphere *const *atmospheres;
+	AtmosphericsFlux *slots;
+	std::size_t count;
+public:
+	inline DeviceFlux(Atmosphere *const *atmospheres, AtmosphericsFlux *slots, std::size_t count)
+		: atmospheres(atmospheres), slots(slots), count(count)
+	{}
+	// Throws if the device didn't report atmosphere from collect_atmospheres().
+	AtmosphericsFlux &operator[](Atmosphere const &atmosphere);
+
+	// J
+	void add_heat(Atmosphere const &atmosphere, double heatEnergy);
+	void add_moles_temp(Atmosphere const &atmosphere, ElementId element, double moles, double tempKelvin);
+	// removes moles of element along with its heat at the atmosphere's temperature
+	void remove(Atmosphere const &atmosphere, ElementId element, double moles);
+	// moves moles of element from source to destination at source's temperature
+	void move_element(Atmosphere const &source, Atmosphere const &destination, ElementId element, double moles);
+	// like Atmosphere::transfer
+	void transfer(Atmosphere const &source, Atmosphere const &destination, double fraction);
+	void transfer(Atmosphere const &source, Atmosphere const &destination, double fraction, ElementMask filter);
+	// like Atmosphere::move_gas_moles
+	void move_gas_moles(Atmosphere const &source, Atmosphere const &destination, double moles);
+	// like Atmosphere::move_gas_volume
+	void move_gas_volume(Atmosphere const &source, Atmosphere const &destination, double volume);
+	// J, moves heatEnergy from source to destination
+	void move_heat(Atmosphere const &source, Atmosphere const &destination, double heatEnergy);
+	// like Atmosphere::mix_with
+	void mix(Atmosphere const &source, Atmosphere const &destination, double dt, bool allowBackflow, bool temperatureMix = true);
+};
+}
+
+#endif
@@ -0,0 +1,343 @@
+#include "atmospherics_journal.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_device_store.hpp"
+#include "atmospherics_element.hpp"
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ZAtmos {
+// flags byte at the start of a record, and fields byte of each atmosphere
+static constexpr std::uint8_t DELTA_VOLUME = 1;
+static constexpr std::uint8_t DELTA_HEAT = 2;
+static constexpr std::uint8_t DELTA_MOLES = 4;
+static constexpr std::size_t WORD = 8;
+
+static void put_varint(std::vector<unsigned char> &out, std::uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<unsigned char>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<unsigned char>(value));
+}
+static void put_bytes(std::vector<unsigned char> &out, void const *data, std::size_t size)
+{
+	auto const *bytes = static_cast<unsigned char const *>(data);
+	out.insert(out.end(), bytes, bytes + size);
+}
+static std::int64_t quantize(double value, double quantum)
+{
+	return std::llround(value / quantum);
+}
+// Appends value, as a zigzag varint of quanta if quantum is set. Returns
+// what the replica will read back.
+static double put_value(std::vector<unsigned char> &out, double value, double quantum)
+{
+	if (quantum <= 0) {
+		put_bytes(out, &value, sizeof(value));
+		return value;
+	}
+	std::int64_t steps = quantize(value, quantum);
+	put_varint(out, (static_cast<std::uint64_t>(steps) << 1) ^ static_cast<std::uint64_t>(steps >> 63));
+	return static_cast<double>(steps) * quantum;
+}
+static bool value_changed(double value, double sent, double quantum)
+{
+	if (quantum <= 0)
+		return value != sent;
+	return quantize(value, quantum) != quantize(sent, quantum);
+}
+
+DeltaJournal::DeltaJournal(std::vector<Atmosphere *> const &atmospheres, DeviceStore const *devices)
+	: atmospheres(atmospheres), devices(devices)
+{
+	reset();
+}
+DeltaJournal::DeltaJournal(DeviceStore const &devices)
+	: DeltaJournal(devices.atmosphere_table(), &devices)
+{}
+
+void DeltaJournal::reset()
+{
+	width = atmosphericsElements.size();
+	std::size_t count = atmospheres.size();
+	volumes.resize(count);
+	heatEnergies.resize(count);
+	moles.assign(count * width, 0.0);
+	sentMasks.resize(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		Atmosphere const &atmosphere = *atmospheres[i];
+		volumes[i] = atmosphere.volume;
+		heatEnergies[i] = atmosphere.heatEnergy;
+		sentMasks[i] = atmosphere.contents.mask();
+		for (auto const &entry : atmosphere.contents)
+			moles[i * width + entry.elementId] = entry.moles;
+	}
+	for (auto &bytes : deviceBytes)
+		bytes.clear();
+	if (!devices)
+		return;
+	tableSize = devices->atmosphere_table().size();
+	for_each_record_array(*devices, [&](DeviceKind kind, auto const &records) {
+		put_bytes(deviceBytes[static_cast<std::size_t>(kind)], records.data(), records.size() * sizeof(records[0]));
+	});
+	put_bytes(deviceBytes[THRESHOLDS_KIND], devices->thresholds.data(), devices->thresholds.size() * sizeof(DeviceThresholds));
+}
+
+void DeltaJournal::check_structure() const
+{
+	if (atmosphericsElements.size() != width)
+		throw std::logic_error("Elements were registered since the DeltaJournal was reset");
+	if (!devices)
+		return;
+	bool same = devices->atmosphere_table().size() == tableSize
+		&& devices->thresholds.size() * sizeof(DeviceThresholds) == deviceBytes[THRESHOLDS_KIND].size();
+	for_each_record_array(*devices, [&](DeviceKind kind, auto const &records) {
+		same = same && records.size() * sizeof(records[0]) == deviceBytes[static_cast<std::size_t>(kind)].size();
+	});
+	if (!same)
+		throw std::logic_error("Devices were added to the DeviceStore since the DeltaJournal was reset");
+}
+
+// Appends an entry for each record of records that differs from sent, and
+// updates sent to match.
+static std::size_t put_records(std::vector<unsigned char> &out, std::uint8_t kind, void const *records,
+                               std::size_t recordSize, std::size_t count, std::vector<unsigned char> &sent)
+{
+	std::size_t words = recordSize / WORD;
+	std::size_t changed = 0;
+	auto const *bytes = static_cast<unsigned char const *>(records);
+	for (std::size_t i = 0; i < count; ++i) {
+		unsigned char const *now = bytes + i * recordSize;
+		unsigned char *before = sent.data() + i * recordSize;
+		std::uint64_t mask = 0;
+		for (std::size_t word = 0; word < words; ++word)
+			if (std::memcmp(now + word * WORD, before + word * WORD, WORD) != 0)
+				mask |= std::uint64_t(1) << word;
+		if (mask == 0)
+			continue;
+		out.push_back(kind);
+		put_varint(out, i);
+		put_varint(out, mask);
+		for (std::size_t word = 0; word < words; ++word)
+			if (mask & (std::uint64_t(1) << word))
+				put_bytes(out, now + word * WORD, WORD);
+		std::memcpy(before, now, recordSize);
+		++changed;
+	}
+	return changed;
+}
+
+std::size_t DeltaJournal::record(std::vector<unsigned char> &out)
+{
+	check_structure();
+	std::size_t start = out.size();
+	std::uint8_t flags = (volumeQuantum > 0 ? DELTA_VOLUME : 0) | (heatQuantum > 0 ? DELTA_HEAT : 0) | (molesQuantum > 0 ? DELTA_MOLES : 0);
+	out.push_back(flags);
+	if (volumeQuantum > 0)
+		put_bytes(out, &volumeQuantum, sizeof(double));
+	if (heatQuantum > 0)
+		put_bytes(out, &heatQuantum, sizeof(double));
+	if (molesQuantum > 0)
+		put_bytes(out, &molesQuantum, sizeof(double));
+
+	// entries go to scratch first, the count comes before them
+	entries.clear();
+	changedAtmospheres = 0;
+	std::size_t next = 0;
+	for (std::size_t i = 0; i < atmospheres.size(); ++i) {
+		Atmosphere const &atmosphere = *atmospheres[i];
+		double *sentMoles = moles.data() + i * width;
+		std::uint8_t fields = 0;
+		if (value_changed(atmosphere.volume, volumes[i], volumeQuantum))
+			fields |= DELTA_VOLUME;
+		if (value_changed(atmosphere.heatEnergy, heatEnergies[i], heatQuantum))
+			fields |= DELTA_HEAT;
+		ElementMask species = 0;
+		ElementMask candidates = atmosphere.contents.mask() | sentMasks[i];
+		while (candidates != 0) {
+			ElementId element = static_cast<ElementId>(std::countr_zero(candidates));
+			candidates &= candidates - 1;
+			if (value_changed(atmosphere.contents.get(element), sentMoles[element], molesQuantum))
+				species |= element_bit(element);
+		}
+		if (species != 0)
+			fields |= DELTA_MOLES;
+		if (fields == 0)
+			continue;
+
+		put_varint(entries, i - next);
+		next = i + 1;
+		entries.push_back(fields);
+		if (fields & DELTA_VOLUME)
+			volumes[i] = put_value(entries, atmosphere.volume, volumeQuantum);
+		if (fields & DELTA_HEAT)
+			heatEnergies[i] = put_value(entries, atmosphere.heatEnergy, heatQuantum);
+		if (fields & DELTA_MOLES) {
+			put_varint(entries, species);
+			while (species != 0) {
+				ElementId element = static_cast<ElementId>(std::countr_zero(species));
+				species &= species - 1;
+				double sent = put_value(entries, atmosphere.contents.get(element), molesQuantum);
+				sentMoles[element] = sent;
+				if (sent > 0)
+					sentMasks[i] |= element_bit(element);
+				else
+					sentMasks[i] &= ~element_bit(element);
+			}
+		}
+		++changedAtmospheres;
+	}
+	put_varint(out, changedAtmospheres);
+	put_bytes(out, entries.data(), entries.size());
+
+	entries.clear();
+	changedDevices = 0;
+	if (devices) {
+		for_each_record_array(*devices, [&](DeviceKind kind, auto const &records) {
+			using Record = typename std::decay_t<decltype(records)>::value_type;
+			static_assert(sizeof(Record) % WORD == 0 && sizeof(Record) / WORD <= 64);
+			changedDevices += put_records(entries, static_cast<std::uint8_t>(kind), records.data(), sizeof(Record),
+			                              records.size(), deviceBytes[static_cast<std::size_t>(kind)]);
+		});
+		changedDevices += put_records(entries, THRESHOLDS_KIND, devices->thresholds.data(), sizeof(DeviceThresholds),
+		                              devices->thresholds.size(), deviceBytes[THRESHOLDS_KIND]);
+	}
+	put_varint(out, changedDevices);
+	put_bytes(out, entries.data(), entries.size());
+	return out.size() - start;
+}
+
+namespace {
+// Bounds-checked reads from a delta record.
+struct DeltaReader {
+	unsigned char const *data;
+	std::size_t size;
+	std::size_t offset = 0;
+
+	void need(std::size_t bytes) const
+	{
+		if (bytes > size - offset)
+			throw std::runtime_error("Delta record is cut short");
+	}
+	std::uint8_t byte()
+	{
+		need(1);
+		return data[offset++];
+	}
+	std::uint64_t varint()
+	{
+		std::uint64_t value = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			std::uint8_t next = byte();
+			value |= std::uint64_t(next & 0x7f) << shift;
+			if (!(next & 0x80))
+				return value;
+		}
+		throw std::runtime_error("Delta record has an overlong varint");
+	}
+	void bytes(void *out, std::size_t count)
+	{
+		need(count);
+		std::memcpy(out, data + offset, count);
+		offset += count;
+	}
+	double value(double quantum)
+	{
+		if (quantum <= 0) {
+			double value;
+			bytes(&value, sizeof(value));
+			return value;
+		}
+		std::uint64_t encoded = varint();
+		std::int64_t steps = static_cast<std::int64_t>(encoded >> 1) ^ -static_cast<std::int64_t>(encoded & 1);
+		return static_cast<double>(steps) * quantum;
+	}
+};
+}
+
+std::size_t apply_delta(unsigned char const *data, std::size_t size,
+                        std::vector<Atmosphere *> const &atmospheres, DeviceStore *devices)
+{
+	DeltaReader reader { data, size };
+	std::uint8_t flags = reader.byte();
+	double volumeQuantum = 0, heatQuantum = 0, molesQuantum = 0;
+	if (flags & DELTA_VOLUME)
+		reader.bytes(&volumeQuantum, sizeof(double));
+	if (flags & DELTA_HEAT)
+		reader.bytes(&heatQuantum, sizeof(double));
+	if (flags & DELTA_MOLES)
+		reader.bytes(&molesQuantum, sizeof(double));
+
+	std::uint64_t changed = reader.varint();
+	std::size_t next = 0;
+	for (std::uint64_t entry = 0; entry < changed; ++entry) {
+		std::uint64_t gap = reader.varint();
+		if (next >= atmospheres.size() || gap >= atmospheres.size() - next)
+			throw std::runtime_error("Delta record refers to an atmosphere the replica doesn't have");
+		std::size_t index = next + gap;
+		next = index + 1;
+		Atmosphere &atmosphere = *atmospheres[index];
+		std::uint8_t fields = reader.byte();
+		if (fields & DELTA_VOLUME)
+			atmosphere.volume = reader.value(volumeQuantum);
+		double heatEnergy = fields & DELTA_HEAT ? reader.value(heatQuantum) : atmosphere.heatEnergy;
+		if (fields & DELTA_MOLES) {
+			ElementMask species = reader.varint();
+			if (std::bit_width(species) > atmosphericsElements.size())
+				throw std::runtime_error("Delta record has moles of an unregistered element");
+			while (species != 0) {
+				ElementId element = static_cast<ElementId>(std::countr_zero(species));
+				species &= species - 1;
+				atmosphere.contents.set(element, reader.value(molesQuantum));
+			}
+			atmosphere.recalculate_aggregates();
+		}
+		atmosphere.heatEnergy = heatEnergy;
+		atmosphere.recalculate_dirty();
+		atmosphere.wake();
+	}
+
+	changed = reader.varint();
+	if (changed > 0 && !devices)
+		throw std::runtime_error("Delta record has devices but the replica has no DeviceStore");
+	for (std::uint64_t entry = 0; entry < changed; ++entry) {
+		std::uint8_t kind = reader.byte();
+		std::uint64_t index = reader.varint();
+		std::uint64_t mask = reader.varint();
+		unsigned char *record = nullptr;
+		std::size_t recordSize = 0;
+		auto find = [&](void *records, std::size_t size, std::size_t count) {
+			if (index >= count)
+				throw std::runtime_error("Delta record refers to a device the replica doesn't have");
+			record = static_cast<unsigned char *>(records) + index * size;
+			recordSize = size;
+		};
+		if (kind == DeltaJournal::THRESHOLDS_KIND) {
+			find(devices->thresholds.data(), sizeof(DeviceThresholds), devices->thresholds.size());
+		} else {
+			for_each_record_array(*devices, [&](DeviceKind recordKind, auto &records) {
+				if (static_cast<std::uint8_t>(recordKind) == kind)
+					find(records.data(), sizeof(records[0]), records.size());
+			});
+		}
+		if (!record)
+			throw std::runtime_error("Delta record has an unknown device kind " + std::to_string(kind));
+		if (std::bit_width(mask) > recordSize / WORD)
+			throw std::runtime_error("Delta record changes words past the end of a device");
+		while (mask != 0) {
+			std::size_t word = std::countr_zero(mask);
+			mask &= mask - 1;
+			reader.bytes(record + word * WORD, WORD);
+		}
+	}
+	return reader.offset;
+}
+}
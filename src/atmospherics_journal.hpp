@@ -0,0 +1,91 @@
+#ifndef ATMOSPHERICS_JOURNAL_HPP
+#define ATMOSPHERICS_JOURNAL_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_device_store.hpp"
+#include "atmospherics_element.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ZAtmos {
+// Records what changed in a set of atmospheres and devices since the last
+// record, for replicas and replays. The usual flow is to send a snapshot
+// (see atmospherics_snapshot.hpp) of the same atmospheres and devices, then
+// call record() after every step and apply_delta() each record on the other
+// side, in order.
+//
+// The journal keeps a copy of everything as of its last record and compares
+// against it, so atmospheres and devices that didn't change, sleeping ones
+// included, write nothing. A delta record holds, for each changed
+// atmosphere, only the fields that changed (volume, heat energy, and the
+// moles of the species that changed), and for each changed device record
+// only the 8-byte words of it that changed.
+//
+// With a quantum set, that field is sent as a whole number of quanta and
+// only counts as changed once it moves to another one. The replica then
+// sees the rounded values, so leave them at 0 for exact replays. Even then
+// the replica recomputes its cached totals from the moles it gets, so derived
+// values like pressure may differ from the source in the last bits.
+//
+// The set of atmospheres, the number of devices of each kind, the thresholds
+// table and the registered elements are fixed from construction (or the
+// last reset()); record() throws std::logic_error if any of them changed,
+// send a new snapshot and reset() then. Values are in native byte order.
+struct DeltaJournal {
+	// device kind byte of DeviceStore::thresholds entries in a record
+	static constexpr std::uint8_t THRESHOLDS_KIND = static_cast<std::uint8_t>(DeviceKind::MolarMixer) + 1;
+private:
+	std::vector<Atmosphere *> atmospheres;
+	DeviceStore const *devices;
+	std::size_t width = 0;
+	// as of the last record, moles[atmosphere * width + element]
+	std::vector<double> volumes;
+	std::vector<double> heatEnergies;
+	std::vector<double> moles;
+	// per atmosphere, species with moles as of the last record
+	std::vector<ElementMask> sentMasks;
+	std::size_t tableSize = 0;
+	// as of the last record, the raw records of each kind and then thresholds
+	std::array<std::vector<unsigned char>, THRESHOLDS_KIND + 1> deviceBytes;
+	std::size_t changedAtmospheres = 0;
+	std::size_t changedDevices = 0;
+	// scratch for record()
+	std::vector<unsigned char> entries;
+
+	void check_structure() const;
+public:
+	// L, 0 sends exact values
+	double volumeQuantum = 0;
+	// J, 0 sends exact values
+	double heatQuantum = 0;
+	// mol, 0 sends exact values
+	double molesQuantum = 0;
+
+	// Journal over atmospheres, and the devices of devices if given, whose
+	// atmosphere indices have to be into atmospheres.
+	DeltaJournal(std::vector<Atmosphere *> const &atmospheres, DeviceStore const *devices = nullptr);
+	// Journal over the atmosphere table of devices and every device in it.
+	explicit DeltaJournal(DeviceStore const &devices);
+
+	// Takes the current state as what the replica has, e.g. after sending it a snapshot.
+	void reset();
+	// Appends a delta record of everything that changed since the last record
+	// (or reset()) to out and returns its size in bytes.
+	std::size_t record(std::vector<unsigned char> &out);
+	// Atmospheres and devices (thresholds included) in the last record.
+	inline std::size_t changed_atmospheres() const { return changedAtmospheres; }
+	inline std::size_t changed_devices() const { return changedDevices; }
+};
+
+// Applies the delta record at data to a replica: atmospheres[i] and devices
+// take the place of atmosphere i and the device store the journal was made
+// over. Returns the size of the record, so records appended one after the
+// other can be walked. Throws std::runtime_error if the record is cut short
+// or refers to atmospheres or devices the replica doesn't have.
+std::size_t apply_delta(unsigned char const *data, std::size_t size,
+                        std::vector<Atmosphere *> const &atmospheres, DeviceStore *devices = nullptr);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include "atmospherics_mixture.hpp"
+#include "atmospherics_element.hpp"
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+namespace ZAtmos {
+AtmosphericsMixture::AtmosphericsMixture(std::initializer_list<AtmosphericsQuantity> quantities)
+{
+	for (auto const &quantity : quantities)
+		add(quantity.elementId, quantity.moles);
+}
+AtmosphericsMixture::AtmosphericsMixture(std::vector<AtmosphericsQuantity> const &quantities)
+{
+	for (auto const &quantity : quantities)
+		add(quantity.elementId, quantity.moles);
+}
+// absent species are stored as 0, so these reductions don't need to check the mask
+double AtmosphericsMixture::total_moles() const
+{
+	double sum = 0;
+	std::size_t count = moles.size();
+	for (std::size_t i = 0; i < count; ++i)
+		sum += moles[i];
+	return sum;
+}
+double AtmosphericsMixture::total_mass() const
+{
+	double const *molarMasses = atmosphericsElements.molar_masses();
+	double sum = 0;
+	std::size_t count = moles.size();
+	for (std::size_t i = 0; i < count; ++i)
+		sum += moles[i] * molarMasses[i];
+	return sum;
+}
+double AtmosphericsMixture::total_heat_capacity() const
+{
+	double const *heatCapacities = atmosphericsElements.heat_capacities_moles();
+	double sum = 0;
+	std::size_t count = moles.size();
+	for (std::size_t i = 0; i < count; ++i)
+		sum += moles[i] * heatCapacities[i];
+	return sum;
+}
+double AtmosphericsMixture::mass_weighted_sum(double const *property) const
+{
+	double const *molarMasses = atmosphericsElements.molar_masses();
+	double sum = 0;
+	std::size_t count = moles.size();
+	for (std::size_t i = 0; i < count; ++i)
+		sum += moles[i] * molarMasses[i] * property[i];
+	return sum;
+}
+}
@@ -2,19 +2,157 @@
 #define MIXTURE_HPP
 
 
+#include "atmospherics_element.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <initializer_list>
 #include <string>
 #include <vector>
 namespace ZAtmos {
 struct AtmosphericsQuantity {
 public:
-	std::string chemicalId;
+	ElementId elementId;
 	double moles;
+	inline AtmosphericsQuantity(ElementId elementId, double moles)
+		: elementId(elementId), moles(moles)
+	{}
+	// Throws if chemicalId is not registered.
 	inline AtmosphericsQuantity(std::string const &chemicalId, double moles)
-		: chemicalId(chemicalId), moles(moles)
+		: elementId(element_id(chemicalId)), moles(moles)
 	{}
+	inline std::string const &chemical_id() const
+	{
+		return atmosphericsElements.key_of(elementId);
+	}
 };
 
-typedef std::vector<AtmosphericsQuantity> AtmosphericsMixture;
+// Moles of each species stored densely by ElementId, plus a bitmask of which
+// species are present. Absent species always read as 0 moles.
+struct AtmosphericsMixture {
+private:
+	// mol, indexed by ElementId
+	std::vector<double> moles;
+	ElementMask present = 0;
+	inline void reserve_for(ElementId element)
+	{
+		if (element >= moles.size())
+			moles.resize(element + 1, 0.0);
+	}
+public:
+	struct const_iterator {
+		AtmosphericsMixture const *mixture;
+		// remaining species, snapshotted so entries can be removed while iterating
+		ElementMask remaining;
+		inline AtmosphericsQuantity operator*() const
+		{
+			ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+			return AtmosphericsQuantity(element, mixture->get(element));
+		}
+		inline const_iterator &operator++()
+		{
+			remaining &= remaining - 1;
+			return *this;
+		}
+		inline bool operator!=(const_iterator const &other) const
+		{
+			return remaining != other.remaining;
+		}
+		inline bool operator==(const_iterator const &other) const
+		{
+			return remaining == other.remaining;
+		}
+	};
+
+	inline AtmosphericsMixture()
+	{}
+	AtmosphericsMixture(std::initializer_list<AtmosphericsQuantity> quantities);
+	AtmosphericsMixture(std::vector<AtmosphericsQuantity> const &quantities);
+
+	inline bool has(ElementId element) const
+	{
+		return (present & element_bit(element)) != 0;
+	}
+	// mol
+	inline double get(ElementId element) const
+	{
+		return element < moles.size() ? moles[element] : 0.0;
+	}
+	// Sets the moles of element, anything <= 0 removes it.
+	inline void set(ElementId element, double amount)
+	{
+		if (amount <= 0) {
+			erase(element);
+			return;
+		}
+		reserve_for(element);
+		moles[element] = amount;
+		present |= element_bit(element);
+	}
+	// Adds (or with negative amount, removes) moles of element, clamped at 0.
+	inline void add(ElementId element, double amount)
+	{
+		set(element, get(element) + amount);
+	}
+	// Removes up to amount moles, returns how many were actually removed.
+	inline double remove(ElementId element, double amount)
+	{
+		double current = get(element);
+		if (amount >= current) {
+			erase(element);
+			return current;
+		}
+		moles[element] = current - amount;
+		return amount;
+	}
+	inline void erase(ElementId element)
+	{
+		if (element < moles.size())
+			moles[element] = 0.0;
+		present &= ~element_bit(element);
+	}
+	inline void clear()
+	{
+		std::fill(moles.begin(), moles.end(), 0.0);
+		present = 0;
+	}
+	// Multiplies every species by factor, factor <= 0 empties the mixture.
+	inline void scale(double factor)
+	{
+		if (factor <= 0) {
+			clear();
+			return;
+		}
+		for (double &amount : moles)
+			amount *= factor;
+	}
+	inline ElementMask mask() const { return present; }
+	// Number of species present
+	inline std::size_t size() const { return std::popcount(present); }
+	inline bool empty() const { return present == 0; }
+	// Length of the dense array, every ElementId in the mixture is below this.
+	inline std::size_t span() const { return moles.size(); }
+	// Grows the dense array to at least span up front, so adding species below
+	// it never allocates.
+	inline void reserve(std::size_t span)
+	{
+		if (span > moles.size())
+			moles.resize(span, 0.0);
+	}
+	inline double const *data() const { return moles.data(); }
+
+	inline const_iterator begin() const { return const_iterator { this, present }; }
+	inline const_iterator end() const { return const_iterator { this, 0 }; }
+
+	// mol
+	double total_moles() const;
+	// kg
+	double total_mass() const;
+	// J / K, sum of moles · molar heat capacity
+	double total_heat_capacity() const;
+	// Σ mass · property[element], for mass-weighted averages of per-element properties
+	double mass_weighted_sum(double const *property) const;
+};
 }
 
 #endif
@@ -0,0 +1,978 @@
+#include "atmospherics_network.hpp"
+#include "allocation_counter.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_reactions.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ZAtmos {
+namespace {
+// Times consecutive phases of step(). Empty without ZATMOS_PROFILE, only call
+// it behind profiling_enabled().
+struct PhaseClock {
+#ifdef ZATMOS_PROFILE
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point last = start;
+
+	// ns since the last lap() or construction
+	inline std::uint64_t lap()
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+		last = now;
+		return static_cast<std::uint64_t>(elapsed);
+	}
+	// ns since construction
+	inline std::uint64_t total() const
+	{
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+#else
+	inline std::uint64_t lap() { return 0; }
+	inline std::uint64_t total() const { return 0; }
+#endif
+};
+}
+
+AtmosphericsNetwork::AtmosphericsNetwork()
+{}
+AtmosphericsNetwork::~AtmosphericsNetwork()
+{
+	// a step that threw may have left them attached
+	detach_counters();
+	for (GenericDevice *device : devices) {
+		device->snapshot = nullptr;
+		device->snapshotIndices = nullptr;
+	}
+	if (deviceStore)
+		deviceStore->snapshot = nullptr;
+}
+
+void AtmosphericsNetwork::add_atmosphere(Atmosphere &atmosphere)
+{
+	if (atmosphereIndices.count(&atmosphere) > 0)
+		return;
+	atmosphereIndices[&atmosphere] = atmospheres.size();
+	atmospheres.push_back(&atmosphere);
+	dirty = true;
+}
+void AtmosphericsNetwork::add_device(GenericDevice &device)
+{
+	if (deviceIndices.count(&device) > 0)
+		throw std::invalid_argument("Device has already been added to this network");
+	collected.clear();
+	device.collect_atmospheres(collected);
+	for (Atmosphere *atmosphere : collected)
+		add_atmosphere(*atmosphere);
+	deviceIndices[&device] = devices.size();
+	devices.push_back(&device);
+	// not valid until the next step, but marks the device as registered
+	device.snapshot = &snapshot;
+	dirty = true;
+}
+void AtmosphericsNetwork::remove_atmosphere(Atmosphere &atmosphere)
+{
+	std::size_t index = index_of(atmosphere);
+	detach_counters();
+	// zones refer to atmospheres by index, which is about to shift
+	split_zones();
+	for (GenericDevice *device : devices) {
+		collected.clear();
+		device->collect_atmospheres(collected);
+		if (std::find(collected.begin(), collected.end(), &atmosphere) != collected.end())
+			throw std::invalid_argument("Atmosphere " + std::to_string(atmosphere.id) + " is still connected to a device");
+	}
+	if (deviceStore && deviceStore->has_atmosphere(atmosphere))
+		throw std::invalid_argument("Atmosphere " + std::to_string(atmosphere.id) + " is still used by the device store");
+	atmospheres.erase(atmospheres.begin() + index);
+	atmosphereIndices.erase(&atmosphere);
+	for (std::size_t i = index; i < atmospheres.size(); ++i)
+		atmosphereIndices[atmospheres[i]] = i;
+	dirty = true;
+	auto owned = std::find_if(ownedAtmospheres.begin(), ownedAtmospheres.end(),
+		[&](std::unique_ptr<Atmosphere> const &entry) { return entry.get() == &atmosphere; });
+	if (owned != ownedAtmospheres.end())
+		ownedAtmospheres.erase(owned);
+}
+void AtmosphericsNetwork::set_device_store(DeviceStore *store)
+{
+	if (deviceStore)
+		deviceStore->snapshot = nullptr;
+	deviceStore = store;
+	storeAtmospheres = 0;
+	dirty = true;
+}
+void AtmosphericsNetwork::remove_device(GenericDevice &device)
+{
+	std::size_t index = index_of(device);
+	detach_counters();
+	split_zones();
+	device.snapshot = nullptr;
+	device.snapshotIndices = nullptr;
+	devices.erase(devices.begin() + index);
+	deviceIndices.erase(&device);
+	for (std::size_t i = index; i < devices.size(); ++i)
+		deviceIndices[devices[i]] = i;
+	dirty = true;
+	auto owned = std::find_if(ownedDevices.begin(), ownedDevices.end(),
+		[&](std::unique_ptr<GenericDevice> const &entry) { return entry.get() == &device; });
+	if (owned != ownedDevices.end())
+		ownedDevices.erase(owned);
+}
+
+std::size_t AtmosphericsNetwork::index_of(Atmosphere const &atmosphere) const
+{
+	auto it = atmosphereIndices.find(&atmosphere);
+	if (it == atmosphereIndices.end())
+		throw std::invalid_argument("Atmosphere " + std::to_string(atmosphere.id) + " is not part of this network");
+	return it->second;
+}
+std::size_t AtmosphericsNetwork::index_of(GenericDevice const &device) const
+{
+	auto it = deviceIndices.find(&device);
+	if (it == deviceIndices.end())
+		throw std::invalid_argument("Device is not part of this network");
+	return it->second;
+}
+std::pair<std::size_t const *, std::size_t const *> AtmosphericsNetwork::device_atmospheres(std::size_t index)
+{
+	if (dirty)
+		rebuild();
+	std::size_t const *base = deviceAtmospheres.data();
+	return { base + deviceAtmosphereOffsets[index], base + deviceAtmosphereOffsets[index + 1] };
+}
+std::pair<std::size_t const *, std::size_t const *> AtmosphericsNetwork::atmosphere_devices(std::size_t index)
+{
+	if (dirty)
+		rebuild();
+	std::size_t const *base = atmosphereDevices.data();
+	return { base + atmosphereDeviceOffsets[index], base + atmosphereDeviceOffsets[index + 1] };
+}
+
+void AtmosphericsNetwork::rebuild()
+{
+	detach_counters();
+	// indices of existing atmospheres are still the same here
+	split_zones();
+	if (deviceStore) {
+		auto const &table = deviceStore->atmosphere_table();
+		for (; storeAtmospheres < table.size(); ++storeAtmospheres)
+			add_atmosphere(*table[storeAtmospheres]);
+	}
+	// device -> atmospheres
+	deviceAtmosphereOffsets.assign(1, 0);
+	deviceAtmospheres.clear();
+	deviceSnapshotOffsets.clear();
+	deviceSnapshotIndices.clear();
+	for (GenericDevice *device : devices) {
+		collected.clear();
+		device->collect_atmospheres(collected);
+		deviceSnapshotOffsets.push_back(deviceSnapshotIndices.size());
+		for (Atmosphere *atmosphere : collected) {
+			std::size_t index = atmosphereIndices.at(atmosphere);
+			deviceSnapshotIndices.push_back(index);
+			// a device may reference the same atmosphere twice, only count it once
+			auto begin = deviceAtmospheres.begin() + deviceAtmosphereOffsets.back();
+			if (std::find(begin, deviceAtmospheres.end(), index) == deviceAtmospheres.end())
+				deviceAtmospheres.push_back(index);
+		}
+		deviceAtmosphereOffsets.push_back(deviceAtmospheres.size());
+	}
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		devices[device]->snapshot = &snapshot;
+		devices[device]->snapshotIndices = deviceSnapshotIndices.data() + deviceSnapshotOffsets[device];
+	}
+	if (deviceStore) {
+		deviceStore->snapshot = &snapshot;
+		deviceStore->snapshotIndices.clear();
+		for (Atmosphere *atmosphere : deviceStore->atmosphere_table())
+			deviceStore->snapshotIndices.push_back(atmosphereIndices.at(atmosphere));
+	}
+	// atmosphere -> devices, by counting then filling
+	atmosphereDeviceOffsets.assign(atmospheres.size() + 1, 0);
+	for (std::size_t index : deviceAtmospheres)
+		++atmosphereDeviceOffsets[index + 1];
+	for (std::size_t i = 0; i < atmospheres.size(); ++i)
+		atmosphereDeviceOffsets[i + 1] += atmosphereDeviceOffsets[i];
+	atmosphereDevices.resize(deviceAtmospheres.size());
+	atmosphereSlots.resize(deviceAtmospheres.size());
+	std::vector<std::size_t> cursor(atmosphereDeviceOffsets.begin(), atmosphereDeviceOffsets.end() - 1);
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		for (std::size_t i = deviceAtmosphereOffsets[device]; i < deviceAtmosphereOffsets[device + 1]; ++i) {
+			std::size_t position = cursor[deviceAtmospheres[i]]++;
+			atmosphereDevices[position] = device;
+			atmosphereSlots[position] = i;
+		}
+	}
+	deviceAtmospherePointers.resize(deviceAtmospheres.size());
+	for (std::size_t i = 0; i < deviceAtmospheres.size(); ++i)
+		deviceAtmospherePointers[i] = atmospheres[deviceAtmospheres[i]];
+	fluxSlots.resize(deviceAtmospheres.size());
+	slotScales.resize(deviceAtmospheres.size());
+	atmosphereFlux.resize(atmospheres.size());
+	if (fluxDevices) {
+		// so gas showing up later doesn't grow them mid-step
+		for (AtmosphericsFlux &flux : fluxSlots)
+			flux.reserve(atmosphericsElements.size());
+		for (AtmosphericsFlux &flux : atmosphereFlux)
+			flux.reserve(atmosphericsElements.size());
+	}
+	fluxFallback.assign(devices.size(), 0);
+	deviceImplicit.assign(devices.size(), 0);
+
+	// topology changed, so start everybody off awake
+	devicePassive.resize(devices.size());
+	for (std::size_t i = 0; i < devices.size(); ++i)
+		devicePassive[i] = devices[i]->is_passive();
+	lastPressures.resize(atmospheres.size());
+	lastTemperatures.resize(atmospheres.size());
+	quietSteps.assign(atmospheres.size(), 0);
+	reacting.assign(atmospheres.size(), 0);
+	if constexpr (profiling_enabled()) {
+		deviceHeldBack.assign(devices.size(), 0);
+		atmosphereMoved.assign(atmospheres.size(), 0);
+	}
+	for (std::size_t i = 0; i < atmospheres.size(); ++i) {
+		atmospheres[i]->wake();
+		lastPressures[i] = atmospheres[i]->get_pressure();
+		lastTemperatures[i] = atmospheres[i]->get_temperature();
+	}
+	rebuild_zones();
+
+	volumeSchedule.clear();
+	for (std::size_t i = 0; i < atmospheres.size(); ++i)
+		if (atmospheres[i]->is_elastic())
+			volumeSchedule.push_back(i);
+	dirty = false;
+	colored = false;
+}
+void AtmosphericsNetwork::color_devices()
+{
+	// greedy coloring of the conflict graph, where two devices conflict if they
+	// share an atmosphere, visiting devices in registration order
+	std::vector<std::size_t> colors(devices.size(), SIZE_MAX);
+	std::vector<bool> taken;
+	std::size_t colorCount = 0;
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		taken.assign(colorCount + 1, false);
+		for (std::size_t i = deviceAtmosphereOffsets[device]; i < deviceAtmosphereOffsets[device + 1]; ++i) {
+			std::size_t atmosphere = deviceAtmospheres[i];
+			for (std::size_t j = atmosphereDeviceOffsets[atmosphere]; j < atmosphereDeviceOffsets[atmosphere + 1]; ++j) {
+				std::size_t color = colors[atmosphereDevices[j]];
+				if (color != SIZE_MAX)
+					taken[color] = true;
+			}
+		}
+		std::size_t color = 0;
+		while (taken[color])
+			++color;
+		colors[device] = color;
+		colorCount = std::max(colorCount, color + 1);
+	}
+	// bucket by color, keeping registration order inside each batch
+	colorOffsets.assign(colorCount + 1, 0);
+	for (std::size_t color : colors)
+		++colorOffsets[color + 1];
+	for (std::size_t i = 0; i < colorCount; ++i)
+		colorOffsets[i + 1] += colorOffsets[i];
+	colorDevices.resize(devices.size());
+	std::vector<std::size_t> cursor(colorOffsets.begin(), colorOffsets.end() - 1);
+	for (std::size_t device = 0; device < devices.size(); ++device)
+		colorDevices[cursor[colors[device]]++] = device;
+	colored = true;
+}
+std::size_t AtmosphericsNetwork::device_color_count()
+{
+	if (dirty)
+		rebuild();
+	if (!colored)
+		color_devices();
+	return colorOffsets.size() - 1;
+}
+void AtmosphericsNetwork::update_devices(double dt)
+{
+	if (fluxDevices) {
+		update_devices_flux(dt);
+		return;
+	}
+	if (!parallelDevices) {
+		for (std::size_t device = 0; device < devices.size(); ++device)
+			if (!device_skipped(device))
+				devices[device]->update(dt);
+		return;
+	}
+	if (!colored)
+		color_devices();
+	for (std::size_t color = 0; color + 1 < colorOffsets.size(); ++color) {
+		std::size_t const *batch = colorDevices.data() + colorOffsets[color];
+		std::size_t count = colorOffsets[color + 1] - colorOffsets[color];
+		executor->parallel_for(count, deviceGrain, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; ++i)
+				if (!device_skipped(batch[i]))
+					devices[batch[i]]->update(dt);
+		});
+	}
+}
+void AtmosphericsNetwork::update_devices_flux(double dt)
+{
+	// phase 1: devices only read, and only write their own slots
+	executor->parallel_for(devices.size(), deviceGrain, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t device = begin; device < end; ++device) {
+			std::size_t first = deviceAtmosphereOffsets[device];
+			std::size_t count = deviceAtmosphereOffsets[device + 1] - first;
+			for (std::size_t i = first; i < first + count; ++i)
+				fluxSlots[i].clear();
+			if (device_skipped(device)) {
+				fluxFallback[device] = 0;
+				continue;
+			}
+			DeviceFlux flux(deviceAtmospherePointers.data() + first, fluxSlots.data() + first, count);
+			fluxFallback[device] = !devices[device]->emit_flux(dt, flux);
+		}
+	});
+	// phase 2: each atmosphere adds up what its devices draw out of it, per
+	// species, and works out how far each slot has to be scaled down so the
+	// total doesn't exceed what it holds
+	executor->parallel_for(atmospheres.size(), grain_for(atmospheres.size(), 4), [&](std::size_t begin, std::size_t end) {
+		for (std::size_t atmosphere = begin; atmosphere < end; ++atmosphere) {
+			std::size_t first = atmosphereDeviceOffsets[atmosphere];
+			std::size_t last = atmosphereDeviceOffsets[atmosphere + 1];
+			double requested[MAX_ATMOSPHERICS_ELEMENTS];
+			ElementMask drawn = 0;
+			for (std::size_t i = first; i < last; ++i) {
+				if (fluxFallback[atmosphereDevices[i]])
+					continue;
+				AtmosphericsFlux const &slot = fluxSlots[atmosphereSlots[i]];
+				for (ElementMask remaining = slot.touched; remaining != 0; remaining &= remaining - 1) {
+					ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+					if (slot.moles[element] >= 0)
+						continue;
+					if (!(drawn & element_bit(element))) {
+						requested[element] = 0;
+						drawn |= element_bit(element);
+					}
+					requested[element] -= slot.moles[element];
+				}
+			}
+			Atmosphere const &source = *atmospheres[atmosphere];
+			for (std::size_t i = first; i < last; ++i) {
+				AtmosphericsFlux const &slot = fluxSlots[atmosphereSlots[i]];
+				double scale = 1;
+				if (!fluxFallback[atmosphereDevices[i]]) {
+					for (ElementMask remaining = slot.touched & drawn; remaining != 0; remaining &= remaining - 1) {
+						ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+						double available = source.get_moles(element);
+						if (slot.moles[element] < 0 && requested[element] > available)
+							scale = std::min(scale, available / requested[element]);
+					}
+				}
+				slotScales[atmosphereSlots[i]] = scale;
+			}
+		}
+	});
+	// phase 3: each atmosphere gathers its slots in device order, each scaled
+	// by the smallest scale of its device's slots, and applies them
+	executor->parallel_for(atmospheres.size(), grain_for(atmospheres.size(), 4), [&](std::size_t begin, std::size_t end) {
+		for (std::size_t atmosphere = begin; atmosphere < end; ++atmosphere) {
+			AtmosphericsFlux &sum = atmosphereFlux[atmosphere];
+			sum.clear();
+			double moved = 0;
+			for (std::size_t i = atmosphereDeviceOffsets[atmosphere]; i < atmosphereDeviceOffsets[atmosphere + 1]; ++i) {
+				std::size_t device = atmosphereDevices[i];
+				if (fluxFallback[device])
+					continue;
+				double const *scales = slotScales.data();
+				double scale = *std::min_element(scales + deviceAtmosphereOffsets[device], scales + deviceAtmosphereOffsets[device + 1]);
+				AtmosphericsFlux const &slot = fluxSlots[atmosphereSlots[i]];
+				sum.accumulate(slot, scale);
+				// what devices between atmospheres draw out of this one, not what sinks destroy
+				if constexpr (profiling_enabled()) {
+					if (deviceAtmosphereOffsets[device + 1] - deviceAtmosphereOffsets[device] > 1) {
+						for (ElementMask remaining = slot.touched; remaining != 0; remaining &= remaining - 1) {
+							ElementId element = static_cast<ElementId>(std::countr_zero(remaining));
+							moved -= std::min(0.0, slot.moles[element] * scale);
+						}
+					}
+				}
+			}
+			if (sum.touched != 0 || sum.heat != 0)
+				atmospheres[atmosphere]->apply_flux(sum);
+			atmospheres[atmosphere]->count_moved(moved);
+		}
+	});
+	for (std::size_t device = 0; device < devices.size(); ++device)
+		if (fluxFallback[device])
+			devices[device]->update(dt);
+}
+bool AtmosphericsNetwork::device_idle(std::size_t device) const
+{
+	std::size_t first = deviceAtmosphereOffsets[device];
+	std::size_t last = deviceAtmosphereOffsets[device + 1];
+	if (!zoneRepresentatives.empty() && deviceLinks[device] && last - first >= 2) {
+		// a link with every end in the same merged zone has nothing to even out
+		auto zone = [&](std::size_t i) {
+			std::size_t atmosphere = deviceAtmospheres[i];
+			return absorbedBy[atmosphere] != SIZE_MAX ? absorbedBy[atmosphere] : atmosphere;
+		};
+		bool inside = true;
+		for (std::size_t i = first + 1; i < last && inside; ++i)
+			inside = zone(i) == zone(first);
+		if (inside)
+			return true;
+	}
+	if (!sleepAtmospheres || !devicePassive[device])
+		return false;
+	for (std::size_t i = first; i < last; ++i)
+		if (!deviceAtmospherePointers[i]->sleeping)
+			return false;
+	return true;
+}
+void AtmosphericsNetwork::update_sleep()
+{
+	// a running passive device with a gradient across it is about to move
+	// something, so its atmospheres can't count as settled. Neither can one
+	// that is still reacting, however slowly: it would stop for good.
+	unsettled.assign(reacting.begin(), reacting.end());
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		if (!devicePassive[device] || device_idle(device) || !devices[device]->is_running())
+			continue;
+		std::size_t first = deviceAtmosphereOffsets[device];
+		std::size_t last = deviceAtmosphereOffsets[device + 1];
+		if (first == last)
+			continue;
+		double minPressure = deviceAtmospherePointers[first]->get_pressure(), maxPressure = minPressure;
+		double minTemperature = deviceAtmospherePointers[first]->get_temperature(), maxTemperature = minTemperature;
+		for (std::size_t i = first + 1; i < last; ++i) {
+			Atmosphere const &atmosphere = *deviceAtmospherePointers[i];
+			minPressure = std::min(minPressure, atmosphere.get_pressure());
+			maxPressure = std::max(maxPressure, atmosphere.get_pressure());
+			minTemperature = std::min(minTemperature, atmosphere.get_temperature());
+			maxTemperature = std::max(maxTemperature, atmosphere.get_temperature());
+		}
+		if (maxPressure - minPressure < sleepPressureEpsilon && maxTemperature - minTemperature < sleepTemperatureEpsilon)
+			continue;
+		for (std::size_t i = first; i < last; ++i)
+			unsettled[deviceAtmospheres[i]] = 1;
+	}
+	for (std::size_t i = 0; i < atmospheres.size(); ++i) {
+		Atmosphere &atmosphere = *atmospheres[i];
+		if (atmosphere_idle(i))
+			continue;
+		double pressure = atmosphere.get_pressure();
+		double temperature = atmosphere.get_temperature();
+		bool quiet = !unsettled[i]
+			&& std::abs(pressure - lastPressures[i]) < sleepPressureEpsilon
+			&& std::abs(temperature - lastTemperatures[i]) < sleepTemperatureEpsilon;
+		lastPressures[i] = pressure;
+		lastTemperatures[i] = temperature;
+		quietSteps[i] = quiet ? quietSteps[i] + 1 : 0;
+		if (quietSteps[i] >= sleepDelay) {
+			atmosphere.sleeping = true;
+			quietSteps[i] = 0;
+		}
+	}
+}
+std::size_t AtmosphericsNetwork::zone_find(std::size_t atmosphere)
+{
+	while (zoneParents[atmosphere] != atmosphere) {
+		zoneParents[atmosphere] = zoneParents[zoneParents[atmosphere]];
+		atmosphere = zoneParents[atmosphere];
+	}
+	return atmosphere;
+}
+void AtmosphericsNetwork::zone_link(std::size_t device)
+{
+	std::size_t first = deviceAtmosphereOffsets[device];
+	for (std::size_t i = first + 1; i < deviceAtmosphereOffsets[device + 1]; ++i) {
+		std::size_t a = zone_find(deviceAtmospheres[first]), b = zone_find(deviceAtmospheres[i]);
+		// lower index as root, so grouping doesn't depend on link order
+		zoneParents[std::max(a, b)] = std::min(a, b);
+	}
+}
+void AtmosphericsNetwork::rebuild_zones()
+{
+	std::size_t count = atmospheres.size();
+	zonePinned.assign(count, 0);
+	for (std::size_t i = 0; i < count; ++i)
+		zonePinned[i] = atmospheres[i]->is_elastic();
+	deviceLinks.resize(devices.size());
+	linkOpen.resize(devices.size());
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		deviceLinks[device] = devices[device]->is_open_link();
+		linkOpen[device] = deviceLinks[device] && devices[device]->is_on();
+		if (!deviceLinks[device])
+			for (std::size_t i = deviceAtmosphereOffsets[device]; i < deviceAtmosphereOffsets[device + 1]; ++i)
+				zonePinned[deviceAtmospheres[i]] = 1;
+	}
+	if (deviceStore)
+		for (Atmosphere *atmosphere : deviceStore->atmosphere_table())
+			zonePinned[atmosphereIndices.at(atmosphere)] = 1;
+	absorbedBy.assign(count, SIZE_MAX);
+	absorbedVolumes.assign(count, 0);
+	zoneAbsorbed.resize(count);
+	for (auto &absorbed : zoneAbsorbed)
+		absorbed.clear();
+	zoneRepresentatives.clear();
+
+	zoneParents.resize(count);
+	for (std::size_t i = 0; i < count; ++i)
+		zoneParents[i] = i;
+	for (std::size_t device = 0; device < devices.size(); ++device)
+		if (linkOpen[device])
+			zone_link(device);
+	zonesGrouped = false;
+}
+void AtmosphericsNetwork::group_zones()
+{
+	// components with more than one member, in order of their root
+	std::size_t count = atmospheres.size();
+	zoneSizes.assign(count, 0);
+	for (std::size_t i = 0; i < count; ++i)
+		++zoneSizes[zone_find(i)];
+	zoneCursor.assign(count, SIZE_MAX);
+	zoneOffsets.assign(1, 0);
+	for (std::size_t i = 0; i < count; ++i) {
+		if (zoneSizes[i] > 1) {
+			zoneCursor[i] = zoneOffsets.back();
+			zoneOffsets.push_back(zoneOffsets.back() + zoneSizes[i]);
+		}
+	}
+	zoneMembers.resize(zoneOffsets.back());
+	for (std::size_t i = 0; i < count; ++i) {
+		std::size_t root = zone_find(i);
+		if (zoneCursor[root] != SIZE_MAX)
+			zoneMembers[zoneCursor[root]++] = i;
+	}
+	zonesGrouped = true;
+}
+void AtmosphericsNetwork::update_zones()
+{
+	if (!mergeZones) {
+		split_zones();
+		return;
+	}
+	bool regroup = false, closed = false;
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		if (!deviceLinks[device])
+			continue;
+		bool open = devices[device]->is_on();
+		if (open == static_cast<bool>(linkOpen[device]))
+			continue;
+		linkOpen[device] = open;
+		regroup = true;
+		std::size_t first = deviceAtmosphereOffsets[device];
+		std::size_t last = deviceAtmosphereOffsets[device + 1];
+		// the zones on either end change shape, take them apart first
+		for (std::size_t i = first; i < last; ++i) {
+			std::size_t atmosphere = deviceAtmospheres[i];
+			std::size_t representative = absorbedBy[atmosphere] != SIZE_MAX ? absorbedBy[atmosphere] : atmosphere;
+			if (!zoneAbsorbed[representative].empty())
+				split_zone(representative);
+		}
+		if (!open) {
+			closed = true;
+			continue;
+		}
+		zone_link(device);
+	}
+	// union-find can't take links out, so start over when one closes
+	if (closed) {
+		for (std::size_t i = 0; i < zoneParents.size(); ++i)
+			zoneParents[i] = i;
+		for (std::size_t device = 0; device < devices.size(); ++device)
+			if (linkOpen[device])
+				zone_link(device);
+	}
+	if (regroup || !zonesGrouped)
+		group_zones();
+
+	// something was written into a merged-away atmosphere, give it its share back
+	for (std::size_t i = zoneRepresentatives.size(); i-- > 0;) {
+		std::size_t representative = zoneRepresentatives[i];
+		for (std::size_t member : zoneAbsorbed[representative]) {
+			Atmosphere const &atmosphere = *atmospheres[member];
+			if (atmosphere.volume != 0 || atmosphere.get_moles() > 0 || atmosphere.heatEnergy > 0) {
+				split_zone(representative);
+				break;
+			}
+		}
+	}
+
+	for (std::size_t zone = 0; zone + 1 < zoneOffsets.size(); ++zone) {
+		std::size_t const *begin = zoneMembers.data() + zoneOffsets[zone];
+		std::size_t const *end = zoneMembers.data() + zoneOffsets[zone + 1];
+		std::size_t pinned = 0;
+		bool merged = false;
+		for (std::size_t const *member = begin; member != end; ++member) {
+			pinned += zonePinned[*member];
+			merged = merged || absorbedBy[*member] != SIZE_MAX;
+		}
+		if (merged || pinned > 1)
+			continue;
+		Atmosphere const &front = *atmospheres[*begin];
+		double minPressure = front.get_pressure(), maxPressure = minPressure;
+		double minTemperature = front.get_temperature(), maxTemperature = minTemperature;
+		for (std::size_t const *member = begin + 1; member != end; ++member) {
+			Atmosphere const &atmosphere = *atmospheres[*member];
+			minPressure = std::min(minPressure, atmosphere.get_pressure());
+			maxPressure = std::max(maxPressure, atmosphere.get_pressure());
+			minTemperature = std::min(minTemperature, atmosphere.get_temperature());
+			maxTemperature = std::max(maxTemperature, atmosphere.get_temperature());
+		}
+		if (maxPressure - minPressure < zonePressureEpsilon && maxTemperature - minTemperature < zoneTemperatureEpsilon)
+			merge_zone(zone);
+	}
+}
+void AtmosphericsNetwork::merge_zone(std::size_t zone)
+{
+	std::size_t const *begin = zoneMembers.data() + zoneOffsets[zone];
+	std::size_t const *end = zoneMembers.data() + zoneOffsets[zone + 1];
+	// the pinned member has to keep its gas where its devices can see it
+	std::size_t representative = *begin;
+	for (std::size_t const *member = begin; member != end; ++member)
+		if (zonePinned[*member])
+			representative = *member;
+	Atmosphere &into = *atmospheres[representative];
+	for (std::size_t const *member = begin; member != end; ++member) {
+		if (*member == representative)
+			continue;
+		absorbedVolumes[*member] = atmospheres[*member]->volume;
+		into.merge(*atmospheres[*member]);
+		absorbedBy[*member] = representative;
+		zoneAbsorbed[representative].push_back(*member);
+	}
+	zoneRepresentatives.push_back(representative);
+}
+void AtmosphericsNetwork::split_zone(std::size_t representative)
+{
+	Atmosphere &from = *atmospheres[representative];
+	// Atmosphere::split, through one reused atmosphere instead of a new one each time
+	if (!zoneScratch)
+		zoneScratch.emplace(0.0);
+	for (std::size_t member : zoneAbsorbed[representative]) {
+		zoneScratch->volume = absorbedVolumes[member];
+		from.move_gas_volume(*zoneScratch, absorbedVolumes[member]);
+		from.add_volume(-absorbedVolumes[member]);
+		atmospheres[member]->merge(*zoneScratch);
+		absorbedBy[member] = SIZE_MAX;
+	}
+	zoneAbsorbed[representative].clear();
+	zoneRepresentatives.erase(std::find(zoneRepresentatives.begin(), zoneRepresentatives.end(), representative));
+}
+void AtmosphericsNetwork::split_zones()
+{
+	while (!zoneRepresentatives.empty())
+		split_zone(zoneRepresentatives.back());
+}
+Atmosphere &AtmosphericsNetwork::zone_of(Atmosphere &atmosphere)
+{
+	std::size_t index = index_of(atmosphere);
+	if (index < absorbedBy.size() && absorbedBy[index] != SIZE_MAX)
+		return *atmospheres[absorbedBy[index]];
+	return atmosphere;
+}
+void AtmosphericsNetwork::attach_counters()
+{
+	if constexpr (profiling_enabled()) {
+		std::fill(deviceHeldBack.begin(), deviceHeldBack.end(), 0);
+		std::fill(atmosphereMoved.begin(), atmosphereMoved.end(), 0.0);
+		for (std::size_t device = 0; device < devices.size(); ++device)
+			devices[device]->heldBack = &deviceHeldBack[device];
+		for (std::size_t atmosphere = 0; atmosphere < atmospheres.size(); ++atmosphere)
+			atmospheres[atmosphere]->movedMoles = &atmosphereMoved[atmosphere];
+		countersAttached = true;
+	}
+}
+void AtmosphericsNetwork::detach_counters()
+{
+	if (!countersAttached)
+		return;
+	for (GenericDevice *device : devices)
+		device->heldBack = nullptr;
+	for (Atmosphere *atmosphere : atmospheres)
+		atmosphere->movedMoles = nullptr;
+	countersAttached = false;
+}
+void AtmosphericsNetwork::take_snapshot()
+{
+	snapshot.states.resize(atmospheres.size());
+	auto take = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i)
+			snapshot.states[i] = atmospheres[i]->state();
+	};
+	if (parallelAtmospheres)
+		executor->parallel_for(atmospheres.size(), grain_for(atmospheres.size(), 1), take);
+	else
+		take(0, atmospheres.size());
+	snapshot.valid = true;
+}
+void AtmosphericsNetwork::collect_transport()
+{
+	transportLinks.clear();
+	std::fill(deviceImplicit.begin(), deviceImplicit.end(), 0);
+	if (!implicitTransport)
+		return;
+	for (std::size_t device = 0; device < devices.size(); ++device) {
+		std::size_t first = deviceAtmosphereOffsets[device];
+		if (deviceAtmosphereOffsets[device + 1] - first < 2 || device_idle(device))
+			continue;
+		double gas, heat;
+		// checks should_run(), so held back links count like held back updates
+		if (!devices[device]->get_conductance(gas, heat))
+			continue;
+		deviceImplicit[device] = 1;
+		std::size_t a = deviceAtmospheres[first];
+		std::size_t b = deviceAtmospheres[first + 1];
+		// no pressure to speak of without a volume
+		if (atmospheres[a]->volume <= 0 || atmospheres[b]->volume <= 0)
+			gas = 0;
+		if (gas > 0 || heat > 0)
+			transportLinks.push_back(TransportLink { a, b, gas, heat });
+	}
+}
+template <typename F>
+void AtmosphericsNetwork::transport_nodes(F &&conductance)
+{
+	transportSystem.clear();
+	transportAtmospheres.clear();
+	transportNodes.assign(atmospheres.size(), SIZE_MAX);
+	for (TransportLink const &link : transportLinks) {
+		double value = conductance(link);
+		if (value <= 0)
+			continue;
+		for (std::size_t atmosphere : { link.a, link.b }) {
+			if (transportNodes[atmosphere] != SIZE_MAX)
+				continue;
+			// capacity is filled in by the caller
+			transportNodes[atmosphere] = transportSystem.add_node(0);
+			transportAtmospheres.push_back(atmosphere);
+		}
+		transportSystem.add_edge(transportNodes[link.a], transportNodes[link.b], value);
+	}
+}
+void AtmosphericsNetwork::update_transport(double dt)
+{
+	transportIterations = 0;
+	if (transportLinks.empty())
+		return;
+
+	// pressure: A p' + dt K L p' = n, with A = V/RT so that n = A p
+	transport_nodes([](TransportLink const &link) { return link.gasConductance; });
+	std::size_t count = transportSystem.size();
+	if (count > 0) {
+		// an empty atmosphere takes the temperature of what flows into it, so
+		// guess that from its neighbours instead of using minTemperature
+		transportSolution.assign(count, 0.0);
+		transportWeights.assign(count, 0.0);
+		for (TransportLink const &link : transportLinks) {
+			if (link.gasConductance <= 0)
+				continue;
+			Atmosphere const &a = *atmospheres[link.a];
+			Atmosphere const &b = *atmospheres[link.b];
+			if (a.get_moles() <= 0 && b.get_moles() > 0) {
+				transportSolution[transportNodes[link.a]] += link.gasConductance * b.get_temperature();
+				transportWeights[transportNodes[link.a]] += link.gasConductance;
+			}
+			if (b.get_moles() <= 0 && a.get_moles() > 0) {
+				transportSolution[transportNodes[link.b]] += link.gasConductance * a.get_temperature();
+				transportWeights[transportNodes[link.b]] += link.gasConductance;
+			}
+		}
+		transportRhs.resize(count);
+		for (std::size_t node = 0; node < count; ++node) {
+			Atmosphere const &atmosphere = *atmospheres[transportAtmospheres[node]];
+			double temperature = atmosphere.get_temperature();
+			if (atmosphere.get_moles() <= 0 && transportWeights[node] > 0)
+				temperature = transportSolution[node] / transportWeights[node];
+			double capacity = atmosphere.volume / (atmosphere.gasConstant * temperature);
+			transportSystem.capacities[node] = capacity;
+			transportRhs[node] = atmosphere.get_moles();
+			transportSolution[node] = atmosphere.get_moles() / capacity;
+		}
+		transportIterations += transportSystem.solve(dt, transportRhs.data(), transportSolution.data(),
+			transportTolerance, transportMaxIterations);
+
+		// move gas downhill, upstream atmospheres first, so whatever flows
+		// through an atmosphere has arrived before it's passed on
+		transportOrder.clear();
+		for (std::size_t i = 0; i < transportSystem.edges.size(); ++i)
+			transportOrder.push_back(i);
+		auto upstream = [&](std::size_t i) {
+			auto const &edge = transportSystem.edges[i];
+			return std::max(transportSolution[edge.a], transportSolution[edge.b]);
+		};
+		// ties by index, std::stable_sort would allocate a buffer every step
+		std::sort(transportOrder.begin(), transportOrder.end(), [&](std::size_t x, std::size_t y) {
+			double ux = upstream(x), uy = upstream(y);
+			return ux > uy || (ux == uy && x < y);
+		});
+		for (std::size_t i : transportOrder) {
+			auto const &edge = transportSystem.edges[i];
+			double flow = dt * edge.conductance * (transportSolution[edge.a] - transportSolution[edge.b]);
+			std::size_t from = flow > 0 ? edge.a : edge.b;
+			std::size_t to = flow > 0 ? edge.b : edge.a;
+			Atmosphere &source = *atmospheres[transportAtmospheres[from]];
+			double moles = source.get_moles();
+			if (moles > 0 && flow != 0)
+				source.transfer(*atmospheres[transportAtmospheres[to]], std::abs(flow) / moles);
+		}
+	}
+
+	// temperature: C T' + dt G L T' = C T, over atmospheres that can hold heat
+	transport_nodes([&](TransportLink const &link) {
+		bool holdsHeat = atmospheres[link.a]->get_heat_capacity() > 0 && atmospheres[link.b]->get_heat_capacity() > 0;
+		return holdsHeat ? link.heatConductance : 0;
+	});
+	count = transportSystem.size();
+	if (count == 0)
+		return;
+	transportRhs.resize(count);
+	transportSolution.resize(count);
+	for (std::size_t node = 0; node < count; ++node) {
+		Atmosphere const &atmosphere = *atmospheres[transportAtmospheres[node]];
+		transportSystem.capacities[node] = atmosphere.get_heat_capacity();
+		transportSolution[node] = atmosphere.get_temperature();
+		transportRhs[node] = transportSystem.capacities[node] * transportSolution[node];
+	}
+	transportIterations += transportSystem.solve(dt, transportRhs.data(), transportSolution.data(),
+		transportTolerance, transportMaxIterations);
+	for (std::size_t node = 0; node < count; ++node) {
+		Atmosphere &atmosphere = *atmospheres[transportAtmospheres[node]];
+		atmosphere.add_heat(transportSystem.capacities[node] * (transportSolution[node] - atmosphere.get_temperature()));
+	}
+}
+
+std::size_t AtmosphericsNetwork::sleeping_count() const
+{
+	return std::count_if(atmospheres.begin(), atmospheres.end(), [](Atmosphere const *atmosphere) { return atmosphere->sleeping; });
+}
+
+std::size_t AtmosphericsNetwork::grain_for(std::size_t count, double costPerItem) const
+{
+	std::size_t grain = static_cast<std::size_t>(chunkCost / std::max(1.0, costPerItem));
+	// keep a few chunks per thread around so there is something to steal
+	std::size_t maxGrain = count / (executor->concurrency() * 4);
+	return std::max<std::size_t>(1, std::min(grain, maxGrain));
+}
+
+void AtmosphericsNetwork::step(double dt)
+{
+	std::uint64_t allocationsBefore = allocation_count();
+	PhaseClock clock;
+	// devices added to the store since may bring new atmospheres
+	if (deviceStore && storeAtmospheres != deviceStore->atmosphere_table().size())
+		dirty = true;
+	bool rebuilt = dirty;
+	if (dirty)
+		rebuild();
+	// build it here, before react() can get to it from several threads
+	atmosphericsReactionIndex.update();
+	if constexpr (profiling_enabled()) {
+		stepStats = NetworkStats();
+		stepStats.steps = 1;
+		clock.lap();
+	}
+	if (mergeZones || !zoneRepresentatives.empty())
+		update_zones();
+	if constexpr (profiling_enabled()) {
+		// after the zones, merging and splitting them moves gas around but
+		// isn't a transfer
+		attach_counters();
+		stepStats.mixingNanoseconds += clock.lap();
+	}
+	std::atomic<std::uint64_t> reactionsFired = 0;
+	std::atomic<std::uint64_t> activeAtmospheres = 0;
+	if (parallelAtmospheres) {
+		// react() checks every reactant of every reaction
+		double reactionCost = 1;
+		for (auto const &reaction : atmosphericsReactions)
+			reactionCost += reaction.reactants.size();
+		executor->parallel_for(atmospheres.size(), grain_for(atmospheres.size(), reactionCost),
+			[&](std::size_t begin, std::size_t end) {
+				std::uint64_t fired = 0, active = 0;
+				for (std::size_t i = begin; i < end; ++i) {
+					reacting[i] = 0;
+					if (!atmosphere_idle(i)) {
+						std::size_t ran = atmospheres[i]->react(dt);
+						reacting[i] = ran > 0;
+						fired += ran;
+						++active;
+					}
+				}
+				if constexpr (profiling_enabled()) {
+					reactionsFired.fetch_add(fired, std::memory_order_relaxed);
+					activeAtmospheres.fetch_add(active, std::memory_order_relaxed);
+				}
+			});
+	} else {
+		for (std::size_t i = 0; i < atmospheres.size(); ++i) {
+			reacting[i] = 0;
+			if (!atmosphere_idle(i)) {
+				std::size_t fired = atmospheres[i]->react(dt);
+				reacting[i] = fired > 0;
+				if constexpr (profiling_enabled()) {
+					reactionsFired.fetch_add(fired, std::memory_order_relaxed);
+					activeAtmospheres.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+	if constexpr (profiling_enabled()) {
+		stepStats.reactionNanoseconds = clock.lap();
+		stepStats.reactionsFired = reactionsFired.load(std::memory_order_relaxed);
+		stepStats.activeAtmospheres = activeAtmospheres.load(std::memory_order_relaxed);
+	}
+	take_snapshot();
+	collect_transport();
+	update_devices(dt);
+	if (deviceStore)
+		deviceStore->update(dt);
+	if constexpr (profiling_enabled())
+		stepStats.deviceNanoseconds = clock.lap();
+	update_transport(dt);
+	if constexpr (profiling_enabled()) {
+		stepStats.mixingNanoseconds += clock.lap();
+		detach_counters();
+		stepStats.devicesSkipped = std::count(deviceHeldBack.begin(), deviceHeldBack.end(), 1);
+		stepStats.molesTransferred = std::accumulate(atmosphereMoved.begin(), atmosphereMoved.end(), 0.0);
+		clock.lap();
+	}
+	snapshot.valid = false;
+	if (parallelAtmospheres) {
+		executor->parallel_for(volumeSchedule.size(), grain_for(volumeSchedule.size(), 1),
+			[&](std::size_t begin, std::size_t end) {
+				for (std::size_t i = begin; i < end; ++i)
+					if (!atmosphere_idle(volumeSchedule[i]))
+						atmospheres[volumeSchedule[i]]->update_volume(dt);
+			});
+	} else {
+		for (std::size_t index : volumeSchedule)
+			if (!atmosphere_idle(index))
+				atmospheres[index]->update_volume(dt);
+	}
+	if constexpr (profiling_enabled())
+		stepStats.elasticNanoseconds = clock.lap();
+	if (sleepAtmospheres)
+		update_sleep();
+	if constexpr (profiling_enabled()) {
+		stepStats.stepNanoseconds = clock.total();
+		totalStats += stepStats;
+	}
+	stepAllocations = allocation_count() - allocationsBefore;
+	if (checkAllocations && !rebuilt && stepAllocations > 0)
+		throw std::logic_error("AtmosphericsNetwork step made " + std::to_string(stepAllocations) + " heap allocations");
+}
+}
@@ -0,0 +1,375 @@
+#ifndef ATMOSPHERICS_NETWORK_HPP
+#define ATMOSPHERICS_NETWORK_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_device_store.hpp"
+#include "atmospherics_flux.hpp"
+#include "atmospherics_profile.hpp"
+#include "atmospherics_solver.hpp"
+#include "executor.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ZAtmos {
+// Keeps track of a set of atmospheres and the devices connecting them, and
+// steps the whole thing in fixed phases:
+//   1. reactions (Atmosphere::react) for every atmosphere
+//   2. device flows (GenericDevice::update) in registration order
+//   3. volume updates (Atmosphere::update_volume), e.g. for ElasticAtmosphere
+// The connectivity graph and schedule are only rebuilt when atmospheres or
+// devices are added or removed.
+//
+// With parallelDevices set, phase 2 instead runs devices in color batches:
+// devices are greedily colored (in registration order) so that no two devices
+// of the same color share an atmosphere, and each batch is spread over the
+// executor. Results only depend on the coloring, not on thread timing.
+// With parallelAtmospheres set, phases 1 and 3 are spread over the executor
+// too, since they only touch one atmosphere each.
+//
+// With fluxDevices set, phase 2 is split in two: every device first records
+// the transfers it wants into its own flux slots while only reading state
+// (GenericDevice::emit_flux), then each atmosphere sums the slots of its
+// devices and applies them at once. Since every device asks from the same
+// starting state, devices that together draw more of a species out of an
+// atmosphere than it holds are scaled down first, each by the smallest
+// available / requested of the species it draws, moles and heat alike.
+// Results don't depend on device order and every part runs on the executor
+// without locks. Devices that don't support flux are updated normally
+// afterwards, in registration order.
+//
+// With sleepAtmospheres set, an atmosphere whose pressure and temperature
+// barely change for sleepDelay steps, which had no reaction run in it, and
+// which isn't next to a running passive device (GenericDevice::is_passive)
+// with a gradient across it, is put to sleep. Sleeping atmospheres skip phases 1 and 3, and passive devices
+// between sleeping atmospheres are skipped. Any write to an atmosphere, device
+// toggle or topology change wakes them again.
+//
+// With mergeZones set, atmospheres joined by open links (GenericDevice::
+// is_open_link, e.g. Valve) are grouped into zones with a union-find. Once a
+// zone's pressures and temperatures are within zone epsilons of each other,
+// its members are merged into one representative with Atmosphere::merge and
+// the links inside are skipped, so a big open area costs one atmosphere.
+// A member that some other device or an elastic volume depends on is pinned;
+// a zone with more than one pinned member isn't merged, otherwise the pinned
+// member is the representative. Zones are split back by volume share with
+// Atmosphere::split when a link is toggled, a merged-away atmosphere is
+// written to, or the topology changes. Read merged-away atmospheres through
+// zone_of(), or call split_zones() first.
+//
+// With implicitTransport set, devices that are symmetric links (GenericDevice::
+// get_conductance, e.g. Valve and TemperatureConductor) are left out of phase
+// 2 and solved together right after it, as one backward Euler step over the
+// whole link graph: first pressure, (A + dt·K·L) p = n with A = V/RT per
+// atmosphere, K the gas conductances and L the graph Laplacian, then
+// temperature, (C + dt·G·L) T = C·T with heat capacities C and heat
+// conductances G. Gas is moved along each link from the higher solved pressure
+// to the lower with Atmosphere::transfer, upstream atmospheres first, so long
+// chains even out in one step at any dt without overshooting.
+//
+// Right before phase 2 the pressure, temperature and moles of every
+// atmosphere are snapshotted, and until the end of implicit transport devices
+// check their running limits (is_running) and similar gating against that
+// snapshot instead of the live atmospheres, so every device sees the same
+// state no matter what ran before it. The amounts moved still come from the
+// live atmospheres.
+//
+// Once the scratch buffers have grown to fit, a step that doesn't have to
+// rebuild the schedule performs no heap allocations; checkAllocations enforces
+// that in builds that count them.
+//
+// Built with ZATMOS_PROFILE, every step fills in a NetworkStats (see
+// atmospherics_profile.hpp) with the time spent per phase and what was done,
+// read it with last_step_stats() or summed with total_stats().
+//
+// A DeviceStore set with set_device_store() is updated at the end of phase 2,
+// on the calling thread, after the registered devices and before implicit
+// transport. Its atmospheres are registered automatically and pinned for
+// zone merging; its devices take no part in coloring, flux mode or implicit
+// transport.
+struct AtmosphericsNetwork {
+private:
+	std::vector<std::unique_ptr<Atmosphere>> ownedAtmospheres;
+	std::vector<std::unique_ptr<GenericDevice>> ownedDevices;
+	std::vector<Atmosphere *> atmospheres;
+	std::vector<GenericDevice *> devices;
+	std::unordered_map<Atmosphere const *, std::size_t> atmosphereIndices;
+	std::unordered_map<GenericDevice const *, std::size_t> deviceIndices;
+
+	// device -> atmospheres, as offsets into deviceAtmospheres (CSR)
+	std::vector<std::size_t> deviceAtmosphereOffsets;
+	std::vector<std::size_t> deviceAtmospheres;
+	// atmosphere -> devices, as offsets into atmosphereDevices (CSR)
+	std::vector<std::size_t> atmosphereDeviceOffsets;
+	std::vector<std::size_t> atmosphereDevices;
+	// parallel to atmosphereDevices, which entry of deviceAtmospheres links the two
+	std::vector<std::size_t> atmosphereSlots;
+	// parallel to deviceAtmospheres
+	std::vector<Atmosphere *> deviceAtmospherePointers;
+	// flux mode, one per deviceAtmospheres entry
+	std::vector<AtmosphericsFlux> fluxSlots;
+	// flux mode, summed flux per atmosphere
+	std::vector<AtmosphericsFlux> atmosphereFlux;
+	// flux mode, parallel to fluxSlots, how far that slot's draws have to be
+	// scaled down to not overdraw its atmosphere
+	std::vector<double> slotScales;
+	// flux mode, per device, set if emit_flux() isn't supported
+	std::vector<char> fluxFallback;
+	// per device, GenericDevice::is_passive()
+	std::vector<char> devicePassive;
+	// per atmosphere, state after the last step and how many steps it's been quiet
+	std::vector<double> lastPressures;
+	std::vector<double> lastTemperatures;
+	std::vector<unsigned> quietSteps;
+	// per atmosphere, set if a reaction ran in it this step
+	std::vector<char> reacting;
+	// scratch, atmospheres still reacting or next to a passive device with a
+	// gradient across it
+	std::vector<char> unsettled;
+	// zones: union-find parents per atmosphere, grouped into components with
+	// more than one member (CSR)
+	std::vector<std::size_t> zoneParents;
+	std::vector<std::size_t> zoneOffsets;
+	std::vector<std::size_t> zoneMembers;
+	bool zonesGrouped = false;
+	// scratch for group_zones()
+	std::vector<std::size_t> zoneSizes;
+	std::vector<std::size_t> zoneCursor;
+	// per atmosphere, elastic or used by a device that isn't an open link
+	std::vector<char> zonePinned;
+	// per device, is_open_link() and whether it was on last step
+	std::vector<char> deviceLinks;
+	std::vector<char> linkOpen;
+	// per atmosphere, representative it's merged into (SIZE_MAX if none) and its volume before
+	std::vector<std::size_t> absorbedBy;
+	std::vector<double> absorbedVolumes;
+	// per representative, atmospheres merged into it
+	std::vector<std::vector<std::size_t>> zoneAbsorbed;
+	std::vector<std::size_t> zoneRepresentatives;
+	// phase 3 only visits elastic atmospheres
+	std::vector<std::size_t> volumeSchedule;
+	// devices sorted by color, batch i is colorDevices[colorOffsets[i]..colorOffsets[i + 1])
+	std::vector<std::size_t> colorOffsets;
+	std::vector<std::size_t> colorDevices;
+	bool dirty = true;
+	bool colored = false;
+	SerialExecutor serialExecutor;
+	Executor *executor = &serialExecutor;
+	// scratch for collect_atmospheres
+	std::vector<Atmosphere *> collected;
+	// implicit transport, per device, set while the solver handles it this step
+	std::vector<char> deviceImplicit;
+	struct TransportLink {
+		std::size_t a, b;
+		double gasConductance; // mol/kPa·s
+		double heatConductance; // J/K·s
+	};
+	std::vector<TransportLink> transportLinks;
+	// per atmosphere, node in transportSystem or SIZE_MAX
+	std::vector<std::size_t> transportNodes;
+	// per node
+	std::vector<std::size_t> transportAtmospheres;
+	std::vector<double> transportRhs;
+	std::vector<double> transportSolution;
+	std::vector<double> transportWeights;
+	// links that move gas, sorted upstream first
+	std::vector<std::size_t> transportOrder;
+	ConductanceSystem transportSystem;
+	unsigned transportIterations = 0;
+	std::uint64_t stepAllocations = 0;
+	// only filled in with ZATMOS_PROFILE
+	NetworkStats stepStats;
+	NetworkStats totalStats;
+	// ZATMOS_PROFILE only, per device and per atmosphere, what should_run() and
+	// count_moved() noted while attach_counters() had them pointed here
+	std::vector<char> deviceHeldBack;
+	std::vector<double> atmosphereMoved;
+	bool countersAttached = false;
+	// split_zone() moves gas through this instead of a new atmosphere each time
+	std::optional<Atmosphere> zoneScratch;
+	// state of every atmosphere at the start of phase 2, read by device checks
+	AtmosphereSnapshot snapshot;
+	// per device, offset of its collect_atmospheres() entries in deviceSnapshotIndices
+	std::vector<std::size_t> deviceSnapshotOffsets;
+	std::vector<std::size_t> deviceSnapshotIndices;
+	DeviceStore *deviceStore = nullptr;
+	// store atmospheres registered so far
+	std::size_t storeAtmospheres = 0;
+
+	void rebuild();
+	void color_devices();
+	void update_devices(double dt);
+	void update_devices_flux(double dt);
+	// true if device is passive and all its atmospheres are asleep, or it's a link inside a merged zone
+	bool device_idle(std::size_t device) const;
+	// device_idle() or handled by the implicit transport solver this step
+	inline bool device_skipped(std::size_t device) const
+	{
+		return deviceImplicit[device] || device_idle(device);
+	}
+	// true if atmosphere is asleep or merged into another
+	inline bool atmosphere_idle(std::size_t atmosphere) const
+	{
+		return atmospheres[atmosphere]->sleeping || (atmosphere < absorbedBy.size() && absorbedBy[atmosphere] != SIZE_MAX);
+	}
+	void update_sleep();
+	void take_snapshot();
+	// Points GenericDevice::heldBack and Atmosphere::movedMoles at zeroed
+	// deviceHeldBack and atmosphereMoved, only with ZATMOS_PROFILE.
+	void attach_counters();
+	// Unsets them again, before anything that could outlive the arrays.
+	void detach_counters();
+	// picks up the links the solver takes over this step
+	void collect_transport();
+	void update_transport(double dt);
+	// fills transportSystem with an edge per link with a positive conductance(link),
+	// and a node per atmosphere they touch
+	template <typename F>
+	void transport_nodes(F &&conductance);
+	std::size_t zone_find(std::size_t atmosphere);
+	// joins the atmospheres of device in the union-find
+	void zone_link(std::size_t device);
+	void rebuild_zones();
+	void group_zones();
+	void update_zones();
+	void merge_zone(std::size_t zone);
+	void split_zone(std::size_t representative);
+	// atmospheres per chunk so each chunk costs about chunkCost
+	std::size_t grain_for(std::size_t count, double costPerItem) const;
+public:
+	// Run reactions and volume updates across the executor.
+	bool parallelAtmospheres = false;
+	// Target work per chunk handed to the executor, in units of roughly one
+	// reactant check. Small enough chunks leave the executor room to balance.
+	double chunkCost = 4096;
+	// Run device updates in conflict-free color batches on the executor.
+	bool parallelDevices = false;
+	// Run devices in two-phase flux mode, see above.
+	bool fluxDevices = false;
+	// Devices per chunk handed to the executor.
+	std::size_t deviceGrain = 64;
+	// Let atmospheres at equilibrium sleep, see above.
+	bool sleepAtmospheres = false;
+	// kPa, change per step and gradient across passive devices below which an atmosphere counts as quiet
+	double sleepPressureEpsilon = 0.01;
+	// K, change per step and gradient across passive devices below which an atmosphere counts as quiet
+	double sleepTemperatureEpsilon = 0.01;
+	// steps an atmosphere has to stay quiet before it sleeps
+	unsigned sleepDelay = 10;
+	// Merge equalized open-link zones into single atmospheres, see above.
+	bool mergeZones = false;
+	// kPa, largest pressure difference inside a zone that still gets merged
+	double zonePressureEpsilon = 0.1;
+	// K, largest temperature difference inside a zone that still gets merged
+	double zoneTemperatureEpsilon = 0.1;
+	// Solve symmetric links implicitly, see above.
+	bool implicitTransport = false;
+	// residual, relative to the right hand side, the transport solves stop at
+	double transportTolerance = 1e-10;
+	// conjugate gradient iterations per transport solve
+	unsigned transportMaxIterations = 500;
+	// Throw std::logic_error from any step that allocated on the heap without
+	// rebuilding the schedule first. Only has an effect when built with
+	// ZATMOS_COUNT_ALLOCATIONS, see allocation_counter.hpp. Scratch buffers
+	// grow to size during the first steps after a change, so turn it on once
+	// the network has been running for a bit.
+	bool checkAllocations = false;
+
+	AtmosphericsNetwork();
+	// Detaches the devices and device store left registered from the
+	// network's snapshot, so the caller's own can keep being used.
+	~AtmosphericsNetwork();
+	// Devices point into the network, so it stays where it was made.
+	AtmosphericsNetwork(AtmosphericsNetwork const &) = delete;
+	AtmosphericsNetwork &operator=(AtmosphericsNetwork const &) = delete;
+	AtmosphericsNetwork(AtmosphericsNetwork &&) = delete;
+	AtmosphericsNetwork &operator=(AtmosphericsNetwork &&) = delete;
+
+	// Registers an atmosphere owned by the caller, which must outlive the network
+	// or be removed first. Does nothing if already registered.
+	void add_atmosphere(Atmosphere &atmosphere);
+	// Registers a device owned by the caller, which must outlive the network or
+	// be removed first, along with any atmospheres it references that aren't
+	// registered yet. Destroying it while registered aborts.
+	void add_device(GenericDevice &device);
+	// Throws if a registered device still references atmosphere.
+	// Atmospheres created by the network are destroyed.
+	void remove_atmosphere(Atmosphere &atmosphere);
+	// Devices created by the network are destroyed.
+	void remove_device(GenericDevice &device);
+
+	// Creates an atmosphere owned by the network.
+	template <typename T = Atmosphere, typename... Args>
+	inline T &create_atmosphere(Args &&...args)
+	{
+		auto atmosphere = std::make_unique<T>(std::forward<Args>(args)...);
+		T &ref = *atmosphere;
+		ownedAtmospheres.push_back(std::move(atmosphere));
+		add_atmosphere(ref);
+		return ref;
+	}
+	// Creates a device owned by the network.
+	template <typename T, typename... Args>
+	inline T &create_device(Args &&...args)
+	{
+		auto device = std::make_unique<T>(std::forward<Args>(args)...);
+		T &ref = *device;
+		ownedDevices.push_back(std::move(device));
+		add_device(ref);
+		return ref;
+	}
+
+	// Forces the schedule to be rebuilt on the next step.
+	inline void invalidate() { dirty = true; }
+	// Executor used for parallel phases, nullptr runs everything on the calling
+	// thread. Not owned, must outlive the network or be replaced first.
+	inline void set_executor(Executor *executor) { this->executor = executor ? executor : &serialExecutor; }
+	inline Executor &get_executor() { return *executor; }
+	// Packed devices updated along with the registered ones, see above, nullptr
+	// for none. Not owned, must outlive the network or be replaced first.
+	void set_device_store(DeviceStore *store);
+	inline DeviceStore *get_device_store() { return deviceStore; }
+	// Number of color batches the parallel device phase runs in.
+	std::size_t device_color_count();
+
+	inline std::size_t atmosphere_count() const { return atmospheres.size(); }
+	inline std::size_t device_count() const { return devices.size(); }
+	inline Atmosphere &atmosphere(std::size_t index) { return *atmospheres[index]; }
+	inline GenericDevice &device(std::size_t index) { return *devices[index]; }
+	// Throws if atmosphere is not registered.
+	std::size_t index_of(Atmosphere const &atmosphere) const;
+	// Throws if device is not registered.
+	std::size_t index_of(GenericDevice const &device) const;
+	// Number of atmospheres currently asleep.
+	std::size_t sleeping_count() const;
+	// Heap allocations made during the last step, 0 unless built with ZATMOS_COUNT_ALLOCATIONS.
+	inline std::uint64_t last_step_allocations() const { return stepAllocations; }
+	// Phase timings and counts of the last step, all 0 unless built with ZATMOS_PROFILE.
+	inline NetworkStats const &last_step_stats() const { return stepStats; }
+	// last_step_stats() summed since construction or reset_stats().
+	inline NetworkStats const &total_stats() const { return totalStats; }
+	inline void reset_stats() { totalStats = NetworkStats(); }
+	// Conjugate gradient iterations the transport solves took last step.
+	inline unsigned transport_iterations() const { return transportIterations; }
+	// Number of zones currently merged.
+	inline std::size_t merged_zone_count() const { return zoneRepresentatives.size(); }
+	// The atmosphere holding atmosphere's gas, itself unless it's merged into a zone.
+	Atmosphere &zone_of(Atmosphere &atmosphere);
+	// Splits every merged zone back into its atmospheres.
+	void split_zones();
+	// Indices of atmospheres touched by device at index, valid until the next topology change.
+	std::pair<std::size_t const *, std::size_t const *> device_atmospheres(std::size_t index);
+	// Indices of devices touching atmosphere at index, valid until the next topology change.
+	std::pair<std::size_t const *, std::size_t const *> atmosphere_devices(std::size_t index);
+
+	void step(double dt);
+};
+}
+
+#endif
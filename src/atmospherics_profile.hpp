@@ -0,0 +1,63 @@
+#ifndef ATMOSPHERICS_PROFILE_HPP
+#define ATMOSPHERICS_PROFILE_HPP
+
+#include <cstdint>
+
+namespace ZAtmos {
+// Built with ZATMOS_PROFILE, AtmosphericsNetwork::step() times its phases and
+// counts what it did into a NetworkStats. Without it the instrumentation is
+// compiled out and the stats stay zero.
+constexpr bool profiling_enabled()
+{
+#ifdef ZATMOS_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+// What AtmosphericsNetwork::step() spent its time on. Phases:
+//   reaction  Atmosphere::react on every awake atmosphere
+//   device    the snapshot, device updates (flux mode included) and the
+//             DeviceStore
+//   mixing    zone merging and splitting, and implicit transport
+//   elastic   Atmosphere::update_volume
+// stepNanoseconds covers the whole step, rebuilds and sleep checks included.
+struct NetworkStats {
+	std::uint64_t steps = 0;
+	std::uint64_t stepNanoseconds = 0;
+	std::uint64_t reactionNanoseconds = 0;
+	std::uint64_t deviceNanoseconds = 0;
+	std::uint64_t mixingNanoseconds = 0;
+	std::uint64_t elasticNanoseconds = 0;
+	// reactions with a positive rate, summed over atmospheres
+	std::uint64_t reactionsFired = 0;
+	// mol moved from one atmosphere into another by devices, the DeviceStore
+	// and implicit transport, as noted by Atmosphere::count_moved. Every move
+	// counts, so gas passing along a chain counts once per link it crosses.
+	double molesTransferred = 0;
+	// registered devices that were on but held back by
+	// GenericDevice::should_run(), implicit transport links included.
+	// DeviceStore records aren't counted
+	std::uint64_t devicesSkipped = 0;
+	// atmospheres neither asleep nor merged into a zone, summed over steps
+	std::uint64_t activeAtmospheres = 0;
+
+	inline NetworkStats &operator+=(NetworkStats const &other)
+	{
+		steps += other.steps;
+		stepNanoseconds += other.stepNanoseconds;
+		reactionNanoseconds += other.reactionNanoseconds;
+		deviceNanoseconds += other.deviceNanoseconds;
+		mixingNanoseconds += other.mixingNanoseconds;
+		elasticNanoseconds += other.elasticNanoseconds;
+		reactionsFired += other.reactionsFired;
+		molesTransferred += other.molesTransferred;
+		devicesSkipped += other.devicesSkipped;
+		activeAtmospheres += other.activeAtmospheres;
+		return *this;
+	}
+};
+}
+
+#endif
@@ -1,17 +1,26 @@
 #include "atmospherics_reactions.hpp"
 #include "atmosphere.hpp"
+#include <cstddef>
 
 namespace ZAtmos {
 AtmosphericsReaction::AtmosphericsReaction(double autoignitionPoint, double energyReleased, bool ignitable)
 	: autoignitionPoint(autoignitionPoint), energyReleased(energyReleased), ignitable(ignitable)
 {}
+void AtmosphericsReaction::add_reactant(ElementId element, double portion)
+{
+	reactants.push_back(AtmosphericsQuantity(element, portion));
+}
+void AtmosphericsReaction::add_product(ElementId element, double portion)
+{
+	products.push_back(AtmosphericsQuantity(element, portion));
+}
 void AtmosphericsReaction::add_reactant(std::string const &chemicalId, double portion)
 {
-	reactants.push_back(AtmosphericsQuantity(chemicalId, portion));
+	add_reactant(element_id(chemicalId), portion);
 }
 void AtmosphericsReaction::add_product(std::string const &chemicalId, double portion)
 {
-	products.push_back(AtmosphericsQuantity(chemicalId, portion));
+	add_product(element_id(chemicalId), portion);
 }
 void AtmosphericsReaction::do_once(Atmosphere &atmosphere, double dt) const
 {
@@ -19,19 +28,58 @@ void AtmosphericsReaction::do_once(Atmosphere &atmosphere, double dt) const
 	double speedScale = reactionSpeed;
 	speedScale *= atmosphere.tempKelvin / autoignitionPoint; // faster the hotter the reaction is, maybe change later
 	for (auto const &reactant : reactants) {
-		double amountPossibleSingle = atmosphere.get_moles(reactant.chemicalId) / (reactant.moles * speedScale);
+		double amountPossibleSingle = atmosphere.get_moles(reactant.elementId) / (reactant.moles * speedScale);
 		amountPossible = std::min(amountPossible, amountPossibleSingle);
 	}
 	speedScale *= amountPossible;
 	for (auto const &reactant : reactants) {
 		double molesRemoved = reactant.moles * speedScale * dt;
-		atmosphere.remove_without_heat(reactant.chemicalId, molesRemoved);
+		atmosphere.remove_without_heat(reactant.elementId, molesRemoved);
 	}
 	for (auto const &product : products) {
 		double molesAdded = product.moles * speedScale * dt;
-		atmosphere.add_moles_heat(product.chemicalId, molesAdded, 0);
+		atmosphere.add_moles_heat(product.elementId, molesAdded, 0);
 	}
 	atmosphere.add_heat(energyReleased * speedScale * dt);
 }
 std::vector<AtmosphericsReaction> atmosphericsReactions;
+
+AtmosphericsReactionIndex::AtmosphericsReactionIndex(std::vector<AtmosphericsReaction> const &reactions)
+	: reactions(reactions)
+{}
+void AtmosphericsReactionIndex::update()
+{
+	if (!stale && builtSize == reactions.size())
+		return;
+	compiledReactions.compile(reactions);
+	ignitable.clear();
+	for (std::size_t i = 0; i < reactions.size(); ++i) {
+		AtmosphericsReaction const &reaction = reactions[i];
+		if (!reaction.ignitable)
+			continue;
+		Entry entry { 0, i };
+		for (auto const &reactant : reaction.reactants)
+			entry.reactants |= element_bit(reactant.elementId);
+		ignitable.push_back(entry);
+	}
+	builtSize = reactions.size();
+	stale = false;
+}
+std::size_t AtmosphericsReactionIndex::react(Atmosphere &atmosphere, double dt)
+{
+	update();
+	if (atmosphere.reactionIntegration.implicit)
+		return compiledReactions.react_implicit(atmosphere, dt, atmosphere.reactionIntegration);
+	return compiledReactions.react(atmosphere, dt);
+}
+void AtmosphericsReactionIndex::ignite(Atmosphere &atmosphere, double dt)
+{
+	update();
+	for (auto const &entry : ignitable) {
+		if ((entry.reactants & ~atmosphere.contents.mask()) != 0)
+			continue;
+		reactions[entry.reaction].do_once(atmosphere, dt);
+	}
+}
+AtmosphericsReactionIndex atmosphericsReactionIndex(atmosphericsReactions);
 }
@@ -1,14 +1,16 @@
 #ifndef ATMOSPHERICS_REACTIONS_HPP
 #define ATMOSPHERICS_REACTIONS_HPP
 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include "atmosphere.hpp"
+#include "atmospherics_compiled_reactions.hpp"
 
 namespace ZAtmos {
 struct AtmosphericsReaction {
-	AtmosphericsMixture reactants;
-	AtmosphericsMixture products;
+	std::vector<AtmosphericsQuantity> reactants;
+	std::vector<AtmosphericsQuantity> products;
 	double autoignitionPoint;
 	// J/mol
 	double energyReleased;
@@ -17,11 +19,46 @@ struct AtmosphericsReaction {
 	bool ignitable = true;
 	// K, J/mol
 	AtmosphericsReaction(double autoignitionPoint, double energyReleased, bool ignitable = true);
+	void add_reactant(ElementId element, double portion);
+	void add_product(ElementId element, double portion);
+	// Throws if chemicalId is not registered.
 	void add_reactant(std::string const &chemicalId, double portion);
+	// Throws if chemicalId is not registered.
 	void add_product(std::string const &chemicalId, double portion);
 	void do_once(Atmosphere &atmosphere, double dt) const;
 };
 extern std::vector<AtmosphericsReaction> atmosphericsReactions;
+
+// Keeps a CompiledReactionSet of reactions up to date, plus each ignitable
+// reaction with a mask of its reactants, so ignite() can skip the ones an
+// atmosphere doesn't have the reactants for.
+struct AtmosphericsReactionIndex {
+private:
+	struct Entry {
+		ElementMask reactants;
+		std::size_t reaction; // index into reactions
+	};
+	std::vector<AtmosphericsReaction> const &reactions;
+	CompiledReactionSet compiledReactions;
+	// ignitable reactions in registration order
+	std::vector<Entry> ignitable;
+	std::size_t builtSize = 0;
+	bool stale = true;
+public:
+	AtmosphericsReactionIndex(std::vector<AtmosphericsReaction> const &reactions);
+	// Call after editing reactions in place, adding or removing them is noticed on its own.
+	inline void invalidate() { stale = true; }
+	// Rebuilds the index if needed. Not thread safe, so call it before
+	// reacting atmospheres from several threads.
+	void update();
+	// as of the last update()
+	inline CompiledReactionSet const &compiled() const { return compiledReactions; }
+	// runs every reaction that autoignites in atmosphere, returns how many ran
+	std::size_t react(Atmosphere &atmosphere, double dt);
+	// runs every ignitable reaction atmosphere has the reactants for
+	void ignite(Atmosphere &atmosphere, double dt);
+};
+extern AtmosphericsReactionIndex atmosphericsReactionIndex;
 }
 
 #endif
@@ -0,0 +1,357 @@
+#include "atmospherics_scenario.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_mixture.hpp"
+#include "atmospherics_reactions.hpp"
+#include "executor.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ZAtmos {
+using namespace AtmosphericsDevices;
+
+Scenario::Scenario()
+{}
+
+static double parse_number(std::string const &text, char const *what)
+{
+	try {
+		std::size_t used;
+		double value = std::stod(text, &used);
+		if (used == text.size())
+			return value;
+	} catch (std::exception const &) {
+	}
+	throw std::invalid_argument(std::string("expected ") + what + ", got '" + text + "'");
+}
+
+namespace {
+// The words of one statement, read left to right.
+struct ScenarioLine {
+	std::vector<std::string> words;
+	std::size_t next = 0;
+
+	bool done() const { return next >= words.size(); }
+	std::string const &word(char const *what)
+	{
+		if (done())
+			throw std::invalid_argument(std::string("expected ") + what);
+		return words[next++];
+	}
+	double number(char const *what)
+	{
+		return parse_number(word(what), what);
+	}
+	std::size_t count(char const *what)
+	{
+		double value = number(what);
+		if (value < 0 || value != static_cast<double>(static_cast<std::size_t>(value)))
+			throw std::invalid_argument(std::string("expected ") + what + " to be a whole number");
+		return static_cast<std::size_t>(value);
+	}
+	// true if the next word is expected, and skips it
+	bool accept(char const *expected)
+	{
+		if (done() || words[next] != expected)
+			return false;
+		++next;
+		return true;
+	}
+	void end()
+	{
+		if (!done())
+			throw std::invalid_argument("unexpected '" + words[next] + "'");
+	}
+};
+}
+
+static std::vector<std::string> split_list(std::string const &text, char separator)
+{
+	std::vector<std::string> parts;
+	std::size_t start = 0;
+	for (;;) {
+		std::size_t end = text.find(separator, start);
+		parts.push_back(text.substr(start, end - start));
+		if (end == std::string::npos)
+			return parts;
+		start = end + 1;
+	}
+}
+
+// "2 hydrogen + 1 oxygen" up to the next separator (or the end), added through add
+template <typename F>
+static void parse_quantities(ScenarioLine &line, char const *separator, F add)
+{
+	do {
+		double portion = line.number("a portion");
+		add(element_id(line.word("an element")), portion);
+	} while (line.accept("+"));
+	if (separator && !line.accept(separator))
+		throw std::invalid_argument(std::string("expected '") + separator + "'");
+}
+
+static void parse_reaction(ScenarioLine &line)
+{
+	double autoignition = line.number("an autoignition point");
+	double energy = line.number("the energy released");
+	AtmosphericsReaction reaction(autoignition, energy);
+	while (!line.accept(":")) {
+		if (line.accept("speed"))
+			reaction.reactionSpeed = line.number("a reaction speed");
+		else if (line.accept("noignite"))
+			reaction.ignitable = false;
+		else
+			throw std::invalid_argument("expected speed, noignite or ':', got '" + line.word("") + "'");
+	}
+	parse_quantities(line, "->", [&](ElementId element, double portion) { reaction.add_reactant(element, portion); });
+	parse_quantities(line, nullptr, [&](ElementId element, double portion) { reaction.add_product(element, portion); });
+	line.end();
+	atmosphericsReactions.push_back(reaction);
+}
+
+void Scenario::load(std::istream &in, std::string const &source)
+{
+	std::string text;
+	std::size_t lineNumber = 0;
+	while (std::getline(in, text)) {
+		++lineNumber;
+		text = text.substr(0, text.find('#'));
+		ScenarioLine line;
+		std::istringstream words(text);
+		for (std::string word; words >> word;)
+			line.words.push_back(word);
+		if (line.done())
+			continue;
+		try {
+			auto atmosphere = [&]() -> Atmosphere & {
+				std::string const &name = line.word("an atmosphere");
+				auto found = atmospheres.find(name);
+				if (found == atmospheres.end())
+					throw std::invalid_argument("no atmosphere '" + name + "'");
+				return *found->second;
+			};
+			auto device = [&]() -> GenericDevice & {
+				std::string const &name = line.word("a device");
+				auto found = devices.find(name);
+				if (found == devices.end())
+					throw std::invalid_argument("no device '" + name + "'");
+				return *found->second;
+			};
+			auto gases = [&]() { return element_ids(split_list(line.word("a list of gases"), ',')); };
+			std::string const &statement = line.word("a statement");
+			if (statement == "builtins") {
+				if (!atmosphericsElements.has_key("hydrogen"))
+					register_atmospherics_builtins();
+			} else if (statement == "element") {
+				std::string id = line.word("an element id");
+				std::string name = line.word("a name");
+				std::string shortName = line.word("a short name");
+				double heatCapacity = line.number("a heat capacity");
+				double molarMass = line.number("a molar mass");
+				double conductivity = line.number("a thermal conductivity");
+				atmosphericsElements.add(id, AtmosphericsElement(name, shortName, heatCapacity, molarMass, conductivity));
+			} else if (statement == "reaction") {
+				parse_reaction(line);
+			} else if (statement == "atmosphere") {
+				std::string name = line.word("an atmosphere name");
+				if (atmospheres.count(name))
+					throw std::invalid_argument("atmosphere '" + name + "' already exists");
+				atmospheres[name] = &network.create_atmosphere(line.number("a volume"));
+				atmosphereNames.push_back(name);
+			} else if (statement == "gas") {
+				Atmosphere &into = atmosphere();
+				ElementId element = element_id(line.word("an element"));
+				double moles = line.number("moles");
+				into.add_moles_temp(element, moles, line.number("a temperature"));
+			} else if (statement == "device") {
+				std::string name = line.word("a device name");
+				if (devices.count(name))
+					throw std::invalid_argument("device '" + name + "' already exists");
+				std::string kind = line.word("a device kind");
+				GenericDevice *created;
+				if (kind == "valve") {
+					Atmosphere &source = atmosphere();
+					created = &network.create_device<Valve>(source, atmosphere());
+				} else if (kind == "one-way-valve") {
+					Atmosphere &source = atmosphere();
+					created = &network.create_device<OneWayValve>(source, atmosphere());
+				} else if (kind == "volume-pump" || kind == "molar-pump" || kind == "temperature-conductor") {
+					Atmosphere &source = atmosphere();
+					Atmosphere &destination = atmosphere();
+					double rate = line.number("a rate");
+					if (kind == "volume-pump")
+						created = &network.create_device<VolumePump>(source, destination, rate);
+					else if (kind == "molar-pump")
+						created = &network.create_device<MolarPump>(source, destination, rate);
+					else
+						created = &network.create_device<TemperatureConductor>(source, destination, rate);
+				} else if (kind == "filtered-volume-pump" || kind == "filtered-molar-pump") {
+					Atmosphere &source = atmosphere();
+					Atmosphere &destination = atmosphere();
+					std::vector<ElementId> filter = gases();
+					double rate = line.number("a rate");
+					if (kind == "filtered-volume-pump")
+						created = &network.create_device<FilteredVolumePump>(source, destination, filter, rate);
+					else
+						created = &network.create_device<FilteredMolarPump>(source, destination, filter, rate);
+				} else if (kind == "void") {
+					Atmosphere &source = atmosphere();
+					created = &network.create_device<Void>(source, line.number("a rate"));
+				} else if (kind == "filtered-void") {
+					Atmosphere &source = atmosphere();
+					std::vector<ElementId> filter = gases();
+					created = &network.create_device<FilteredVoid>(source, filter, line.number("a rate"));
+				} else if (kind == "temperature-controller") {
+					Atmosphere &destination = atmosphere();
+					created = &network.create_device<TemperatureController>(destination, line.number("an energy rate"));
+				} else if (kind == "volume-mixer" || kind == "molar-mixer") {
+					Atmosphere &sourceA = atmosphere();
+					Atmosphere &sourceB = atmosphere();
+					Atmosphere &destination = atmosphere();
+					double ratio = line.number("a ratio");
+					double rate = line.number("a rate");
+					if (kind == "volume-mixer")
+						created = &network.create_device<VolumeMixer>(sourceA, sourceB, destination, ratio, rate);
+					else
+						created = &network.create_device<MolarMixer>(sourceA, sourceB, destination, ratio, rate);
+				} else if (kind == "spawner") {
+					Atmosphere &destination = atmosphere();
+					double temperature = line.number("a temperature");
+					AtmosphericsMixture mixture;
+					for (std::string const &entry : split_list(line.word("a list of gas:moles"), ',')) {
+						std::vector<std::string> parts = split_list(entry, ':');
+						if (parts.size() != 2)
+							throw std::invalid_argument("expected gas:moles, got '" + entry + "'");
+						mixture.add(element_id(parts[0]), parse_number(parts[1], "moles"));
+					}
+					created = &network.create_device<Spawner>(destination, mixture, temperature);
+				} else {
+					throw std::invalid_argument("unknown device kind '" + kind + "'");
+				}
+				devices[name] = created;
+				if (line.accept("on"))
+					created->set(true);
+			} else if (statement == "limit") {
+				auto *limited = dynamic_cast<Device *>(&device());
+				std::string const &field = line.word("a limit");
+				double value = line.number("a value");
+				if (!limited)
+					throw std::invalid_argument("device has no limits");
+				if (field == "min-pressure")
+					limited->minPressure = value;
+				else if (field == "max-pressure")
+					limited->maxPressure = value;
+				else if (field == "min-temperature")
+					limited->minTemperature = value;
+				else if (field == "max-temperature")
+					limited->maxTemperature = value;
+				else
+					throw std::invalid_argument("unknown limit '" + field + "'");
+			} else if (statement == "option") {
+				std::string const &option = line.word("an option");
+				bool value = !line.accept("off");
+				if (value)
+					line.accept("on");
+				if (option == "parallel-atmospheres")
+					network.parallelAtmospheres = value;
+				else if (option == "parallel-devices")
+					network.parallelDevices = value;
+				else if (option == "flux-devices")
+					network.fluxDevices = value;
+				else if (option == "sleep")
+					network.sleepAtmospheres = value;
+				else if (option == "merge-zones")
+					network.mergeZones = value;
+				else if (option == "implicit-transport")
+					network.implicitTransport = value;
+				else
+					throw std::invalid_argument("unknown option '" + option + "'");
+			} else if (statement == "at") {
+				std::size_t step = line.count("a step");
+				std::string const &action = line.word("on, off or toggle");
+				Event event { step, nullptr, Action::Toggle };
+				if (action == "on")
+					event.action = Action::On;
+				else if (action == "off")
+					event.action = Action::Off;
+				else if (action != "toggle")
+					throw std::invalid_argument("expected on, off or toggle, got '" + action + "'");
+				event.device = &device();
+				schedule.push_back(event);
+			} else if (statement == "steps") {
+				steps = line.count("a number of steps");
+			} else if (statement == "dt") {
+				dt = line.number("a time step");
+			} else if (statement == "threads") {
+				threads = line.count("a number of threads");
+			} else {
+				throw std::invalid_argument("unknown statement '" + statement + "'");
+			}
+			line.end();
+		} catch (std::invalid_argument const &error) {
+			throw std::invalid_argument(source + ":" + std::to_string(lineNumber) + ": " + error.what());
+		}
+	}
+	std::stable_sort(schedule.begin(), schedule.end(), [](Event const &a, Event const &b) { return a.step < b.step; });
+	nextEvent = 0;
+	while (nextEvent < schedule.size() && schedule[nextEvent].step < currentStep)
+		++nextEvent;
+}
+
+void Scenario::load_file(std::string const &path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::invalid_argument("Could not open scenario '" + path + "'");
+	load(file, path);
+}
+
+void Scenario::run(std::size_t count)
+{
+	if (threads > 1 && (!executor || executor->concurrency() != threads)) {
+		executor = std::make_unique<WorkStealingExecutor>(threads);
+		network.set_executor(executor.get());
+	}
+	for (std::size_t i = 0; i < count; ++i) {
+		for (; nextEvent < schedule.size() && schedule[nextEvent].step <= currentStep; ++nextEvent) {
+			Event const &event = schedule[nextEvent];
+			if (event.action == Action::Toggle)
+				event.device->toggle();
+			else
+				event.device->set(event.action == Action::On);
+		}
+		network.step(dt);
+		++currentStep;
+	}
+}
+
+std::uint64_t state_digest(Atmosphere const &atmosphere)
+{
+	// FNV-1a over the bits of every value
+	std::uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](double value) {
+		std::uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 8; ++i) {
+			hash ^= (bits >> (i * 8)) & 0xff;
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(atmosphere.volume);
+	mix(atmosphere.heatEnergy);
+	for (auto const &entry : atmosphere.contents) {
+		mix(static_cast<double>(entry.elementId));
+		mix(entry.moles);
+	}
+	return hash;
+}
+}
@@ -0,0 +1,88 @@
+#ifndef ATMOSPHERICS_SCENARIO_HPP
+#define ATMOSPHERICS_SCENARIO_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_device.hpp"
+#include "atmospherics_network.hpp"
+#include "executor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ZAtmos {
+// A network set up from a text scenario, for running the library without
+// writing C++. One statement per line, # starts a comment, names are single
+// words:
+//
+//   builtins                                  register_atmospherics_builtins()
+//   element ID NAME SHORT J/kgK kg/mol W/mK   register an element
+//   reaction K J/mol [speed MOL/S] [noignite] : 2 hydrogen + 1 oxygen -> 2 water
+//   atmosphere NAME L                         add an atmosphere
+//   gas ATMOSPHERE ELEMENT MOL K              add moles at a temperature
+//   device NAME KIND ATMOSPHERES... PARAMETERS... [on]
+//   limit DEVICE min-pressure|max-pressure|min-temperature|max-temperature VALUE
+//   option parallel-atmospheres|parallel-devices|flux-devices|sleep|merge-zones|implicit-transport [on|off]
+//   at STEP on|off|toggle DEVICE              switch a device before step STEP
+//   steps N, dt S, threads N                  how run() steps it
+//
+// Device kinds and what follows them:
+//   valve, one-way-valve, volume-pump, molar-pump, temperature-conductor,
+//   filtered-volume-pump, filtered-molar-pump: SOURCE DESTINATION, then the
+//   gases (comma separated) for filtered ones, then the rate, except valves
+//   void RATE, filtered-void GASES RATE: SOURCE first
+//   temperature-controller DESTINATION J/S
+//   volume-mixer, molar-mixer: A B DESTINATION RATIO RATE
+//   spawner DESTINATION K GAS:MOL,GAS:MOL...
+// Rates are in the units of the device classes.
+//
+// Reactions are appended to atmosphericsReactions and elements registered
+// globally, like the C++ API would.
+struct Scenario {
+	enum class Action { On, Off, Toggle };
+	struct Event {
+		std::size_t step;
+		GenericDevice *device;
+		Action action;
+	};
+private:
+	std::unique_ptr<Executor> executor;
+	// next entry of schedule to apply
+	std::size_t nextEvent = 0;
+	std::size_t currentStep = 0;
+public:
+	AtmosphericsNetwork network;
+	std::unordered_map<std::string, Atmosphere *> atmospheres;
+	std::unordered_map<std::string, GenericDevice *> devices;
+	// in the order they were declared
+	std::vector<std::string> atmosphereNames;
+	// sorted by step
+	std::vector<Event> schedule;
+	std::size_t steps = 100;
+	double dt = 0.05;
+	std::size_t threads = 1;
+
+	Scenario();
+	Scenario(Scenario const &) = delete;
+	Scenario &operator=(Scenario const &) = delete;
+
+	// Reads every statement from in. Throws std::invalid_argument naming
+	// source and the line of the first statement that's wrong.
+	void load(std::istream &in, std::string const &source);
+	// Opens path and load()s it.
+	void load_file(std::string const &path);
+	// Runs count steps of dt, applying scheduled events on the way.
+	void run(std::size_t count);
+	// Steps run so far.
+	inline std::size_t step() const { return currentStep; }
+};
+
+// Hash of the exact volume, heat energy and moles of atmosphere, to compare
+// end states between runs.
+std::uint64_t state_digest(Atmosphere const &atmosphere);
+}
+
+#endif
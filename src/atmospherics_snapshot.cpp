@@ -0,0 +1,540 @@
+#include "atmospherics_snapshot.hpp"
+#include "atmosphere.hpp"
+#include "atmosphere_world.hpp"
+#include "atmospherics_device_store.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_reactions.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ZAtmos {
+static constexpr char SNAPSHOT_MAGIC[8] = { 'Z', 'A', 'T', 'M', 'S', 'N', 'A', 'P' };
+static constexpr std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+static constexpr std::size_t SNAPSHOT_ALIGNMENT = 8;
+
+// Device records go to disk as they are in memory, so any change to them has
+// to come with a new SNAPSHOT_VERSION.
+static_assert(std::is_trivially_copyable_v<DeviceStore::LinkRecord> && sizeof(DeviceStore::LinkRecord) == 16);
+static_assert(std::is_trivially_copyable_v<DeviceStore::RateRecord> && sizeof(DeviceStore::RateRecord) == 24);
+static_assert(std::is_trivially_copyable_v<DeviceStore::FilteredRecord> && sizeof(DeviceStore::FilteredRecord) == 32);
+static_assert(std::is_trivially_copyable_v<DeviceStore::MixerRecord> && sizeof(DeviceStore::MixerRecord) == 40);
+static_assert(std::is_trivially_copyable_v<DeviceStore::SpawnerRecord> && sizeof(DeviceStore::SpawnerRecord) == 24);
+static_assert(std::is_trivially_copyable_v<DeviceThresholds> && sizeof(DeviceThresholds) == 12 * sizeof(double));
+
+static SnapshotSection device_section(DeviceKind kind)
+{
+	return static_cast<SnapshotSection>(static_cast<std::uint32_t>(SnapshotSection::Devices) + static_cast<std::uint32_t>(kind));
+}
+
+namespace {
+// Sections are gathered as lists of existing arrays and written out in one go.
+struct SnapshotChunk {
+	// nullptr writes bytes zeros
+	void const *data;
+	std::size_t bytes;
+};
+struct SnapshotPendingSection {
+	SnapshotSection kind;
+	std::uint32_t recordSize;
+	std::uint64_t count;
+	std::vector<SnapshotChunk> chunks;
+};
+struct SnapshotBuilder {
+	std::vector<SnapshotPendingSection> sections;
+	std::uint64_t atmosphereCount = 0;
+	// storage of sections that aren't existing arrays
+	std::vector<char> strings;
+	std::vector<SnapshotElement> elements;
+	std::vector<SnapshotReaction> reactions;
+	std::vector<SnapshotQuantity> quantities;
+	std::vector<double> volumes;
+	std::vector<double> heatEnergies;
+	std::vector<double> moles;
+	std::vector<double> mixtures;
+
+	template <typename T>
+	void add(SnapshotSection kind, T const *data, std::size_t count)
+	{
+		sections.push_back(SnapshotPendingSection { kind, sizeof(T), count, { SnapshotChunk { data, count * sizeof(T) } } });
+	}
+	SnapshotString add_string(std::string const &value)
+	{
+		SnapshotString string { static_cast<std::uint32_t>(strings.size()), static_cast<std::uint32_t>(value.size()) };
+		strings.insert(strings.end(), value.begin(), value.end());
+		return string;
+	}
+	void add_registries()
+	{
+		for (std::size_t id = 0; id < atmosphericsElements.size(); ++id) {
+			AtmosphericsElement const *element = atmosphericsElements[id];
+			SnapshotElement record {};
+			record.key = add_string(atmosphericsElements.key_of(id));
+			record.name = add_string(element->get_name());
+			record.shortName = add_string(element->get_short_name());
+			record.heatCapacity = element->get_heat_capacity_mass();
+			record.molarMass = element->get_molar_mass();
+			record.thermalConductivity = element->get_thermal_conductivity();
+			elements.push_back(record);
+		}
+		for (AtmosphericsReaction const &reaction : atmosphericsReactions) {
+			SnapshotReaction record {};
+			record.autoignitionPoint = reaction.autoignitionPoint;
+			record.energyReleased = reaction.energyReleased;
+			record.reactionSpeed = reaction.reactionSpeed;
+			record.firstQuantity = static_cast<std::uint32_t>(quantities.size());
+			record.reactantCount = static_cast<std::uint32_t>(reaction.reactants.size());
+			record.productCount = static_cast<std::uint32_t>(reaction.products.size());
+			record.ignitable = reaction.ignitable;
+			for (AtmosphericsQuantity const &quantity : reaction.reactants)
+				quantities.push_back(SnapshotQuantity { quantity.elementId, quantity.moles });
+			for (AtmosphericsQuantity const &quantity : reaction.products)
+				quantities.push_back(SnapshotQuantity { quantity.elementId, quantity.moles });
+			reactions.push_back(record);
+		}
+		add(SnapshotSection::Strings, strings.data(), strings.size());
+		add(SnapshotSection::Elements, elements.data(), elements.size());
+		add(SnapshotSection::Reactions, reactions.data(), reactions.size());
+		add(SnapshotSection::ReactionQuantities, quantities.data(), quantities.size());
+	}
+	void add_atmospheres(std::vector<Atmosphere *> const &atmospheres)
+	{
+		std::size_t count = atmospheres.size();
+		std::size_t width = atmosphericsElements.size();
+		atmosphereCount = count;
+		volumes.resize(count);
+		heatEnergies.resize(count);
+		moles.assign(width * count, 0.0);
+		for (std::size_t i = 0; i < count; ++i) {
+			Atmosphere const &atmosphere = *atmospheres[i];
+			volumes[i] = atmosphere.volume;
+			heatEnergies[i] = atmosphere.heatEnergy;
+			for (auto const &entry : atmosphere.contents)
+				moles[entry.elementId * count + i] = entry.moles;
+		}
+		add(SnapshotSection::Volumes, volumes.data(), count);
+		add(SnapshotSection::HeatEnergies, heatEnergies.data(), count);
+		add(SnapshotSection::Moles, moles.data(), moles.size());
+	}
+	void write(std::string const &path) const
+	{
+		SnapshotHeader header {};
+		std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = SNAPSHOT_VERSION;
+		header.byteOrder = SNAPSHOT_BYTE_ORDER;
+		header.sectionCount = static_cast<std::uint32_t>(sections.size());
+		header.elementCount = static_cast<std::uint32_t>(atmosphericsElements.size());
+		header.atmosphereCount = atmosphereCount;
+
+		auto align = [](std::uint64_t offset) { return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT; };
+		std::vector<SnapshotSectionEntry> table;
+		std::uint64_t offset = align(sizeof(SnapshotHeader) + sections.size() * sizeof(SnapshotSectionEntry));
+		for (SnapshotPendingSection const &section : sections) {
+			table.push_back(SnapshotSectionEntry { static_cast<std::uint32_t>(section.kind), section.recordSize, section.count, offset });
+			offset = align(offset + section.count * section.recordSize);
+		}
+
+		std::FILE *file = std::fopen(path.c_str(), "wb");
+		if (!file)
+			throw std::runtime_error("Could not open snapshot '" + path + "' for writing");
+		static char const zeros[4096] = {};
+		std::uint64_t written = 0;
+		bool ok = true;
+		auto put = [&](void const *data, std::size_t bytes) {
+			while (ok && bytes > 0) {
+				std::size_t part = data ? bytes : std::min(bytes, sizeof(zeros));
+				ok = std::fwrite(data ? data : zeros, 1, part, file) == part;
+				written += part;
+				bytes -= part;
+				if (data)
+					data = static_cast<char const *>(data) + part;
+			}
+		};
+		put(&header, sizeof(header));
+		put(table.data(), table.size() * sizeof(SnapshotSectionEntry));
+		for (std::size_t i = 0; i < sections.size(); ++i) {
+			put(nullptr, table[i].offset - written);
+			for (SnapshotChunk const &chunk : sections[i].chunks)
+				put(chunk.data, chunk.bytes);
+		}
+		put(nullptr, align(written) - written);
+		if (std::fclose(file) != 0 || !ok)
+			throw std::runtime_error("Could not write snapshot '" + path + "'");
+	}
+};
+}
+
+void save_snapshot(std::string const &path, AtmosphereWorld const &world)
+{
+	SnapshotBuilder builder;
+	builder.add_registries();
+	std::size_t count = world.size();
+	std::size_t width = atmosphericsElements.size();
+	// columns of the world's moles matrix as they are, species it hasn't
+	// allocated yet are all 0
+	std::size_t allocated = world.stride() > 0 ? world.moles.size() / world.stride() : 0;
+	SnapshotPendingSection moles { SnapshotSection::Moles, sizeof(double), width * count, {} };
+	for (std::size_t element = 0; element < width; ++element) {
+		void const *column = element < allocated ? world.species_moles(static_cast<ElementId>(element)) : nullptr;
+		moles.chunks.push_back(SnapshotChunk { column, count * sizeof(double) });
+	}
+	builder.atmosphereCount = count;
+	builder.add(SnapshotSection::Volumes, world.volume.data(), count);
+	builder.add(SnapshotSection::HeatEnergies, world.heatEnergy.data(), count);
+	builder.sections.push_back(std::move(moles));
+	builder.write(path);
+}
+
+void save_snapshot(std::string const &path, std::vector<Atmosphere *> const &atmospheres)
+{
+	SnapshotBuilder builder;
+	builder.add_registries();
+	builder.add_atmospheres(atmospheres);
+	builder.write(path);
+}
+
+void save_snapshot(std::string const &path, DeviceStore const &devices)
+{
+	SnapshotBuilder builder;
+	builder.add_registries();
+	builder.add_atmospheres(devices.atmosphere_table());
+	std::size_t width = atmosphericsElements.size();
+	builder.mixtures.assign(devices.mixtures.size() * width, 0.0);
+	for (std::size_t i = 0; i < devices.mixtures.size(); ++i)
+		for (auto const &entry : devices.mixtures[i])
+			builder.mixtures[i * width + entry.elementId] = entry.moles;
+	builder.add(SnapshotSection::Thresholds, devices.thresholds.data(), devices.thresholds.size());
+	builder.add(SnapshotSection::SpawnerMixtures, builder.mixtures.data(), builder.mixtures.size());
+	for_each_record_array(devices, [&](DeviceKind kind, auto const &records) {
+		builder.add(device_section(kind), records.data(), records.size());
+	});
+	builder.write(path);
+}
+
+SnapshotFile::SnapshotFile(std::string const &path)
+{
+#ifdef _WIN32
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		throw std::runtime_error("Could not open snapshot '" + path + "'");
+	buffer.resize(static_cast<std::size_t>(file.tellg()));
+	file.seekg(0);
+	if (!file.read(buffer.data(), buffer.size()))
+		throw std::runtime_error("Could not read snapshot '" + path + "'");
+	data = buffer.data();
+	length = buffer.size();
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Could not open snapshot '" + path + "'");
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Could not read snapshot '" + path + "'");
+	}
+	length = static_cast<std::size_t>(info.st_size);
+	if (length > 0) {
+		void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Could not map snapshot '" + path + "'");
+		}
+		data = mapping;
+	}
+	close(fd);
+#endif
+	try {
+		validate(path);
+	} catch (...) {
+		release();
+		throw;
+	}
+}
+
+void SnapshotFile::validate(std::string const &path)
+{
+	auto fail = [&](std::string const &why) {
+		throw std::runtime_error("Snapshot '" + path + "' " + why);
+	};
+	if (length < sizeof(SnapshotHeader))
+		fail("is too short");
+	header = static_cast<SnapshotHeader const *>(data);
+	if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+		fail("is not a snapshot");
+	if (header->byteOrder != SNAPSHOT_BYTE_ORDER)
+		fail("was written with a different byte order");
+	if (header->version != SNAPSHOT_VERSION)
+		fail("has version " + std::to_string(header->version) + ", expected " + std::to_string(SNAPSHOT_VERSION));
+	if (header->elementCount > MAX_ATMOSPHERICS_ELEMENTS)
+		fail("has too many elements");
+	if (header->sectionCount > (length - sizeof(SnapshotHeader)) / sizeof(SnapshotSectionEntry))
+		fail("has a truncated section table");
+	auto const *table = reinterpret_cast<SnapshotSectionEntry const *>(header + 1);
+	for (std::uint32_t i = 0; i < header->sectionCount; ++i) {
+		SnapshotSectionEntry const &entry = table[i];
+		if (entry.kind >= sections.size() || sections[entry.kind])
+			fail("has an unknown or repeated section " + std::to_string(entry.kind));
+		if (entry.offset % SNAPSHOT_ALIGNMENT != 0 || entry.offset > length || entry.recordSize == 0
+		    || entry.count > (length - entry.offset) / entry.recordSize)
+			fail("has a section " + std::to_string(entry.kind) + " outside the file");
+		sections[entry.kind] = &entry;
+	}
+	// record sizes get checked on the way
+	std::size_t count;
+	records<char>(SnapshotSection::Strings, count);
+	records<SnapshotReaction>(SnapshotSection::Reactions, count);
+	records<SnapshotQuantity>(SnapshotSection::ReactionQuantities, count);
+	records<DeviceThresholds>(SnapshotSection::Thresholds, count);
+	records<double>(SnapshotSection::SpawnerMixtures, count);
+	if (header->elementCount > 0 && count % header->elementCount != 0)
+		fail("has a partial spawner mixture");
+	records<SnapshotElement>(SnapshotSection::Elements, count);
+	if (count != header->elementCount)
+		fail("doesn't list every element");
+	volumeData = records<double>(SnapshotSection::Volumes, count);
+	if (count != header->atmosphereCount)
+		fail("doesn't have a volume for every atmosphere");
+	heatData = records<double>(SnapshotSection::HeatEnergies, count);
+	if (count != header->atmosphereCount)
+		fail("doesn't have a heat energy for every atmosphere");
+	molesData = records<double>(SnapshotSection::Moles, count);
+	// count == atmosphereCount · elementCount, without overflowing
+	bool molesComplete = header->elementCount > 0
+		? count % header->elementCount == 0 && count / header->elementCount == header->atmosphereCount
+		: count == 0;
+	if (!molesComplete)
+		fail("doesn't have moles for every atmosphere");
+}
+
+void SnapshotFile::release()
+{
+#ifndef _WIN32
+	if (data)
+		munmap(const_cast<void *>(data), length);
+#endif
+	data = nullptr;
+	header = nullptr;
+}
+
+SnapshotFile::~SnapshotFile()
+{
+	release();
+}
+
+void const *SnapshotFile::section(SnapshotSection kind, std::size_t recordSize, std::size_t &count) const
+{
+	SnapshotSectionEntry const *entry = sections[static_cast<std::size_t>(kind)];
+	if (!entry) {
+		count = 0;
+		return nullptr;
+	}
+	if (entry->recordSize != recordSize)
+		throw std::runtime_error("Snapshot section " + std::to_string(entry->kind) + " has records of " + std::to_string(entry->recordSize) + " bytes, expected " + std::to_string(recordSize));
+	count = entry->count;
+	return static_cast<char const *>(data) + entry->offset;
+}
+
+std::string SnapshotFile::string(SnapshotString const &string) const
+{
+	std::size_t count;
+	char const *chars = records<char>(SnapshotSection::Strings, count);
+	if (string.offset > count || string.length > count - string.offset)
+		throw std::runtime_error("Snapshot string is outside of the string table");
+	return std::string(chars + string.offset, string.length);
+}
+
+void SnapshotFile::check_elements() const
+{
+	if (elementsChecked.load(std::memory_order_acquire))
+		return;
+	std::size_t count;
+	SnapshotElement const *elements = records<SnapshotElement>(SnapshotSection::Elements, count);
+	for (std::size_t id = 0; id < count; ++id) {
+		std::string key = string(elements[id].key);
+		if (!atmosphericsElements.has_id(id) || atmosphericsElements.key_of(id) != key)
+			throw std::runtime_error("Snapshot element '" + key + "' is not registered with id " + std::to_string(id));
+	}
+	elementsChecked.store(true, std::memory_order_release);
+}
+
+double const *SnapshotFile::volumes() const
+{
+	return volumeData;
+}
+double const *SnapshotFile::heat_energies() const
+{
+	return heatData;
+}
+double const *SnapshotFile::species_moles(ElementId element) const
+{
+	return molesData + element * header->atmosphereCount;
+}
+std::size_t SnapshotFile::device_count() const
+{
+	std::size_t total = 0;
+	for (std::uint32_t kind = 0; kind <= static_cast<std::uint32_t>(DeviceKind::MolarMixer); ++kind)
+		if (SnapshotSectionEntry const *entry = sections[static_cast<std::size_t>(SnapshotSection::Devices) + kind])
+			total += entry->count;
+	return total;
+}
+
+void SnapshotFile::restore_registries() const
+{
+	std::size_t count;
+	SnapshotElement const *elements = records<SnapshotElement>(SnapshotSection::Elements, count);
+	for (std::size_t id = 0; id < count; ++id) {
+		SnapshotElement const &element = elements[id];
+		std::string key = string(element.key);
+		if (atmosphericsElements.has_id(id)) {
+			if (atmosphericsElements.key_of(id) != key)
+				throw std::runtime_error("Snapshot element '" + key + "' has id " + std::to_string(id) + ", which is already '" + atmosphericsElements.key_of(id) + "'");
+			continue;
+		}
+		if (atmosphericsElements.has_key(key))
+			throw std::runtime_error("Snapshot element '" + key + "' is already registered with another id");
+		atmosphericsElements.add(key, AtmosphericsElement(string(element.name), string(element.shortName),
+			element.heatCapacity, element.molarMass, element.thermalConductivity));
+	}
+
+	std::size_t reactionCount, quantityCount;
+	SnapshotReaction const *reactions = records<SnapshotReaction>(SnapshotSection::Reactions, reactionCount);
+	SnapshotQuantity const *quantities = records<SnapshotQuantity>(SnapshotSection::ReactionQuantities, quantityCount);
+	std::vector<AtmosphericsReaction> restored;
+	restored.reserve(reactionCount);
+	for (std::size_t i = 0; i < reactionCount; ++i) {
+		SnapshotReaction const &record = reactions[i];
+		std::size_t used = std::size_t(record.reactantCount) + record.productCount;
+		if (record.firstQuantity > quantityCount || used > quantityCount - record.firstQuantity)
+			throw std::runtime_error("Snapshot reaction " + std::to_string(i) + " has quantities outside the file");
+		AtmosphericsReaction reaction(record.autoignitionPoint, record.energyReleased, record.ignitable != 0);
+		reaction.reactionSpeed = record.reactionSpeed;
+		for (std::size_t q = 0; q < used; ++q) {
+			SnapshotQuantity const &quantity = quantities[record.firstQuantity + q];
+			if (quantity.element >= count)
+				throw std::runtime_error("Snapshot reaction " + std::to_string(i) + " uses an unknown element");
+			ElementId element = static_cast<ElementId>(quantity.element);
+			if (q < record.reactantCount)
+				reaction.add_reactant(element, quantity.moles);
+			else
+				reaction.add_product(element, quantity.moles);
+		}
+		restored.push_back(std::move(reaction));
+	}
+	atmosphericsReactions = std::move(restored);
+	atmosphericsReactionIndex.invalidate();
+	// every element is registered under its id now
+	elementsChecked.store(true, std::memory_order_release);
+}
+
+void SnapshotFile::restore_atmosphere(std::size_t index, Atmosphere &atmosphere) const
+{
+	if (index >= atmosphere_count())
+		throw std::invalid_argument("Snapshot has no atmosphere " + std::to_string(index));
+	check_elements();
+	atmosphere.volume = volumeData[index];
+	atmosphere.contents.clear();
+	std::size_t stride = header->atmosphereCount;
+	for (std::size_t element = 0; element < header->elementCount; ++element)
+		atmosphere.contents.set(static_cast<ElementId>(element), molesData[element * stride + index]);
+	atmosphere.recalculate_aggregates();
+	atmosphere.heatEnergy = heatData[index];
+	atmosphere.recalculate_dirty();
+	atmosphere.wake();
+}
+
+std::size_t SnapshotFile::restore_world(AtmosphereWorld &world) const
+{
+	check_elements();
+	return world.append(atmosphere_count(), volumeData, heatData, molesData, atmosphere_count(), element_count());
+}
+
+// A bool read from the file is only a bool if its byte is 0 or 1.
+static bool bool_valid(bool const &value)
+{
+	unsigned char byte;
+	std::memcpy(&byte, &value, sizeof(byte));
+	return byte <= 1;
+}
+// True if every index in record is within its table and active is a bool.
+static bool record_valid(DeviceStore::LinkRecord const &record, std::size_t atmospheres, std::size_t thresholds, std::size_t)
+{
+	return record.source < atmospheres && record.destination < atmospheres
+	    && (record.thresholds < thresholds || record.thresholds == DeviceStore::NO_THRESHOLDS)
+	    && bool_valid(record.active);
+}
+static bool record_valid(DeviceStore::RateRecord const &record, std::size_t atmospheres, std::size_t thresholds, std::size_t)
+{
+	return record.source < atmospheres && record.destination < atmospheres
+	    && (record.thresholds < thresholds || record.thresholds == DeviceStore::NO_THRESHOLDS)
+	    && bool_valid(record.active);
+}
+static bool record_valid(DeviceStore::FilteredRecord const &record, std::size_t atmospheres, std::size_t thresholds, std::size_t)
+{
+	return record.source < atmospheres && record.destination < atmospheres
+	    && (record.thresholds < thresholds || record.thresholds == DeviceStore::NO_THRESHOLDS)
+	    && bool_valid(record.active);
+}
+static bool record_valid(DeviceStore::MixerRecord const &record, std::size_t atmospheres, std::size_t thresholds, std::size_t)
+{
+	return record.sourceA < atmospheres && record.sourceB < atmospheres && record.destination < atmospheres
+	    && (record.thresholds < thresholds || record.thresholds == DeviceStore::NO_THRESHOLDS)
+	    && bool_valid(record.active);
+}
+static bool record_valid(DeviceStore::SpawnerRecord const &record, std::size_t atmospheres, std::size_t thresholds, std::size_t mixtures)
+{
+	return record.destination < atmospheres && record.mixture < mixtures
+	    && (record.thresholds < thresholds || record.thresholds == DeviceStore::NO_THRESHOLDS)
+	    && bool_valid(record.active);
+}
+
+void SnapshotFile::restore_devices(DeviceStore &devices, std::vector<Atmosphere *> const &atmospheres) const
+{
+	if (devices.size() > 0 || !devices.atmosphere_table().empty() || devices.thresholds.size() > 1 || !devices.mixtures.empty())
+		throw std::invalid_argument("Snapshot devices can only be restored into an empty DeviceStore");
+	if (atmospheres.size() != atmosphere_count())
+		throw std::invalid_argument("Snapshot has " + std::to_string(atmosphere_count()) + " atmospheres, got " + std::to_string(atmospheres.size()));
+	check_elements();
+	for (std::size_t i = 0; i < atmospheres.size(); ++i)
+		if (devices.add_atmosphere(*atmospheres[i]) != i)
+			throw std::invalid_argument("Snapshot atmospheres have to be distinct");
+
+	std::size_t thresholdCount, mixtureValues;
+	DeviceThresholds const *thresholds = records<DeviceThresholds>(SnapshotSection::Thresholds, thresholdCount);
+	if (thresholdCount > 0)
+		devices.thresholds.assign(thresholds, thresholds + thresholdCount);
+	double const *mixtures = records<double>(SnapshotSection::SpawnerMixtures, mixtureValues);
+	std::size_t width = element_count();
+	std::size_t mixtureCount = width > 0 ? mixtureValues / width : 0;
+	devices.mixtures.resize(mixtureCount);
+	for (std::size_t i = 0; i < mixtureCount; ++i)
+		for (std::size_t element = 0; element < width; ++element)
+			devices.mixtures[i].set(static_cast<ElementId>(element), mixtures[i * width + element]);
+
+	for_each_record_array(devices, [&](DeviceKind kind, auto &stored) {
+		using Record = typename std::decay_t<decltype(stored)>::value_type;
+		std::size_t count;
+		Record const *loaded = records<Record>(device_section(kind), count);
+		for (std::size_t i = 0; i < count; ++i)
+			if (!record_valid(loaded[i], atmospheres.size(), devices.thresholds.size(), mixtureCount))
+				throw std::runtime_error("Snapshot device " + std::to_string(i) + " of kind " + std::to_string(static_cast<int>(kind)) + " has a bad active flag or refers to something that isn't there");
+		stored.assign(loaded, loaded + count);
+	});
+	for (Atmosphere *atmosphere : atmospheres)
+		atmosphere->wake();
+}
+}
@@ -0,0 +1,177 @@
+#ifndef ATMOSPHERICS_SNAPSHOT_HPP
+#define ATMOSPHERICS_SNAPSHOT_HPP
+
+#include "atmosphere.hpp"
+#include "atmosphere_world.hpp"
+#include "atmospherics_device_store.hpp"
+#include "atmospherics_element.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ZAtmos {
+// Binary snapshots of atmospheres, packed devices and the registries.
+//
+// A snapshot is a header, a table of sections and then the sections
+// themselves, each an 8-byte aligned array of fixed-size records in native
+// byte order. Atmospheres are stored like AtmosphereWorld stores them: one
+// array of volumes, one of heat energies and a species-major moles matrix
+// with a column per registered element. Devices are the record arrays of a
+// DeviceStore as they are in memory, with atmospheres referring to snapshot
+// atmospheres by index. Elements and reactions are stored by id, so loading
+// needs the same elements registered in the same order (or not yet
+// registered, see SnapshotFile::restore_registries).
+//
+// Devices held as GenericDevice objects can be saved by packing them into a
+// DeviceStore first with DeviceStore::add.
+constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+enum class SnapshotSection : std::uint32_t {
+	// chars referred to by SnapshotString
+	Strings,
+	Elements,
+	Reactions,
+	// reactants and products of every reaction, see SnapshotReaction
+	ReactionQuantities,
+	// L, per atmosphere
+	Volumes,
+	// J, per atmosphere
+	HeatEnergies,
+	// mol, moles[element * atmosphereCount + atmosphere]
+	Moles,
+	// DeviceStore::thresholds
+	Thresholds,
+	// DeviceStore::mixtures, one row of elementCount mol each
+	SpawnerMixtures,
+	// DeviceStore record array of kind is Devices + kind
+	Devices,
+	Count = Devices + static_cast<std::uint32_t>(DeviceKind::MolarMixer) + 1,
+};
+
+struct SnapshotHeader {
+	char magic[8];
+	std::uint32_t version;
+	// SNAPSHOT_BYTE_ORDER as written, to reject snapshots from the other endianness
+	std::uint32_t byteOrder;
+	std::uint32_t sectionCount;
+	std::uint32_t elementCount;
+	std::uint64_t atmosphereCount;
+};
+struct SnapshotSectionEntry {
+	std::uint32_t kind;
+	// bytes per record, checked on load
+	std::uint32_t recordSize;
+	std::uint64_t count;
+	// from the start of the file
+	std::uint64_t offset;
+};
+struct SnapshotString {
+	std::uint32_t offset;
+	std::uint32_t length;
+};
+struct SnapshotElement {
+	SnapshotString key;
+	SnapshotString name;
+	SnapshotString shortName;
+	double heatCapacity; // J / (K · kg)
+	double molarMass; // kg / mol
+	double thermalConductivity; // W / (m · K)
+};
+struct SnapshotReaction {
+	double autoignitionPoint; // K
+	double energyReleased; // J/mol
+	double reactionSpeed; // mol/s
+	// reactants, then products, starting at firstQuantity in ReactionQuantities
+	std::uint32_t firstQuantity;
+	std::uint32_t reactantCount;
+	std::uint32_t productCount;
+	std::uint32_t ignitable;
+};
+struct SnapshotQuantity {
+	std::uint64_t element;
+	double moles;
+};
+
+// Writes the registries and every atmosphere of world, in row order.
+// Throws std::runtime_error if path can't be written.
+void save_snapshot(std::string const &path, AtmosphereWorld const &world);
+// Writes the registries and atmospheres, in order.
+void save_snapshot(std::string const &path, std::vector<Atmosphere *> const &atmospheres);
+// Writes the registries, the atmosphere table of devices and every device in it.
+void save_snapshot(std::string const &path, DeviceStore const &devices);
+
+// A snapshot file mapped into memory. Opening only checks the header and
+// that every section lies within the file, the arrays returned point straight
+// into the mapping and stay valid for as long as the SnapshotFile does.
+// Everything that can't be read throws std::runtime_error.
+struct SnapshotFile {
+private:
+	void const *data = nullptr;
+	std::size_t length = 0;
+	// used instead of a mapping where mmap isn't available
+	std::vector<char> buffer;
+	SnapshotHeader const *header = nullptr;
+	std::array<SnapshotSectionEntry const *, static_cast<std::size_t>(SnapshotSection::Count)> sections {};
+	// atmosphere sections, found once by validate()
+	double const *volumeData = nullptr;
+	double const *heatData = nullptr;
+	double const *molesData = nullptr;
+	// set once check_elements() passed, the registry only ever grows so it
+	// stays that way
+	mutable std::atomic<bool> elementsChecked { false };
+
+	// checks the header and section table, throws if anything is off
+	void validate(std::string const &path);
+	void release();
+
+	// Records of kind, which have to be recordSize bytes each. Missing sections are empty.
+	void const *section(SnapshotSection kind, std::size_t recordSize, std::size_t &count) const;
+	template <typename T>
+	inline T const *records(SnapshotSection kind, std::size_t &count) const
+	{
+		return static_cast<T const *>(section(kind, sizeof(T), count));
+	}
+	std::string string(SnapshotString const &string) const;
+	// throws unless every element of the snapshot is registered under its id,
+	// only looks at the registry until that passes once
+	void check_elements() const;
+public:
+	explicit SnapshotFile(std::string const &path);
+	SnapshotFile(SnapshotFile const &) = delete;
+	SnapshotFile &operator=(SnapshotFile const &) = delete;
+	~SnapshotFile();
+
+	inline std::uint32_t version() const { return header->version; }
+	inline std::size_t element_count() const { return header->elementCount; }
+	inline std::size_t atmosphere_count() const { return header->atmosphereCount; }
+	// L, per atmosphere
+	double const *volumes() const;
+	// J, per atmosphere
+	double const *heat_energies() const;
+	// mol of element in every atmosphere, element must be below element_count()
+	double const *species_moles(ElementId element) const;
+	// Number of devices of every kind together.
+	std::size_t device_count() const;
+
+	// Registers every element of the snapshot that isn't yet, checking those
+	// that are have the same key and id, and replaces atmosphericsReactions
+	// with the reactions of the snapshot. Throws if an id is already taken
+	// by another element.
+	void restore_registries() const;
+	// Replaces volume, heat and contents of atmosphere with those of
+	// atmosphere index of the snapshot.
+	void restore_atmosphere(std::size_t index, Atmosphere &atmosphere) const;
+	// Appends every atmosphere of the snapshot to world, in order, and
+	// returns the row of the first one.
+	std::size_t restore_world(AtmosphereWorld &world) const;
+	// Fills devices, which has to be empty, with the devices of the snapshot.
+	// atmospheres[i] takes the place of atmosphere i of the snapshot, restore
+	// their state with restore_atmosphere() if needed.
+	void restore_devices(DeviceStore &devices, std::vector<Atmosphere *> const &atmospheres) const;
+};
+}
+
+#endif
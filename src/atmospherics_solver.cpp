@@ -0,0 +1,76 @@
+#include "atmospherics_solver.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace ZAtmos {
+void ConductanceSystem::multiply(double dt, double const *x, double *out) const
+{
+	std::size_t count = size();
+	for (std::size_t i = 0; i < count; ++i)
+		out[i] = capacities[i] * x[i];
+	for (Edge const &edge : edges) {
+		double flow = dt * edge.conductance * (x[edge.a] - x[edge.b]);
+		out[edge.a] += flow;
+		out[edge.b] -= flow;
+	}
+}
+
+unsigned ConductanceSystem::solve(double dt, double const *rhs, double *x, double tolerance, unsigned maxIterations)
+{
+	std::size_t count = size();
+	if (count == 0)
+		return 0;
+	residual.resize(count);
+	direction.resize(count);
+	product.resize(count);
+	preconditioned.resize(count);
+	inverseDiagonal.assign(capacities.begin(), capacities.end());
+	for (Edge const &edge : edges) {
+		inverseDiagonal[edge.a] += dt * edge.conductance;
+		inverseDiagonal[edge.b] += dt * edge.conductance;
+	}
+	for (double &value : inverseDiagonal)
+		value = 1 / value;
+
+	double rhsNorm = 0;
+	for (std::size_t i = 0; i < count; ++i)
+		rhsNorm += rhs[i] * rhs[i];
+	double limit = tolerance * tolerance * rhsNorm;
+
+	multiply(dt, x, product.data());
+	double residualNorm = 0;
+	double rz = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		residual[i] = rhs[i] - product[i];
+		preconditioned[i] = residual[i] * inverseDiagonal[i];
+		direction[i] = preconditioned[i];
+		residualNorm += residual[i] * residual[i];
+		rz += residual[i] * preconditioned[i];
+	}
+	unsigned iteration = 0;
+	while (iteration < maxIterations && residualNorm > limit) {
+		++iteration;
+		multiply(dt, direction.data(), product.data());
+		double curvature = 0;
+		for (std::size_t i = 0; i < count; ++i)
+			curvature += direction[i] * product[i];
+		if (curvature <= 0)
+			break;
+		double alpha = rz / curvature;
+		residualNorm = 0;
+		double nextRz = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			x[i] += alpha * direction[i];
+			residual[i] -= alpha * product[i];
+			preconditioned[i] = residual[i] * inverseDiagonal[i];
+			residualNorm += residual[i] * residual[i];
+			nextRz += residual[i] * preconditioned[i];
+		}
+		double beta = nextRz / rz;
+		rz = nextRz;
+		for (std::size_t i = 0; i < count; ++i)
+			direction[i] = preconditioned[i] + beta * direction[i];
+	}
+	return iteration;
+}
+}
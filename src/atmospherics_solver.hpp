@@ -0,0 +1,55 @@
+#ifndef ATMOSPHERICS_SOLVER_HPP
+#define ATMOSPHERICS_SOLVER_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace ZAtmos {
+// Sparse linear system (C + dt·L) x = b over a graph, where C is a positive
+// capacity per node and L is the Laplacian of the edges weighted by their
+// conductance. That makes it symmetric positive definite, so it's solved with
+// Jacobi-preconditioned conjugate gradient. Taking one backward Euler step of
+// anything that flows along edges proportional to the difference of x, like
+// gas with pressure or heat with temperature, comes down to this.
+struct ConductanceSystem {
+	struct Edge {
+		std::size_t a, b;
+		double conductance;
+	};
+private:
+	// scratch for solve()
+	std::vector<double> residual;
+	std::vector<double> direction;
+	std::vector<double> product;
+	std::vector<double> preconditioned;
+	std::vector<double> inverseDiagonal;
+public:
+	// per node
+	std::vector<double> capacities;
+	std::vector<Edge> edges;
+
+	inline void clear()
+	{
+		capacities.clear();
+		edges.clear();
+	}
+	inline std::size_t add_node(double capacity)
+	{
+		capacities.push_back(capacity);
+		return capacities.size() - 1;
+	}
+	inline void add_edge(std::size_t a, std::size_t b, double conductance)
+	{
+		edges.push_back(Edge { a, b, conductance });
+	}
+	inline std::size_t size() const { return capacities.size(); }
+
+	// out = (C + dt·L) x
+	void multiply(double dt, double const *x, double *out) const;
+	// Solves (C + dt·L) x = rhs, starting from whatever is in x. Stops once the
+	// residual is below tolerance relative to rhs, returns the iterations used.
+	unsigned solve(double dt, double const *rhs, double *x, double tolerance, unsigned maxIterations);
+};
+}
+
+#endif
@@ -5,9 +5,9 @@ namespace ZAtmos {
 ElasticAtmosphere::ElasticAtmosphere(double initialVolume)
 	: Atmosphere(initialVolume)
 {}
-void ElasticAtmosphere::tick(double dt)
+void ElasticAtmosphere::update_volume(double dt)
 {
-	Atmosphere::tick(dt);
+	(void) dt;
 	// PV = nRT
 	// P = external pressure
 	// n = get_moles()
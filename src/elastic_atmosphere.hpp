@@ -6,7 +6,8 @@ namespace ZAtmos {
 struct ElasticAtmosphere : public Atmosphere {
 	double externalPressure = 101.325;
 	ElasticAtmosphere(double initialVolume);
-	void tick(double dt) override;
+	void update_volume(double dt) override;
+	inline bool is_elastic() const override { return true; }
 };
 }
 
@@ -0,0 +1,218 @@
+#include "executor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+namespace ZAtmos {
+void SerialExecutor::run(std::size_t count, std::size_t grain, ChunkFunction const &body)
+{
+	(void) grain;
+	if (count > 0)
+		body(0, count);
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(std::size_t threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	for (std::size_t i = 1; i < threads; ++i)
+		workers.emplace_back([this] { worker_loop(); });
+}
+ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto &worker : workers)
+		worker.join();
+}
+// grabs chunks until the job runs out
+void ThreadPoolExecutor::work(ChunkFunction const &body, std::size_t count, std::size_t grain)
+{
+	for (;;) {
+		std::size_t begin = next.fetch_add(grain, std::memory_order_relaxed);
+		if (begin >= count)
+			return;
+		body(begin, std::min(count, begin + grain));
+	}
+}
+void ThreadPoolExecutor::worker_loop()
+{
+	std::size_t seen = 0;
+	for (;;) {
+		ChunkFunction const *job;
+		std::size_t jobCount, jobGrain;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			// woke up after that run() already returned
+			if (!body)
+				continue;
+			job = body;
+			jobCount = count;
+			jobGrain = grain;
+			++busyWorkers;
+		}
+		work(*job, jobCount, jobGrain);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--busyWorkers;
+		}
+		done.notify_one();
+	}
+}
+void ThreadPoolExecutor::run(std::size_t count, std::size_t grain, ChunkFunction const &body)
+{
+	if (count == 0)
+		return;
+	grain = std::max<std::size_t>(1, grain);
+	if (workers.empty() || count <= grain) {
+		body(0, count);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->body = &body;
+		this->count = count;
+		this->grain = grain;
+		next.store(0, std::memory_order_relaxed);
+		++generation;
+	}
+	wake.notify_all();
+	work(body, count, grain);
+	// workers that wake up once the job is over find body cleared, so only
+	// the ones that took the job under mutex need waiting for
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return busyWorkers == 0; });
+	this->body = nullptr;
+}
+
+WorkStealingExecutor::WorkStealingExecutor(std::size_t threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	queues = std::vector<Queue>(threads);
+	for (std::size_t i = 1; i < threads; ++i)
+		workers.emplace_back([this, i] { worker_loop(i); });
+}
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto &worker : workers)
+		worker.join();
+}
+// takes a chunk off the front of our own range
+bool WorkStealingExecutor::pop(std::size_t self, std::size_t grain, std::size_t &begin, std::size_t &end)
+{
+	Queue &queue = queues[self];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.begin >= queue.end)
+		return false;
+	begin = queue.begin;
+	end = std::min(queue.end, begin + grain);
+	queue.begin = end;
+	return true;
+}
+// moves the back half of some other thread's range into ours
+bool WorkStealingExecutor::steal(std::size_t self, std::size_t grain)
+{
+	std::size_t threads = queues.size();
+	for (std::size_t offset = 1; offset < threads; ++offset) {
+		Queue &victim = queues[(self + offset) % threads];
+		std::size_t begin, end;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			std::size_t remaining = victim.end > victim.begin ? victim.end - victim.begin : 0;
+			if (remaining == 0)
+				continue;
+			// leave the victim at least the chunk it would take next
+			std::size_t taken = remaining > grain ? remaining / 2 : remaining;
+			begin = victim.end - taken;
+			end = victim.end;
+			victim.end = begin;
+		}
+		Queue &queue = queues[self];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.begin = begin;
+		queue.end = end;
+		return true;
+	}
+	return false;
+}
+void WorkStealingExecutor::work(std::size_t self, ChunkFunction const &body, std::size_t grain)
+{
+	std::size_t begin, end;
+	for (;;) {
+		while (pop(self, grain, begin, end))
+			body(begin, end);
+		if (!steal(self, grain))
+			return;
+	}
+}
+void WorkStealingExecutor::worker_loop(std::size_t self)
+{
+	std::size_t seen = 0;
+	for (;;) {
+		ChunkFunction const *job;
+		std::size_t jobGrain;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			// woke up after that run() already returned
+			if (!body)
+				continue;
+			job = body;
+			jobGrain = grain;
+			++busyWorkers;
+		}
+		work(self, *job, jobGrain);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--busyWorkers;
+		}
+		done.notify_one();
+	}
+}
+void WorkStealingExecutor::run(std::size_t count, std::size_t grain, ChunkFunction const &body)
+{
+	if (count == 0)
+		return;
+	grain = std::max<std::size_t>(1, grain);
+	if (workers.empty() || count <= grain) {
+		body(0, count);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->body = &body;
+		this->grain = grain;
+		// even initial split, stealing fixes up the imbalance
+		std::size_t threads = queues.size();
+		for (std::size_t i = 0; i < threads; ++i) {
+			std::lock_guard<std::mutex> queueLock(queues[i].mutex);
+			queues[i].begin = count * i / threads;
+			queues[i].end = count * (i + 1) / threads;
+		}
+		++generation;
+	}
+	wake.notify_all();
+	work(0, body, grain);
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return busyWorkers == 0; });
+	this->body = nullptr;
+}
+}
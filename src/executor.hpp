@@ -0,0 +1,123 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ZAtmos {
+// Non-owning reference to a callable taking (begin, end), so handing work to
+// an executor never allocates.
+struct ChunkFunction {
+	void const *context;
+	void (*call)(void const *context, std::size_t begin, std::size_t end);
+	template <typename F>
+	inline ChunkFunction(F const &function)
+		: context(&function),
+		  call([](void const *context, std::size_t begin, std::size_t end) {
+			(*static_cast<F const *>(context))(begin, end);
+		  })
+	{}
+	inline void operator()(std::size_t begin, std::size_t end) const
+	{
+		call(context, begin, end);
+	}
+};
+
+// Runs independent chunks of work, possibly on several threads. Implement this
+// to plug the simulation into an existing job system.
+struct Executor {
+	// Calls body(begin, end) over [0, count) in chunks of at most grain items,
+	// and returns once every chunk is done. Chunks may run concurrently.
+	virtual void run(std::size_t count, std::size_t grain, ChunkFunction const &body) = 0;
+	// Number of threads that may run chunks at once.
+	virtual std::size_t concurrency() const = 0;
+	inline virtual ~Executor() {}
+
+	template <typename F>
+	inline void parallel_for(std::size_t count, std::size_t grain, F const &body)
+	{
+		run(count, grain, ChunkFunction(body));
+	}
+};
+
+// Runs everything on the calling thread.
+struct SerialExecutor : public Executor {
+	void run(std::size_t count, std::size_t grain, ChunkFunction const &body) override;
+	inline std::size_t concurrency() const override { return 1; }
+};
+
+// Fixed pool of threads pulling chunks off a shared counter. The calling
+// thread works too, so threads = 1 spawns nothing.
+struct ThreadPoolExecutor : public Executor {
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	// bumped for every run() so sleeping workers know there's a new job
+	std::size_t generation = 0;
+	std::size_t busyWorkers = 0;
+	bool stopping = false;
+	// current job, nullptr between jobs. Workers copy these under mutex, since
+	// the next run() may rewrite them as soon as they let go of it.
+	ChunkFunction const *body = nullptr;
+	std::size_t count = 0;
+	std::size_t grain = 1;
+	std::atomic<std::size_t> next { 0 };
+
+	void work(ChunkFunction const &body, std::size_t count, std::size_t grain);
+	void worker_loop();
+public:
+	// threads = 0 uses std::thread::hardware_concurrency()
+	ThreadPoolExecutor(std::size_t threads = 0);
+	~ThreadPoolExecutor() override;
+	ThreadPoolExecutor(ThreadPoolExecutor const &) = delete;
+	ThreadPoolExecutor &operator=(ThreadPoolExecutor const &) = delete;
+	void run(std::size_t count, std::size_t grain, ChunkFunction const &body) override;
+	inline std::size_t concurrency() const override { return workers.size() + 1; }
+};
+
+// Pool where each thread starts with an even share of the range and takes
+// grain-sized chunks off the front of it. A thread that runs dry steals the
+// back half of another thread's remaining range, so uneven per-item cost
+// (a burning room next to a sealed tank) still balances out.
+struct WorkStealingExecutor : public Executor {
+private:
+	struct alignas(64) Queue {
+		std::mutex mutex;
+		std::size_t begin = 0;
+		std::size_t end = 0;
+	};
+	std::vector<std::thread> workers;
+	// one per thread, index 0 is the calling thread
+	std::vector<Queue> queues;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::size_t generation = 0;
+	std::size_t busyWorkers = 0;
+	bool stopping = false;
+	// current job, nullptr between jobs, copied by workers under mutex
+	ChunkFunction const *body = nullptr;
+	std::size_t grain = 1;
+
+	bool pop(std::size_t self, std::size_t grain, std::size_t &begin, std::size_t &end);
+	bool steal(std::size_t self, std::size_t grain);
+	void work(std::size_t self, ChunkFunction const &body, std::size_t grain);
+	void worker_loop(std::size_t self);
+public:
+	// threads = 0 uses std::thread::hardware_concurrency()
+	WorkStealingExecutor(std::size_t threads = 0);
+	~WorkStealingExecutor() override;
+	WorkStealingExecutor(WorkStealingExecutor const &) = delete;
+	WorkStealingExecutor &operator=(WorkStealingExecutor const &) = delete;
+	void run(std::size_t count, std::size_t grain, ChunkFunction const &body) override;
+	inline std::size_t concurrency() const override { return queues.size(); }
+};
+}
+
+#endif
@@ -0,0 +1,440 @@
+#include "grid_atmosphere.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_flux.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ZAtmos {
+// Heat conduction would move between two bodies at most, the amount that
+// leaves both at the same temperature.
+static inline double equalizing_heat(double temperatureGradient, double capacityA, double capacityB)
+{
+	double capacity = capacityA + capacityB;
+	return capacity > 0 ? std::abs(temperatureGradient) * capacityA * capacityB / capacity : 0;
+}
+// Clamps conducted heat to share of the equalizing amount.
+static inline double limit_conduction(double heat, double limit)
+{
+	return std::clamp(heat, -limit, limit);
+}
+
+// Calls row(first, count, offset) for contiguous runs of cells whose edge along
+// axis leads to cell + offset, so callers get plain loops over neighbouring memory.
+template <typename F>
+static void for_each_edge_run(std::size_t width, std::size_t height, std::size_t depth, unsigned axis, F &&row)
+{
+	std::size_t layer = width * height;
+	if (axis == 0) {
+		if (width < 2)
+			return;
+		for (std::size_t start = 0; start < layer * depth; start += width)
+			row(start, width - 1, 1);
+	} else if (axis == 1) {
+		if (height < 2)
+			return;
+		for (std::size_t z = 0; z < depth; ++z)
+			row(z * layer, width * (height - 1), width);
+	} else if (depth > 1) {
+		row(0, layer * (depth - 1), layer);
+	}
+}
+
+GridAtmosphere::GridAtmosphere(std::size_t width, std::size_t height, std::size_t depth, double cellVolume)
+	: width(width), height(height), depth(depth), cellVolume(cellVolume)
+{
+	if (width == 0 || height == 0 || depth == 0)
+		throw std::invalid_argument("Grid atmosphere needs at least one cell along every axis");
+	if (cellVolume <= 0)
+		throw std::invalid_argument("Grid atmosphere cells need a positive volume");
+	std::size_t count = cell_count();
+	totalMoles.assign(count, 0.0);
+	totalMass.assign(count, 0.0);
+	massHeatCapacity.assign(count, 0.0);
+	massThermalConductivity.assign(count, 0.0);
+	heatEnergy.assign(count, 0.0);
+	tempKelvin.assign(count, minTemperature);
+	blocked.assign(count, 0);
+	reserve_species(atmosphericsElements.size());
+}
+
+void GridAtmosphere::reserve_species(std::size_t elements)
+{
+	if (elements <= species)
+		return;
+	// planes are stacked, so growing only appends
+	moles.resize(elements * cell_count(), 0.0);
+	species = elements;
+}
+double GridAtmosphere::change_moles(std::size_t cell, ElementId element, double delta)
+{
+	reserve_species(static_cast<std::size_t>(element) + 1);
+	double &amount = species_moles(element)[cell];
+	double before = amount;
+	amount = std::max(0.0, amount + delta);
+	double change = amount - before;
+	double mass = change * atmosphericsElements.molar_masses()[element];
+	totalMoles[cell] += change;
+	totalMass[cell] += mass;
+	massHeatCapacity[cell] += mass * atmosphericsElements.heat_capacities_moles()[element];
+	massThermalConductivity[cell] += mass * atmosphericsElements.thermal_conductivities()[element];
+	if (totalMoles[cell] <= 0) {
+		totalMoles[cell] = 0;
+		totalMass[cell] = 0;
+		massHeatCapacity[cell] = 0;
+		massThermalConductivity[cell] = 0;
+	}
+	return change;
+}
+void GridAtmosphere::recalculate_dirty(std::size_t cell)
+{
+	double heatCapacity = get_heat_capacity(cell);
+	if (heatEnergy[cell] <= 0 || heatCapacity <= 0) {
+		tempKelvin[cell] = minTemperature;
+		heatEnergy[cell] = 0;
+	} else {
+		tempKelvin[cell] = heatEnergy[cell] / heatCapacity;
+	}
+}
+double GridAtmosphere::mix_flow(double pressureA, double pressureB, double dt) const
+{
+	// same as Atmosphere::get_mix_flow
+	double pressureGradient = 0.1 * (pressureA - pressureB);
+	double flowMult = maxPressure / (maxPressure + std::abs(pressureGradient));
+	flowMult *= flowMult;
+	return mixRate * flowMult * pressureGradient * dt;
+}
+
+void GridAtmosphere::set_blocked(std::size_t cell, unsigned axis, bool blocked)
+{
+	if (cell >= cell_count() || axis > 2)
+		throw std::invalid_argument("Edge " + std::to_string(axis) + " of cell " + std::to_string(cell) + " is not part of this grid");
+	std::uint8_t bit = static_cast<std::uint8_t>(1u << axis);
+	if (blocked)
+		this->blocked[cell] |= bit;
+	else
+		this->blocked[cell] &= static_cast<std::uint8_t>(~bit);
+}
+bool GridAtmosphere::is_blocked(std::size_t cell, unsigned axis) const
+{
+	return (blocked[cell] >> axis) & 1;
+}
+
+void GridAtmosphere::add_moles_temp(std::size_t cell, ElementId element, double moles, double tempKelvin)
+{
+	add_moles_heat(cell, element, moles, tempKelvin * moles * atmosphericsElements.heat_capacities_moles()[element]);
+}
+void GridAtmosphere::add_moles_heat(std::size_t cell, ElementId element, double moles, double heatEnergy)
+{
+	change_moles(cell, element, moles);
+	this->heatEnergy[cell] += heatEnergy;
+	recalculate_dirty(cell);
+}
+void GridAtmosphere::remove(std::size_t cell, ElementId element, double moles)
+{
+	moles = std::min(moles, get_moles(cell, element));
+	if (moles <= 0)
+		return;
+	add_moles_temp(cell, element, -moles, tempKelvin[cell]);
+}
+void GridAtmosphere::add_heat(std::size_t cell, double heatEnergy)
+{
+	// same floor as Atmosphere::add_heat
+	if (heatEnergy < 0)
+		this->heatEnergy[cell] = std::max(get_heat_capacity(cell) * minTemperature, this->heatEnergy[cell] + heatEnergy);
+	else
+		this->heatEnergy[cell] += heatEnergy;
+	recalculate_dirty(cell);
+}
+void GridAtmosphere::copy_cell(std::size_t cell, GridAtmosphere const &source, std::size_t sourceCell)
+{
+	reserve_species(source.species);
+	for (std::size_t element = 0; element < species; ++element) {
+		ElementId id = static_cast<ElementId>(element);
+		species_moles(id)[cell] = source.get_moles(sourceCell, id);
+	}
+	totalMoles[cell] = source.totalMoles[sourceCell];
+	totalMass[cell] = source.totalMass[sourceCell];
+	massHeatCapacity[cell] = source.massHeatCapacity[sourceCell];
+	massThermalConductivity[cell] = source.massThermalConductivity[sourceCell];
+	heatEnergy[cell] = source.heatEnergy[sourceCell];
+	tempKelvin[cell] = source.tempKelvin[sourceCell];
+}
+void GridAtmosphere::clear_cell(std::size_t cell)
+{
+	for (std::size_t element = 0; element < species; ++element)
+		species_moles(static_cast<ElementId>(element))[cell] = 0;
+	totalMoles[cell] = 0;
+	totalMass[cell] = 0;
+	massHeatCapacity[cell] = 0;
+	massThermalConductivity[cell] = 0;
+	heatEnergy[cell] = 0;
+	tempKelvin[cell] = minTemperature;
+}
+
+double GridAtmosphere::get_moles(std::size_t cell) const
+{
+	return totalMoles[cell];
+}
+double GridAtmosphere::get_moles(std::size_t cell, ElementId element) const
+{
+	if (element >= species)
+		return 0;
+	return species_moles(element)[cell];
+}
+double GridAtmosphere::get_temperature(std::size_t cell) const
+{
+	return tempKelvin[cell];
+}
+double GridAtmosphere::get_pressure(std::size_t cell) const
+{
+	// PV = nRT
+	return totalMoles[cell] * gasConstant * tempKelvin[cell] / cellVolume;
+}
+double GridAtmosphere::get_heat_capacity(std::size_t cell) const
+{
+	if (totalMass[cell] <= 0)
+		return 0;
+	return totalMoles[cell] * massHeatCapacity[cell] / totalMass[cell];
+}
+double GridAtmosphere::get_thermal_conductivity(std::size_t cell) const
+{
+	if (totalMass[cell] <= 0)
+		return 0;
+	return massThermalConductivity[cell] / totalMass[cell];
+}
+
+void GridAtmosphere::link(std::size_t cell, Atmosphere &atmosphere)
+{
+	if (cell >= cell_count())
+		throw std::invalid_argument("Cell " + std::to_string(cell) + " is not part of this grid");
+	std::size_t index = 0;
+	while (index < linkedAtmospheres.size() && linkedAtmospheres[index] != &atmosphere)
+		++index;
+	if (index == linkedAtmospheres.size()) {
+		linkedAtmospheres.push_back(&atmosphere);
+		linkFlux.emplace_back();
+	}
+	links.push_back(Link { cell, index });
+}
+void GridAtmosphere::unlink(std::size_t cell, Atmosphere &atmosphere)
+{
+	auto found = std::find(linkedAtmospheres.begin(), linkedAtmospheres.end(), &atmosphere);
+	if (found == linkedAtmospheres.end())
+		return;
+	std::size_t index = static_cast<std::size_t>(found - linkedAtmospheres.begin());
+	std::erase_if(links, [&](Link const &link) { return link.cell == cell && link.atmosphere == index; });
+	bool used = std::any_of(links.begin(), links.end(), [&](Link const &link) { return link.atmosphere == index; });
+	if (used)
+		return;
+	linkedAtmospheres.erase(found);
+	linkFlux.erase(linkFlux.begin() + static_cast<std::ptrdiff_t>(index));
+	for (Link &link : links)
+		if (link.atmosphere > index)
+			--link.atmosphere;
+}
+
+void GridAtmosphere::exchange(double const *plane, bool heat)
+{
+	double *flow = this->flow.data();
+	double *delta = this->delta.data();
+	double const *scale = outScale.data();
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		double const *fractions = edgeFractions[axis].data();
+		double const *conducted = edgeHeat[axis].data();
+		for_each_edge_run(width, height, depth, axis, [&](std::size_t first, std::size_t count, std::size_t offset) {
+			std::size_t end = first + count;
+			// each edge carries a share of whichever side it flows out of
+			for (std::size_t i = first; i < end; ++i) {
+				double f = fractions[i];
+				flow[i] = f > 0 ? f * scale[i] * plane[i] : f * scale[i + offset] * plane[i + offset];
+			}
+			if (heat)
+				for (std::size_t i = first; i < end; ++i)
+					flow[i] += conducted[i];
+			for (std::size_t i = first; i < end; ++i)
+				delta[i] -= flow[i];
+			for (std::size_t i = first; i < end; ++i)
+				delta[i + offset] += flow[i];
+		});
+	}
+}
+
+void GridAtmosphere::step(double dt)
+{
+	begin_step(dt);
+	end_step();
+}
+void GridAtmosphere::begin_step(double dt)
+{
+	reserve_species(atmosphericsElements.size());
+	std::size_t count = cell_count();
+	pressures.resize(count);
+	conductivities.resize(count);
+	capacities.resize(count);
+	outScale.assign(count, 0.0);
+	flow.resize(count);
+	delta.resize(count);
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		edgeFractions[axis].assign(count, 0.0);
+		edgeHeat[axis].assign(count, 0.0);
+	}
+	for (std::size_t i = 0; i < count; ++i) {
+		pressures[i] = totalMoles[i] * gasConstant * tempKelvin[i] / cellVolume;
+		conductivities[i] = totalMass[i] > 0 ? massThermalConductivity[i] / totalMass[i] : 0;
+		capacities[i] = totalMass[i] > 0 ? totalMoles[i] * massHeatCapacity[i] / totalMass[i] : 0;
+	}
+
+	// work out every edge from the state at the start of the step, the same
+	// way Atmosphere::mix_with with backflow and temperature mixing would
+	double conduction = dt * tempMixRate / 0.01; // 1cm across 1m^2
+	// Unlike a pair of atmospheres, a cell conducts through all its edges at
+	// once, so each edge may only take its share of what would even out the
+	// two cells. Otherwise nearly empty cells overshoot and blow up.
+	unsigned edges = (width > 1) + (height > 1) + (depth > 1);
+	double edgeShare = 1.0 / std::max(1u, 2 * edges + (links.empty() ? 0 : 1));
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		double *fractions = edgeFractions[axis].data();
+		double *conducted = edgeHeat[axis].data();
+		std::uint8_t bit = static_cast<std::uint8_t>(1u << axis);
+		for_each_edge_run(width, height, depth, axis, [&](std::size_t first, std::size_t count, std::size_t offset) {
+			std::size_t end = first + count;
+			for (std::size_t i = first; i < end; ++i) {
+				std::size_t n = i + offset;
+				double dN = mix_flow(pressures[i], pressures[n], dt);
+				bool forward = dN > 0;
+				double sourceMoles = forward ? totalMoles[i] : totalMoles[n];
+				double f = sourceMoles > 0 ? std::min(1.0, std::abs(dN) / sourceMoles) : 0;
+				double k = forward ? conductivities[i] : conductivities[n];
+				bool open = (blocked[i] & bit) == 0;
+				fractions[i] = open ? (forward ? f : -f) : 0;
+				double temperatureGradient = tempKelvin[i] - tempKelvin[n];
+				double limit = edgeShare * equalizing_heat(temperatureGradient, capacities[i], capacities[n]);
+				conducted[i] = open ? limit_conduction(k * temperatureGradient * conduction, limit) : 0;
+			}
+			for (std::size_t i = first; i < end; ++i)
+				outScale[i] += std::max(0.0, fractions[i]);
+			for (std::size_t i = first; i < end; ++i)
+				outScale[i + offset] += std::max(0.0, -fractions[i]);
+		});
+	}
+	std::size_t linkCount = links.size();
+	linkFractions.resize(linkCount);
+	linkHeat.resize(linkCount);
+	linkOutScale.assign(linkedAtmospheres.size(), 0.0);
+	for (std::size_t l = 0; l < linkCount; ++l) {
+		std::size_t i = links[l].cell;
+		Atmosphere const &atmosphere = *linkedAtmospheres[links[l].atmosphere];
+		double dN = mix_flow(pressures[i], atmosphere.get_pressure(), dt);
+		double temperatureGradient = tempKelvin[i] - atmosphere.get_temperature();
+		double limit = edgeShare * equalizing_heat(temperatureGradient, capacities[i], atmosphere.get_heat_capacity());
+		if (dN > 0) {
+			double f = totalMoles[i] > 0 ? std::min(1.0, dN / totalMoles[i]) : 0;
+			linkFractions[l] = f;
+			linkHeat[l] = limit_conduction(conductivities[i] * temperatureGradient * conduction, limit);
+			outScale[i] += f;
+		} else {
+			double moles = atmosphere.get_moles();
+			double f = moles > 0 ? std::min(1.0, -dN / moles) : 0;
+			linkFractions[l] = -f;
+			linkHeat[l] = limit_conduction(atmosphere.get_thermal_conductivity() * temperatureGradient * conduction, limit);
+			linkOutScale[links[l].atmosphere] += f;
+		}
+	}
+}
+void GridAtmosphere::end_step()
+{
+	std::size_t count = cell_count();
+	std::size_t linkCount = links.size();
+	// a cell can't give away more than it has, scale its outflows down together
+	for (std::size_t i = 0; i < count; ++i)
+		outScale[i] = outScale[i] > 1 ? 1 / outScale[i] : 1;
+	for (double &scale : linkOutScale)
+		scale = scale > 1 ? 1 / scale : 1;
+
+	for (std::size_t element = 0; element < species; ++element) {
+		ElementId id = static_cast<ElementId>(element);
+		double *plane = species_moles(id);
+		std::fill(delta.begin(), delta.end(), 0.0);
+		exchange(plane, false);
+		for (std::size_t l = 0; l < linkCount; ++l) {
+			std::size_t i = links[l].cell;
+			std::size_t a = links[l].atmosphere;
+			double f = linkFractions[l];
+			double amount = f > 0
+				? f * outScale[i] * plane[i]
+				: f * linkOutScale[a] * linkedAtmospheres[a]->get_moles(id);
+			if (amount == 0)
+				continue;
+			delta[i] -= amount;
+			linkFlux[a].add_moles(id, amount);
+		}
+		for (std::size_t i = 0; i < count; ++i)
+			plane[i] = std::max(0.0, plane[i] + delta[i]);
+	}
+
+	std::fill(delta.begin(), delta.end(), 0.0);
+	exchange(heatEnergy.data(), true);
+	for (std::size_t l = 0; l < linkCount; ++l) {
+		std::size_t i = links[l].cell;
+		std::size_t a = links[l].atmosphere;
+		double f = linkFractions[l];
+		double amount = f > 0
+			? f * outScale[i] * heatEnergy[i]
+			: f * linkOutScale[a] * linkedAtmospheres[a]->heatEnergy;
+		amount += linkHeat[l];
+		delta[i] -= amount;
+		linkFlux[a].heat += amount;
+	}
+
+	// rebuild the aggregates from the planes rather than tracking every edge
+	std::fill(totalMoles.begin(), totalMoles.end(), 0.0);
+	std::fill(totalMass.begin(), totalMass.end(), 0.0);
+	std::fill(massHeatCapacity.begin(), massHeatCapacity.end(), 0.0);
+	std::fill(massThermalConductivity.begin(), massThermalConductivity.end(), 0.0);
+	double const *molarMasses = atmosphericsElements.molar_masses();
+	double const *heatCapacities = atmosphericsElements.heat_capacities_moles();
+	double const *thermalConductivities = atmosphericsElements.thermal_conductivities();
+	for (std::size_t element = 0; element < species; ++element) {
+		double const *plane = species_moles(static_cast<ElementId>(element));
+		double molarMass = molarMasses[element];
+		double heatCapacity = heatCapacities[element];
+		double thermalConductivity = thermalConductivities[element];
+		for (std::size_t i = 0; i < count; ++i) {
+			double mass = plane[i] * molarMass;
+			totalMoles[i] += plane[i];
+			totalMass[i] += mass;
+			massHeatCapacity[i] += mass * heatCapacity;
+			massThermalConductivity[i] += mass * thermalConductivity;
+		}
+	}
+	double largestPressureChange = 0;
+	double largestTemperatureChange = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		double heatCapacity = totalMass[i] > 0 ? totalMoles[i] * massHeatCapacity[i] / totalMass[i] : 0;
+		double heat = heatEnergy[i] + delta[i];
+		// same floor as Atmosphere::add_heat
+		if (delta[i] < 0)
+			heat = std::max(heatCapacity * minTemperature, heat);
+		bool empty = heat <= 0 || heatCapacity <= 0;
+		double temperature = empty ? minTemperature : heat / heatCapacity;
+		double pressure = totalMoles[i] * gasConstant * temperature / cellVolume;
+		largestPressureChange = std::max(largestPressureChange, std::abs(pressure - pressures[i]));
+		largestTemperatureChange = std::max(largestTemperatureChange, std::abs(temperature - tempKelvin[i]));
+		heatEnergy[i] = empty ? 0 : heat;
+		tempKelvin[i] = temperature;
+	}
+	pressureChange = largestPressureChange;
+	temperatureChange = largestTemperatureChange;
+
+	for (std::size_t a = 0; a < linkedAtmospheres.size(); ++a) {
+		linkedAtmospheres[a]->apply_flux(linkFlux[a]);
+		linkFlux[a].clear();
+	}
+}
+}
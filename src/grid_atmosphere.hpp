@@ -0,0 +1,160 @@
+#ifndef GRID_ATMOSPHERE_HPP
+#define GRID_ATMOSPHERE_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "atmospherics_flux.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ZAtmos {
+// A 2D or 3D grid of equally sized cells, each behaving like an Atmosphere
+// joined to its neighbours by an open Valve. Moles are stored as one plane
+// per species (moles[element * cell_count() + cell]), and every step runs the
+// same pressure-driven flow as Atmosphere::mix_with plus the same conduction
+// as Atmosphere::mix_temperatures across every open edge. All edges are worked
+// out from the state at the start of the step and applied together, in loops
+// over contiguous rows the compiler can vectorize.
+//
+// Walls and doors block single edges. Cells can be linked to ordinary
+// atmospheres, which exchange gas with them the same way, so devices hooked
+// up to those atmospheres keep working.
+struct GridAtmosphere {
+private:
+	std::size_t width, height, depth;
+	// species allocated in moles
+	std::size_t species = 0;
+	// per cell, cached like Atmosphere's aggregates
+	std::vector<double> totalMoles; // mol
+	std::vector<double> totalMass; // kg
+	std::vector<double> massHeatCapacity; // Σ kg · J / K·mol
+	std::vector<double> massThermalConductivity; // Σ kg · W / m·K
+
+	struct Link {
+		std::size_t cell;
+		// index into linkedAtmospheres
+		std::size_t atmosphere;
+	};
+	std::vector<Link> links;
+	std::vector<Atmosphere *> linkedAtmospheres;
+
+	// scratch for step()
+	// per axis and cell, share of the source's gas crossing the edge to the
+	// next cell, negative when it flows back
+	std::vector<double> edgeFractions[3];
+	// per axis and cell, J conducted across the edge to the next cell
+	std::vector<double> edgeHeat[3];
+	// per link, same as above with the cell as this side
+	std::vector<double> linkFractions;
+	std::vector<double> linkHeat;
+	// per cell and linked atmosphere, share of gas flowing out, then the scale keeping that at most 1
+	std::vector<double> outScale;
+	std::vector<double> linkOutScale;
+	// per cell, from the state at the start of the step
+	std::vector<double> pressures; // kPa
+	std::vector<double> conductivities; // W/K·m
+	std::vector<double> capacities; // J/K
+	// per cell, amount crossing each edge and net change
+	std::vector<double> flow;
+	std::vector<double> delta;
+	std::vector<AtmosphericsFlux> linkFlux;
+	// largest change of any cell over the last step
+	double pressureChange = 0; // kPa
+	double temperatureChange = 0; // K
+
+	void reserve_species(std::size_t elements);
+	// adds delta moles of element to cell (clamped at 0), returns the actual change
+	double change_moles(std::size_t cell, ElementId element, double delta);
+	void recalculate_dirty(std::size_t cell);
+	// moves the contents of plane (one species, or heatEnergy) across every edge
+	// into delta, heat adds edgeHeat on top
+	void exchange(double const *plane, bool heat);
+	// mol that mix_with would move from a to b, negative is towards a
+	double mix_flow(double pressureA, double pressureB, double dt) const;
+public:
+	// Edge bits in blocked, one per axis.
+	static constexpr std::uint8_t BLOCK_X = 1;
+	static constexpr std::uint8_t BLOCK_Y = 2;
+	static constexpr std::uint8_t BLOCK_Z = 4;
+
+	// Same meaning and defaults as on Atmosphere
+	double gasConstant = 8.31446261815324;
+	double minTemperature = 0.001; // K
+	double mixRate = 5; // L/kPa·s
+	double maxPressure = 1000;
+	double tempMixRate = 100;
+	// L
+	double cellVolume;
+
+	// mol, moles[element * cell_count() + cell]
+	std::vector<double> moles;
+	// J
+	std::vector<double> heatEnergy;
+	// K
+	std::vector<double> tempKelvin;
+	// per cell, BLOCK_* bits for the edges to the next cell along each axis
+	std::vector<std::uint8_t> blocked;
+
+	// depth = 1 for a 2D grid
+	GridAtmosphere(std::size_t width, std::size_t height, std::size_t depth, double cellVolume);
+
+	inline std::size_t get_width() const { return width; }
+	inline std::size_t get_height() const { return height; }
+	inline std::size_t get_depth() const { return depth; }
+	inline std::size_t cell_count() const { return width * height * depth; }
+	inline std::size_t cell(std::size_t x, std::size_t y, std::size_t z = 0) const
+	{
+		return x + width * (y + height * z);
+	}
+	inline double *species_moles(ElementId element) { return moles.data() + element * cell_count(); }
+	inline double const *species_moles(ElementId element) const { return moles.data() + element * cell_count(); }
+
+	// Blocks or opens the edge between cell and the next cell along axis (0 = x, 1 = y, 2 = z).
+	void set_blocked(std::size_t cell, unsigned axis, bool blocked);
+	bool is_blocked(std::size_t cell, unsigned axis) const;
+
+	void add_moles_temp(std::size_t cell, ElementId element, double moles, double tempKelvin);
+	void add_moles_heat(std::size_t cell, ElementId element, double moles, double heatEnergy);
+	void remove(std::size_t cell, ElementId element, double moles);
+	// J
+	void add_heat(std::size_t cell, double heatEnergy);
+	// Overwrites cell with the contents of sourceCell in source.
+	void copy_cell(std::size_t cell, GridAtmosphere const &source, std::size_t sourceCell);
+	// Leaves cell as vacuum.
+	void clear_cell(std::size_t cell);
+
+	// mol
+	double get_moles(std::size_t cell) const;
+	// mol
+	double get_moles(std::size_t cell, ElementId element) const;
+	// K
+	double get_temperature(std::size_t cell) const;
+	// kPa
+	double get_pressure(std::size_t cell) const;
+	// J / K
+	double get_heat_capacity(std::size_t cell) const;
+	// W/K·m
+	double get_thermal_conductivity(std::size_t cell) const;
+
+	// Lets gas and heat flow between cell and atmosphere like an open Valve.
+	// atmosphere must outlive the grid or be unlinked first.
+	void link(std::size_t cell, Atmosphere &atmosphere);
+	void unlink(std::size_t cell, Atmosphere &atmosphere);
+	inline std::size_t link_count() const { return links.size(); }
+
+	void step(double dt);
+	// step() in two halves for callers stitching several grids together.
+	// begin_step() works out every edge from the current state, after which
+	// outflow(cell) is the share of the cell's gas leaving it. end_step()
+	// moves the gas, scaling down the outflows of cells where that's over 1.
+	void begin_step(double dt);
+	void end_step();
+	inline double &outflow(std::size_t cell) { return outScale[cell]; }
+	// Largest change of pressure (kPa) and temperature (K) of any cell during the last step.
+	inline double last_pressure_change() const { return pressureChange; }
+	inline double last_temperature_change() const { return temperatureChange; }
+};
+}
+
+#endif
@@ -2,88 +2,145 @@
 #define REGISTRY_HPP
 
 
+#include <cstddef>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace ZAtmos {
+// Values are stored densely in registration order, so every key also gets a
+// stable integer id (0, 1, 2...) that can be used instead of hashing the key.
 template <typename T>
 struct ImmutableRegistry {
-private:
-	std::unordered_map<std::string, T> map;
+protected:
+	std::vector<T> values;
+	std::vector<std::string> keys;
+	std::unordered_map<std::string, std::size_t> ids;
 public:
 	inline ImmutableRegistry()
 	{}
 
-	inline bool has_key(std::string const &key)
+	inline bool has_key(std::string const &key) const
+	{
+		return ids.count(key) > 0;
+	}
+	inline bool has_id(std::size_t id) const
+	{
+		return id < values.size();
+	}
+	// Number of registered values, ids are [0, size())
+	inline std::size_t size() const
+	{
+		return values.size();
+	}
+	// Returns true if key is found.
+	inline bool try_get_id(std::string const &key, std::size_t &out) const
+	{
+		auto it = ids.find(key);
+		if (it == ids.end())
+			return false;
+		out = it->second;
+		return true;
+	}
+	// Throws if key is not in registry.
+	inline std::size_t id_of(std::string const &key) const
+	{
+		auto it = ids.find(key);
+		if (it == ids.end())
+			throw std::invalid_argument("Key '" + key + "' not found in registry");
+		return it->second;
+	}
+	// Throws if id is not in registry.
+	inline std::string const &key_of(std::size_t id) const
 	{
-		return map.count(key) > 0;
+		if (!has_id(id))
+			throw std::invalid_argument("Id " + std::to_string(id) + " not found in registry");
+		return keys[id];
 	}
 	// Returns true if key is found.
-	inline bool try_cget(std::string const &key, T const *&out)
+	inline bool try_cget(std::string const &key, T const *&out) const
 	{
-		if (has_key(key)) {
-			out = &map[key];
+		std::size_t id;
+		if (try_get_id(key, id)) {
+			out = &values[id];
 			return true;
 		}
 		return false;
 	}
 	// Throws if key is not in registry.
-	inline T const *cget(std::string const &key)
+	inline T const *cget(std::string const &key) const
 	{
-		if (has_key(key))
-			return &map[key];
-		throw std::invalid_argument("Key '" + key + "' not found in registry");
-		return nullptr; // shouldn't be reached but shh
+		return &values[id_of(key)];
+	}
+	// Throws if id is not in registry.
+	inline T const *cget(std::size_t id) const
+	{
+		if (!has_id(id))
+			throw std::invalid_argument("Id " + std::to_string(id) + " not found in registry");
+		return &values[id];
 	}
-	// Adds key:value to registry
-	inline void add(std::string const &key, T const &value)
+	// Adds key:value to registry, returns the id assigned to it.
+	// Pointers returned by cget() are invalidated by later calls to add().
+	inline std::size_t add(std::string const &key, T const &value)
 	{
-		if (has_key(key)) {
+		if (has_key(key))
 			throw std::invalid_argument("Key '" + key + "' has already been registered");
-			return;
-		}
-		map[key] = value;
+		std::size_t id = values.size();
+		values.push_back(value);
+		keys.push_back(key);
+		ids[key] = id;
+		return id;
 	}
 
-	inline T const *operator[](std::string const &key)
+	inline T const *operator[](std::string const &key) const
 	{
 		return cget(key);
 	}
+	// Unchecked, id must have come from this registry.
+	inline T const *operator[](std::size_t id) const
+	{
+		return &values[id];
+	}
 };
 
 template <typename T>
 struct MutableRegistry : public ImmutableRegistry<T> {
 private:
-	std::unordered_map<std::string, T> &map = ImmutableRegistry<T>::map;
+	std::vector<T> &values = ImmutableRegistry<T>::values;
 public:
 	inline bool try_get(std::string const &key, T *&out)
 	{
-		if (ImmutableRegistry<T>::has_key(key)) {
-			out = &map[key];
+		std::size_t id;
+		if (ImmutableRegistry<T>::try_get_id(key, id)) {
+			out = &values[id];
 			return true;
 		}
 		return false;
 	}
 	inline T *get(std::string const &key)
 	{
-		if (ImmutableRegistry<T>::has_key(key))
-			return &map[key];
-		throw std::invalid_argument("Key '" + key + "' not found in registry");
-		return nullptr;
+		return &values[ImmutableRegistry<T>::id_of(key)];
+	}
+	inline T *get(std::size_t id)
+	{
+		if (!ImmutableRegistry<T>::has_id(id))
+			throw std::invalid_argument("Id " + std::to_string(id) + " not found in registry");
+		return &values[id];
 	}
 	inline void set(std::string const &key, T const &value)
 	{
-		if (ImmutableRegistry<T>::has_key(key)) {
-			map[key] = value;
-		} else {
-			throw std::invalid_argument("Key '" + key + "' not found in registry");
-		}
+		values[ImmutableRegistry<T>::id_of(key)] = value;
 	}
 	inline T *operator[](std::string const &key)
 	{
 		return get(key);
 	}
+	// Unchecked, id must have come from this registry.
+	inline T *operator[](std::size_t id)
+	{
+		return &values[id];
+	}
 };
 }
 
@@ -0,0 +1,377 @@
+#include "sparse_grid_atmosphere.hpp"
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "grid_atmosphere.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ZAtmos {
+SparseGridAtmosphere::Chunk::Chunk(std::size_t index, std::size_t const extent[3], bool const halo[3], double cellVolume)
+	: grid(extent[0] + halo[0], extent[1] + halo[1], extent[2] + halo[2], cellVolume), index(index),
+	  extent { extent[0], extent[1], extent[2] }
+{
+	std::size_t size[3] = { grid.get_width(), grid.get_height(), grid.get_depth() };
+	for (std::size_t z = 0; z < size[2]; ++z) {
+		for (std::size_t y = 0; y < size[1]; ++y) {
+			for (std::size_t x = 0; x < size[0]; ++x) {
+				std::size_t coordinates[3] = { x, y, z };
+				unsigned outside = 0;
+				unsigned axis = 0;
+				for (unsigned a = 0; a < 3; ++a) {
+					if (coordinates[a] >= extent[a]) {
+						++outside;
+						axis = a;
+					}
+				}
+				if (outside == 0)
+					continue;
+				// halo cells only ever trade with the interior cell behind them
+				std::size_t cell = grid.cell(x, y, z);
+				grid.blocked[cell] = GridAtmosphere::BLOCK_X | GridAtmosphere::BLOCK_Y | GridAtmosphere::BLOCK_Z;
+				if (outside == 1) {
+					coordinates[axis] = 0;
+					halos.push_back(HaloCell { cell, axis, coordinates[0], coordinates[1], coordinates[2] });
+				}
+			}
+		}
+	}
+}
+
+SparseGridAtmosphere::SparseGridAtmosphere(std::size_t width, std::size_t height, std::size_t depth, double cellVolume)
+	: width(width), height(height), depth(depth), cellVolume(cellVolume)
+{
+	if (width == 0 || height == 0 || depth == 0)
+		throw std::invalid_argument("Grid atmosphere needs at least one cell along every axis");
+	if (cellVolume <= 0)
+		throw std::invalid_argument("Grid atmosphere cells need a positive volume");
+	chunkCounts[0] = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	chunkCounts[1] = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	chunkCounts[2] = (depth + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	chunks.resize(chunkCounts[0] * chunkCounts[1] * chunkCounts[2]);
+}
+
+std::size_t SparseGridAtmosphere::chunk_index(std::size_t x, std::size_t y, std::size_t z) const
+{
+	return x / CHUNK_SIZE + chunkCounts[0] * (y / CHUNK_SIZE + chunkCounts[1] * (z / CHUNK_SIZE));
+}
+std::size_t SparseGridAtmosphere::next_chunk(std::size_t index, unsigned axis) const
+{
+	std::size_t stride = axis == 0 ? 1 : axis == 1 ? chunkCounts[0] : chunkCounts[0] * chunkCounts[1];
+	std::size_t coordinate = index / stride % chunkCounts[axis];
+	return coordinate + 1 < chunkCounts[axis] ? index + stride : SIZE_MAX;
+}
+std::size_t SparseGridAtmosphere::previous_chunk(std::size_t index, unsigned axis) const
+{
+	std::size_t stride = axis == 0 ? 1 : axis == 1 ? chunkCounts[0] : chunkCounts[0] * chunkCounts[1];
+	std::size_t coordinate = index / stride % chunkCounts[axis];
+	return coordinate > 0 ? index - stride : SIZE_MAX;
+}
+SparseGridAtmosphere::Chunk &SparseGridAtmosphere::allocate(std::size_t index)
+{
+	std::size_t coordinates[3] = {
+		index % chunkCounts[0],
+		index / chunkCounts[0] % chunkCounts[1],
+		index / (chunkCounts[0] * chunkCounts[1]),
+	};
+	std::size_t size[3] = { width, height, depth };
+	std::size_t extent[3];
+	bool halo[3];
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		extent[axis] = std::min(CHUNK_SIZE, size[axis] - coordinates[axis] * CHUNK_SIZE);
+		halo[axis] = coordinates[axis] + 1 < chunkCounts[axis];
+	}
+	chunks[index] = std::make_unique<Chunk>(index, extent, halo, cellVolume);
+	configure(chunks[index]->grid);
+	allocated.push_back(index);
+	return *chunks[index];
+}
+SparseGridAtmosphere::Chunk *SparseGridAtmosphere::find(std::size_t x, std::size_t y, std::size_t z, std::size_t &cell) const
+{
+	check_cell(x, y, z);
+	Chunk *chunk = chunks[chunk_index(x, y, z)].get();
+	if (chunk != nullptr)
+		cell = chunk->grid.cell(x % CHUNK_SIZE, y % CHUNK_SIZE, z % CHUNK_SIZE);
+	return chunk;
+}
+SparseGridAtmosphere::Chunk &SparseGridAtmosphere::touch(std::size_t x, std::size_t y, std::size_t z, std::size_t &cell)
+{
+	Chunk *chunk = find(x, y, z, cell);
+	if (chunk == nullptr) {
+		chunk = &allocate(chunk_index(x, y, z));
+		cell = chunk->grid.cell(x % CHUNK_SIZE, y % CHUNK_SIZE, z % CHUNK_SIZE);
+	}
+	chunk->quietSteps = 0;
+	return *chunk;
+}
+void SparseGridAtmosphere::check_cell(std::size_t x, std::size_t y, std::size_t z) const
+{
+	if (x >= width || y >= height || z >= depth)
+		throw std::invalid_argument("Cell " + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + " is not part of this grid");
+}
+void SparseGridAtmosphere::configure(GridAtmosphere &grid) const
+{
+	grid.gasConstant = gasConstant;
+	grid.minTemperature = minTemperature;
+	grid.mixRate = mixRate;
+	grid.maxPressure = maxPressure;
+	grid.tempMixRate = tempMixRate;
+	grid.cellVolume = cellVolume;
+}
+
+void SparseGridAtmosphere::fill_halos(Chunk &chunk)
+{
+	std::size_t stride = atmosphericsElements.size() + 1;
+	chunk.haloStart.resize(chunk.halos.size() * stride);
+	double *start = chunk.haloStart.data();
+	for (HaloCell const &halo : chunk.halos) {
+		std::size_t next = next_chunk(chunk.index, halo.axis);
+		Chunk const *neighbour = chunks[next].get();
+		if (neighbour != nullptr)
+			chunk.grid.copy_cell(halo.cell, neighbour->grid, neighbour->grid.cell(halo.x, halo.y, halo.z));
+		else
+			chunk.grid.clear_cell(halo.cell);
+		for (std::size_t element = 0; element + 1 < stride; ++element)
+			start[element] = chunk.grid.get_moles(halo.cell, static_cast<ElementId>(element));
+		start[stride - 1] = chunk.grid.heatEnergy[halo.cell];
+		start += stride;
+	}
+}
+void SparseGridAtmosphere::share_outflows(Chunk &chunk, bool gather)
+{
+	for (HaloCell const &halo : chunk.halos) {
+		Chunk *neighbour = chunks[next_chunk(chunk.index, halo.axis)].get();
+		if (neighbour == nullptr || !neighbour->stepping)
+			continue;
+		double &total = neighbour->grid.outflow(neighbour->grid.cell(halo.x, halo.y, halo.z));
+		if (gather)
+			chunk.grid.outflow(halo.cell) = total;
+		else
+			total += chunk.grid.outflow(halo.cell);
+	}
+}
+void SparseGridAtmosphere::forward_halos(Chunk &chunk)
+{
+	std::size_t stride = atmosphericsElements.size() + 1;
+	double const *start = chunk.haloStart.data();
+	for (HaloCell const &halo : chunk.halos) {
+		double const *before = start;
+		start += stride;
+		double gained = 0;
+		bool changed = false;
+		for (std::size_t element = 0; element + 1 < stride; ++element) {
+			double delta = chunk.grid.get_moles(halo.cell, static_cast<ElementId>(element)) - before[element];
+			gained += delta;
+			changed |= delta != 0;
+		}
+		double heat = chunk.grid.heatEnergy[halo.cell] - before[stride - 1];
+		if (!changed && heat == 0)
+			continue;
+		std::size_t next = next_chunk(chunk.index, halo.axis);
+		Chunk *neighbour = chunks[next].get();
+		if (neighbour == nullptr) {
+			// gas spilling into vacuum only gets a chunk once there's enough of it
+			if (gained <= vacuumMoles)
+				continue;
+			neighbour = &allocate(next);
+		}
+		GridAtmosphere &grid = neighbour->grid;
+		std::size_t cell = grid.cell(halo.x, halo.y, halo.z);
+		double pressure = grid.get_pressure(cell);
+		double temperature = grid.get_temperature(cell);
+		for (std::size_t element = 0; element + 1 < stride; ++element) {
+			ElementId id = static_cast<ElementId>(element);
+			double delta = chunk.grid.get_moles(halo.cell, id) - before[element];
+			if (delta != 0)
+				grid.add_moles_heat(cell, id, delta, 0);
+		}
+		grid.add_heat(cell, heat);
+		if (std::abs(grid.get_pressure(cell) - pressure) > sleepPressureEpsilon
+			|| std::abs(grid.get_temperature(cell) - temperature) > sleepTemperatureEpsilon)
+			neighbour->quietSteps = 0;
+	}
+}
+double SparseGridAtmosphere::face_moles(Chunk const &chunk, unsigned axis) const
+{
+	std::size_t end[3] = { chunk.extent[0], chunk.extent[1], chunk.extent[2] };
+	end[axis] = 1;
+	double total = 0;
+	for (std::size_t z = 0; z < end[2]; ++z)
+		for (std::size_t y = 0; y < end[1]; ++y)
+			for (std::size_t x = 0; x < end[0]; ++x)
+				total += chunk.grid.get_moles(chunk.grid.cell(x, y, z));
+	return total;
+}
+double SparseGridAtmosphere::chunk_moles(Chunk const &chunk) const
+{
+	double total = 0;
+	for (std::size_t z = 0; z < chunk.extent[2]; ++z)
+		for (std::size_t y = 0; y < chunk.extent[1]; ++y)
+			for (std::size_t x = 0; x < chunk.extent[0]; ++x)
+				total += chunk.grid.get_moles(chunk.grid.cell(x, y, z));
+	return total;
+}
+
+void SparseGridAtmosphere::set_blocked(std::size_t x, std::size_t y, std::size_t z, unsigned axis, bool blocked)
+{
+	check_cell(x, y, z);
+	std::size_t coordinates[3] = { x, y, z };
+	std::size_t size[3] = { width, height, depth };
+	if (axis > 2 || coordinates[axis] + 1 >= size[axis])
+		throw std::invalid_argument("Edge " + std::to_string(axis) + " of cell " + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + " leads out of this grid");
+	std::size_t cell;
+	Chunk *chunk = find(x, y, z, cell);
+	if (chunk == nullptr && !blocked)
+		return;
+	// walls keep their chunk allocated even while it's vacuum
+	if (chunk == nullptr)
+		chunk = &touch(x, y, z, cell);
+	chunk->grid.set_blocked(cell, axis, blocked);
+	chunk->walls |= blocked;
+	chunk->quietSteps = 0;
+}
+bool SparseGridAtmosphere::is_blocked(std::size_t x, std::size_t y, std::size_t z, unsigned axis) const
+{
+	std::size_t cell;
+	Chunk const *chunk = find(x, y, z, cell);
+	return chunk != nullptr && chunk->grid.is_blocked(cell, axis);
+}
+
+void SparseGridAtmosphere::add_moles_temp(std::size_t x, std::size_t y, std::size_t z, ElementId element, double moles, double tempKelvin)
+{
+	std::size_t cell;
+	touch(x, y, z, cell).grid.add_moles_temp(cell, element, moles, tempKelvin);
+}
+void SparseGridAtmosphere::remove(std::size_t x, std::size_t y, std::size_t z, ElementId element, double moles)
+{
+	std::size_t cell;
+	Chunk *chunk = find(x, y, z, cell);
+	if (chunk == nullptr)
+		return;
+	chunk->grid.remove(cell, element, moles);
+	chunk->quietSteps = 0;
+}
+void SparseGridAtmosphere::add_heat(std::size_t x, std::size_t y, std::size_t z, double heatEnergy)
+{
+	std::size_t cell;
+	Chunk *chunk = find(x, y, z, cell);
+	// vacuum can't hold heat
+	if (chunk == nullptr)
+		return;
+	chunk->grid.add_heat(cell, heatEnergy);
+	chunk->quietSteps = 0;
+}
+
+double SparseGridAtmosphere::get_moles(std::size_t x, std::size_t y, std::size_t z) const
+{
+	std::size_t cell;
+	Chunk const *chunk = find(x, y, z, cell);
+	return chunk != nullptr ? chunk->grid.get_moles(cell) : 0;
+}
+double SparseGridAtmosphere::get_moles(std::size_t x, std::size_t y, std::size_t z, ElementId element) const
+{
+	std::size_t cell;
+	Chunk const *chunk = find(x, y, z, cell);
+	return chunk != nullptr ? chunk->grid.get_moles(cell, element) : 0;
+}
+double SparseGridAtmosphere::get_temperature(std::size_t x, std::size_t y, std::size_t z) const
+{
+	std::size_t cell;
+	Chunk const *chunk = find(x, y, z, cell);
+	return chunk != nullptr ? chunk->grid.get_temperature(cell) : minTemperature;
+}
+double SparseGridAtmosphere::get_pressure(std::size_t x, std::size_t y, std::size_t z) const
+{
+	std::size_t cell;
+	Chunk const *chunk = find(x, y, z, cell);
+	return chunk != nullptr ? chunk->grid.get_pressure(cell) : 0;
+}
+
+void SparseGridAtmosphere::link(std::size_t x, std::size_t y, std::size_t z, Atmosphere &atmosphere)
+{
+	std::size_t cell;
+	touch(x, y, z, cell).grid.link(cell, atmosphere);
+}
+void SparseGridAtmosphere::unlink(std::size_t x, std::size_t y, std::size_t z, Atmosphere &atmosphere)
+{
+	std::size_t cell;
+	Chunk *chunk = find(x, y, z, cell);
+	if (chunk != nullptr)
+		chunk->grid.unlink(cell, atmosphere);
+}
+
+void SparseGridAtmosphere::step(double dt)
+{
+	auto active = [&](Chunk const &chunk) {
+		return chunk.quietSteps < sleepDelay || chunk.grid.link_count() > 0;
+	};
+	// gas at the low face of a chunk can only leave through the edges owned by
+	// the chunk before it, so that one has to exist
+	for (std::size_t i = 0; i < allocated.size(); ++i) {
+		Chunk const &chunk = *chunks[allocated[i]];
+		if (!active(chunk))
+			continue;
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			std::size_t previous = previous_chunk(chunk.index, axis);
+			if (previous != SIZE_MAX && chunks[previous] == nullptr && face_moles(chunk, axis) > vacuumMoles)
+				allocate(previous);
+		}
+	}
+	// sweep active chunks and the ones around them, whose halos or edges they share
+	for (std::size_t index : allocated) {
+		Chunk &chunk = *chunks[index];
+		if (!active(chunk))
+			continue;
+		chunk.stepping = true;
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			for (std::size_t neighbour : { previous_chunk(index, axis), next_chunk(index, axis) })
+				if (neighbour != SIZE_MAX && chunks[neighbour] != nullptr)
+					chunks[neighbour]->stepping = true;
+		}
+	}
+	stepping.clear();
+	for (std::size_t index : allocated)
+		if (chunks[index]->stepping)
+			stepping.push_back(chunks[index].get());
+
+	// halos have to be filled from every chunk before any of them steps
+	for (Chunk *chunk : stepping)
+		fill_halos(*chunk);
+	for (Chunk *chunk : stepping) {
+		configure(chunk->grid);
+		chunk->grid.begin_step(dt);
+	}
+	// a cell on a chunk face gives gas away through its own chunk and the
+	// halos of the ones before it, all of which have to agree on its total
+	for (Chunk *chunk : stepping)
+		share_outflows(*chunk, false);
+	for (Chunk *chunk : stepping)
+		share_outflows(*chunk, true);
+	for (Chunk *chunk : stepping)
+		chunk->grid.end_step();
+	for (Chunk *chunk : stepping)
+		forward_halos(*chunk);
+	for (Chunk *chunk : stepping) {
+		chunk->stepping = false;
+		if (chunk->grid.last_pressure_change() > sleepPressureEpsilon
+			|| chunk->grid.last_temperature_change() > sleepTemperatureEpsilon)
+			chunk->quietSteps = 0;
+		else if (chunk->quietSteps < sleepDelay)
+			++chunk->quietSteps;
+	}
+
+	// drop settled chunks that are (close enough to) vacuum
+	std::erase_if(allocated, [&](std::size_t index) {
+		Chunk const &chunk = *chunks[index];
+		if (active(chunk) || chunk.walls || chunk_moles(chunk) > vacuumMoles)
+			return false;
+		chunks[index].reset();
+		return true;
+	});
+}
+}
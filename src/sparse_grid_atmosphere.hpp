@@ -0,0 +1,132 @@
+#ifndef SPARSE_GRID_ATMOSPHERE_HPP
+#define SPARSE_GRID_ATMOSPHERE_HPP
+
+#include "atmosphere.hpp"
+#include "atmospherics_element.hpp"
+#include "grid_atmosphere.hpp"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ZAtmos {
+// A large grid split into CHUNK_SIZE³ chunks (CHUNK_SIZE² for 2D), each a
+// GridAtmosphere allocated only once something is in it, so memory follows
+// occupied space rather than map bounds. Unallocated chunks are vacuum.
+//
+// Each chunk carries a one cell halo on its +x/+y/+z sides holding copies of
+// its neighbours' first cells, so it owns exactly the edges leading out of
+// its cells. Halos are filled from the state at the start of the step and
+// whatever flowed into them is handed on to the neighbour afterwards, which
+// gives the same result as one big grid.
+//
+// Chunks fall asleep after sleepDelay steps without a cell changing by more
+// than the epsilons, and only active chunks plus their neighbours are swept.
+// Any change made through this interface wakes the chunk it touches.
+struct SparseGridAtmosphere {
+	static constexpr std::size_t CHUNK_SIZE = 16;
+private:
+	struct HaloCell {
+		// cell in the chunk's grid
+		std::size_t cell;
+		unsigned axis;
+		// coordinates of the copied cell in the next chunk along axis
+		std::size_t x, y, z;
+	};
+	struct Chunk {
+		GridAtmosphere grid;
+		std::size_t index;
+		// interior cells along each axis, the grid is one longer where there's a halo
+		std::size_t extent[3];
+		std::vector<HaloCell> halos;
+		// moles per species then heat of each halo cell at the start of the step
+		std::vector<double> haloStart;
+		unsigned quietSteps = 0;
+		bool walls = false;
+		bool stepping = false;
+
+		Chunk(std::size_t index, std::size_t const extent[3], bool const halo[3], double cellVolume);
+	};
+
+	std::size_t width, height, depth;
+	// chunks along each axis
+	std::size_t chunkCounts[3];
+	// by chunk coordinate, empty when unallocated
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	// indices of allocated chunks
+	std::vector<std::size_t> allocated;
+	std::vector<Chunk *> stepping;
+
+	std::size_t chunk_index(std::size_t x, std::size_t y, std::size_t z) const;
+	// next chunk along axis, or SIZE_MAX past the edge of the map
+	std::size_t next_chunk(std::size_t index, unsigned axis) const;
+	std::size_t previous_chunk(std::size_t index, unsigned axis) const;
+	Chunk &allocate(std::size_t index);
+	// chunk holding (x, y, z) and the cell's index in its grid, null if unallocated
+	Chunk *find(std::size_t x, std::size_t y, std::size_t z, std::size_t &cell) const;
+	Chunk &touch(std::size_t x, std::size_t y, std::size_t z, std::size_t &cell);
+	void check_cell(std::size_t x, std::size_t y, std::size_t z) const;
+	void configure(GridAtmosphere &grid) const;
+	void fill_halos(Chunk &chunk);
+	// adds halo outflows onto the cells they copy, or with gather copies the totals back
+	void share_outflows(Chunk &chunk, bool gather);
+	void forward_halos(Chunk &chunk);
+	double face_moles(Chunk const &chunk, unsigned axis) const;
+	double chunk_moles(Chunk const &chunk) const;
+public:
+	// Same meaning and defaults as on Atmosphere
+	double gasConstant = 8.31446261815324;
+	double minTemperature = 0.001; // K
+	double mixRate = 5; // L/kPa·s
+	double maxPressure = 1000;
+	double tempMixRate = 100;
+	// L
+	double cellVolume;
+
+	// kPa and K a cell may change by in one step while its chunk counts as settled
+	double sleepPressureEpsilon = 0.01;
+	double sleepTemperatureEpsilon = 0.01;
+	// settled steps before a chunk stops being swept
+	unsigned sleepDelay = 10;
+	// mol, traces below this don't spill into unallocated chunks, and settled
+	// chunks holding less in total are freed (the trace is lost)
+	double vacuumMoles = 1e-6;
+
+	// depth = 1 for a 2D grid
+	SparseGridAtmosphere(std::size_t width, std::size_t height, std::size_t depth, double cellVolume);
+
+	inline std::size_t get_width() const { return width; }
+	inline std::size_t get_height() const { return height; }
+	inline std::size_t get_depth() const { return depth; }
+
+	// Blocks or opens the edge between (x, y, z) and the next cell along axis (0 = x, 1 = y, 2 = z).
+	void set_blocked(std::size_t x, std::size_t y, std::size_t z, unsigned axis, bool blocked);
+	bool is_blocked(std::size_t x, std::size_t y, std::size_t z, unsigned axis) const;
+
+	void add_moles_temp(std::size_t x, std::size_t y, std::size_t z, ElementId element, double moles, double tempKelvin);
+	void remove(std::size_t x, std::size_t y, std::size_t z, ElementId element, double moles);
+	// J
+	void add_heat(std::size_t x, std::size_t y, std::size_t z, double heatEnergy);
+
+	// mol
+	double get_moles(std::size_t x, std::size_t y, std::size_t z) const;
+	// mol
+	double get_moles(std::size_t x, std::size_t y, std::size_t z, ElementId element) const;
+	// K
+	double get_temperature(std::size_t x, std::size_t y, std::size_t z) const;
+	// kPa
+	double get_pressure(std::size_t x, std::size_t y, std::size_t z) const;
+
+	// Lets gas and heat flow between (x, y, z) and atmosphere like an open
+	// Valve, see GridAtmosphere::link. Linked chunks never sleep.
+	void link(std::size_t x, std::size_t y, std::size_t z, Atmosphere &atmosphere);
+	void unlink(std::size_t x, std::size_t y, std::size_t z, Atmosphere &atmosphere);
+
+	void step(double dt);
+
+	inline std::size_t allocated_chunk_count() const { return allocated.size(); }
+	// Chunks swept by the last step.
+	inline std::size_t active_chunk_count() const { return stepping.size(); }
+};
+}
+
+#endif